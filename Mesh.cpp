@@ -1,11 +1,33 @@
 #include "Mesh.h"
 #include "similarity.h"
-#include "area.h"
 #include "serialize.h"
+#include "subdivision.h"
+#include "center_cache.h"
+#include "center_integrator.h"
+#include "half_float.h"
+#include "mesh_bundle.h"
+#include "vertex_order.h"
+#include "weight_signature.h"
 
 #include <Eigen/Dense>
 
-#define DIVISION_BY_ZERO_THRESHOLD 1e-10
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+
+// work granularity of the precomputation
+#define VERTEX_CHUNK_SIZE 16
+
+// relative spread of similarities accepted over a node of triangles,
+// narrowed until the approximate centers are within the error
+#define INITIAL_RELATIVE_SPREAD 0.5f
+#define MINIMUM_RELATIVE_SPREAD 1e-4f
 
 // Returns the number of centers of rotations, computes them if not done yet
 int Mesh::GetCenterCount()
@@ -26,124 +48,676 @@ const Eigen::MatrixXf &Mesh::GetCentersOfRotation()
     return centersOfRotation;
 }
 
-// Compute COR according to the paper
-void Mesh::ComputeCentersOfRotation()
+ThreadPool & Mesh::GetThreadPool()
 {
-    int centerCount = 0;
+    if (!threadPool)
+    {
+        threadPool = std::make_unique<ThreadPool>(threadCount);
+    }
+    return *threadPool;
+}
 
-    // Some vertices have no center of rotation.
-    // So this acts like an offset into the compact
-    // matrix of center coords
-    this->indexOfCenter.clear();
-    std::vector<Eigen::Vector3f> computed;
+ThreadPool & Mesh::GetSkinningPool()
+{
+    if (!skinningPool)
+    {
+        skinningPool = std::make_unique<ThreadPool>(skinningThreadCount);
+    }
+    return *skinningPool;
+}
 
-    // computation cache
-    std::vector<Eigen::SparseVector<float>> cacheTriangleWeights;
-    std::vector<float> cacheTriangleAreas;
+const TriangleCache & Mesh::GetTriangleCache()
+{
+    // built once, patched by UpdateWeights and dropped by SubdivideTriangles
+    if (!triangleCache && subdivisionThreshold > 0)
+    {
+        Eigen::MatrixXf allVertices(vertices.rows() + subdividedVertices.rows(), 3);
+        allVertices.topRows(vertices.rows()) = vertices;
+        allVertices.bottomRows(subdividedVertices.rows()) = subdividedVertices;
 
-    // fill up the cache
-    for (int i = 0; i < GetRestFaceCount(); i++)
+        triangleCache = std::make_unique<TriangleCache>(allVertices, subdividedTriangles,
+            subdividedWeights, GetThreadPool());
+    }
+    else if (!triangleCache)
     {
-        FindTriangleWeight(i, cacheTriangleWeights);
-        
-        const auto & triangle = triangles.row(i);
+        triangleCache = std::make_unique<TriangleCache>(vertices, triangles, weights,
+            GetThreadPool());
+    }
+    return *triangleCache;
+}
 
-        Eigen::Vector3f vertexA = vertices.row(triangle.x());
-        Eigen::Vector3f vertexB = vertices.row(triangle.y());
-        Eigen::Vector3f vertexC = vertices.row(triangle.z());
+float Mesh::SkinningWeightDistance(int vertexIndex1, int vertexIndex2)
+{
+    // subdivided weights start with the rest vertices
+    const auto & allWeights = subdivisionThreshold > 0 ? subdividedWeights : weights;
 
-        cacheTriangleAreas.push_back(area(vertexA, vertexB, vertexC));
+    for (int index : {vertexIndex1, vertexIndex2})
+    {
+        if (index < 0 || index >= allWeights.cols())
+            throw std::out_of_range("Vertex index out of range: " + std::to_string(index));
     }
-    
-    // may distribute this into threads
-    for (int i = 0; i < (int) vertices.rows(); i++)
+
+    return ::SkinningWeightDistance(allWeights.col(vertexIndex1), allWeights.col(vertexIndex2));
+}
+
+void Mesh::SubdivideTriangles(float threshold)
+{
+    if (threshold > 0)
     {
-        try {
-            // check if vertex has only one bone
-            if (1 == this->weights.col(i).nonZeros())
+        StoreSubdivision(SubdivideByWeightDistance(vertices, triangles, weights,
+            threshold, GetThreadPool()), threshold);
+    }
+    else
+    {
+        StoreSubdivision(Subdivision(), 0);
+    }
+}
+
+void Mesh::StoreSubdivision(Subdivision && subdivision, float threshold)
+{
+    if (threshold > 0)
+    {
+        subdividedVertices = std::move(subdivision.vertices);
+        subdividedTriangles = std::move(subdivision.triangles);
+        subdividedWeights = std::move(subdivision.weights);
+    }
+    else
+    {
+        subdividedVertices.resize(0, 3);
+        subdividedTriangles.resize(0, 3);
+        subdividedWeights.resize(0, 0);
+    }
+    subdivisionThreshold = threshold;
+
+    // the centers are integrated over other triangles
+    triangleCache.reset();
+    areCentersComputed = false;
+    areCenterSumsValid = false;
+}
+
+void Mesh::SetSkinningSimd(SimdLevel level)
+{
+    skinningSimd = std::min(level, DetectSimdLevel());
+}
+
+void Mesh::SetVertexReordering(bool reorder)
+{
+    if (reorder == reorderVertices) return;
+
+    reorderVertices = reorder;
+    skinningLayout.reset();
+}
+
+void Mesh::SetCompactSkinning(int weightBits)
+{
+    if (weightBits != 0 && weightBits != 8 && weightBits != 16)
+        throw std::invalid_argument("Compact weights have 8 or 16 bits, not " + std::to_string(weightBits));
+    if (weightBits == compactWeightBits) return;
+
+    compactWeightBits = weightBits;
+    skinningLayout.reset();
+}
+
+SkinningAccuracy Mesh::MeasureCompactSkinning(const float * rotations, const float * translations)
+{
+    if (compactWeightBits == 0) throw std::runtime_error("Compact skinning is off");
+
+    int vertexCount = GetRestVertexCount();
+    std::vector<float> compact((size_t) 3 * vertexCount), exact((size_t) 3 * vertexCount);
+
+    SkinningAccuracy accuracy = {};
+    bool incremental = incrementalSkinning;
+    incrementalSkinning = false;
+    SkinInto(rotations, translations, compact.data());
+
+    const auto & error = skinningLayout->GetQuantizationError();
+    accuracy.weightError = error.weight;
+    accuracy.restPositionError = error.restPosition;
+    accuracy.centerError = error.center;
+
+    // the compact layout is kept aside while a float one skins the pose
+    auto compactLayout = std::move(skinningLayout);
+    int weightBits = compactWeightBits;
+    compactWeightBits = 0;
+    try
+    {
+        SkinInto(rotations, translations, exact.data());
+    }
+    catch (...)
+    {
+        compactWeightBits = weightBits;
+        skinningLayout = std::move(compactLayout);
+        incrementalSkinning = incremental;
+        throw;
+    }
+    compactWeightBits = weightBits;
+    skinningLayout = std::move(compactLayout);
+    incrementalSkinning = incremental;
+    hasPreviousFrame = false;
+
+    double sum = 0;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        float distance = (Eigen::Map<const Eigen::Vector3f>(compact.data() + 3 * i)
+            - Eigen::Map<const Eigen::Vector3f>(exact.data() + 3 * i)).norm();
+        accuracy.maxError = std::max(accuracy.maxError, distance);
+        sum += distance;
+    }
+    accuracy.meanError = vertexCount > 0 ? (float) (sum / vertexCount) : 0;
+
+    return accuracy;
+}
+
+void Mesh::SetIncrementalSkinning(bool incremental)
+{
+    incrementalSkinning = incremental;
+    hasPreviousFrame = false;
+}
+
+void Mesh::SetThreadCount(int count)
+{
+    if (threadPool && count == threadCount) return;
+
+    threadCount = count;
+    threadPool.reset();
+}
+
+void Mesh::SetSkinningThreadCount(int count)
+{
+    if (skinningPool && count == skinningThreadCount) return;
+
+    skinningThreadCount = count;
+    skinningPool.reset();
+}
+
+void Mesh::SetSkinningChunkSize(int vertexCount)
+{
+    // whole blocks, so tasks write whole cache lines of each coordinate
+    int blocks = (std::max(1, vertexCount) + SKINNING_BLOCK_WIDTH - 1) / SKINNING_BLOCK_WIDTH;
+    skinningChunkSize = blocks * SKINNING_BLOCK_WIDTH;
+}
+
+// Compute COR according to the paper
+bool Mesh::ComputeCentersOfRotation(ComputeProgress * progress, std::string * error)
+{
+    // vertices with the same weights have the same center
+    std::vector<int> groupOfVertex;
+    auto representatives = GroupBySignature(groupOfVertex);
+    int groupCount = (int) representatives.size();
+
+    isCenterCacheHit = false;
+    uint64_t cacheKey = 0;
+    if (!centerCacheDirectory.empty())
+    {
+        cacheKey = CenterCacheKey(vertices, triangles, weights,
+            {maxCenterError, signatureTolerance, subdivisionThreshold});
+
+        CenterCacheEntry entry;
+        if (ReadCenterCache(centerCacheDirectory, cacheKey, groupCount, entry))
+        {
+            if (progress)
             {
-                this->indexOfCenter.push_back(-1);
-                continue;
+                progress->total.store(groupCount, std::memory_order_relaxed);
+                progress->completed.store(groupCount, std::memory_order_relaxed);
+            }
+
+            centerError = entry.centerError;
+            areCenterSumsValid = !entry.nominators.empty();
+            if (areCenterSumsValid)
+            {
+                groupOfCenterSums = groupOfVertex;
+                centerNominators = std::move(entry.nominators);
+                centerDenominators = std::move(entry.denominators);
             }
-            auto center = ComputeCenterOfRotation(i, 
-                cacheTriangleWeights, cacheTriangleAreas);
-            computed.push_back(center);
-            this->indexOfCenter.push_back(centerCount);
 
-            centerCount++;
+            StoreCenters(groupOfVertex, entry.centers);
+            isCenterCacheHit = true;
+            return true;
         }
-        catch (const std::exception & e)
+    }
+
+    // computation cache
+    const auto & cache = GetTriangleCache();
+
+    // exact integration, or hierarchy of triangles for approximate centers
+    std::optional<CenterIntegrator> integrator;
+    std::unique_ptr<TriangleBVH> hierarchy;
+    if (maxCenterError > 0)
+        hierarchy = std::make_unique<TriangleBVH>(cache);
+    else
+        integrator.emplace(weights, cache);
+
+    // Each group is independent, so results land in their own slot
+    // and the output does not depend on the thread count.
+    std::vector<Eigen::Vector3f> computed(groupCount);
+    std::vector<Eigen::Vector3f> nominators(groupCount, Eigen::Vector3f::Zero());
+    std::vector<float> denominators(groupCount);
+    std::vector<float> errors(groupCount, 0);
+
+    std::string failure;
+    bool succeeded = ComputeGroups(groupCount, [&](int g, std::vector<int> & candidateTriangles)
+    {
+        int i = representatives[g];
+
+        if (hierarchy)
         {
-            this->failureContextMessage = e.what();
-            
+            computed[g] = ApproximateCenterOfRotation(i, *hierarchy, errors[g]);
             return;
         }
+
+        integrator->Accumulate(i, nominators[g], denominators[g], candidateTriangles);
+
+        CenterIntegrator::CheckDenominator(i, denominators[g]);
+        computed[g] = nominators[g] / denominators[g];
+    }, failure, progress);
+
+    if (!succeeded)
+    {
+        if (error) *error = failure;
+        else this->failureContextMessage = failure;
+        return false;
     }
 
-    Eigen::MatrixXf centers(centerCount, 3);
-    for (int i = 0; i < centerCount; i++)
+    centerError = 0;
+    for (auto error : errors)
     {
-        centers.row(i) = computed[i];
+        centerError = std::max(centerError, error);
     }
-    this->centersOfRotation = centers;
 
+    if (!centerCacheDirectory.empty())
+    {
+        CenterCacheEntry entry;
+        entry.centers = computed;
+        if (!hierarchy)
+        {
+            entry.nominators = nominators;
+            entry.denominators = denominators;
+        }
+        entry.centerError = centerError;
+
+        // the cache only saves time, the centers are valid without it
+        try
+        {
+            WriteCenterCache(centerCacheDirectory, cacheKey, entry);
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    // approximate centers cannot be patched
+    areCenterSumsValid = !hierarchy;
+    if (areCenterSumsValid)
+    {
+        groupOfCenterSums = groupOfVertex;
+        centerNominators = std::move(nominators);
+        centerDenominators = std::move(denominators);
+    }
+
+    StoreCenters(groupOfVertex, computed);
+    return true;
+}
+
+bool Mesh::ComputeGroups(int groupCount,
+    const std::function<void(int, std::vector<int> &)> & compute,
+    std::string & failure, ComputeProgress * progress)
+{
+    if (progress) progress->total.store(groupCount, std::memory_order_relaxed);
+
+    // The lowest failing group wins, like in a serial loop.
+    // Groups are ordered by first vertex, so this is also the lowest vertex.
+    std::atomic<int> firstFailure(groupCount);
+    std::mutex failureLock;
+    std::string failureMessage;
+
+    GetThreadPool().ParallelFor(groupCount, VERTEX_CHUNK_SIZE, [&](int begin, int end)
+    {
+        std::vector<int> scratch;
+
+        if (progress && progress->cancelled.load(std::memory_order_relaxed)) return;
+
+        for (int g = begin; g < end; g++)
+        {
+            // no point in going past a failure
+            if (g > firstFailure.load(std::memory_order_relaxed)) return;
+
+            try {
+                compute(g, scratch);
+            }
+            catch (const std::exception & e)
+            {
+                std::lock_guard<std::mutex> guard(failureLock);
+                if (g < firstFailure.load())
+                {
+                    firstFailure.store(g);
+                    failureMessage = e.what();
+                }
+                return;
+            }
+        }
+
+        if (progress) progress->completed.fetch_add(end - begin, std::memory_order_relaxed);
+    });
+
+    if (progress && progress->cancelled.load())
+    {
+        failure = "Computation of the centers was cancelled";
+        return false;
+    }
+
+    if (firstFailure.load() != groupCount)
+    {
+        failure = failureMessage;
+        return false;
+    }
+    return true;
+}
+
+void Mesh::StoreCenters(const std::vector<int> & groupOfVertex,
+    const std::vector<Eigen::Vector3f> & groupCenters)
+{
+    int vertexCount = (int) groupOfVertex.size();
+    int groupCount = (int) groupCenters.size();
+    isCenterCacheHit = false;
+
+    // Some vertices have no center of rotation.
+    // So this acts like an offset into the compact
+    // matrix of center coords
+    if (shareCenters)
+    {
+        this->indexOfCenter = groupOfVertex;
+
+        Eigen::MatrixXf centers(groupCount, 3);
+        for (int g = 0; g < groupCount; g++)
+        {
+            centers.row(g) = groupCenters[g];
+        }
+        this->centersOfRotation = centers;
+    }
+    else
+    {
+        this->indexOfCenter.assign(vertexCount, -1);
+        int centerCount = 0;
+        for (int i = 0; i < vertexCount; i++)
+        {
+            if (groupOfVertex[i] != -1) this->indexOfCenter[i] = centerCount++;
+        }
+
+        Eigen::MatrixXf centers(centerCount, 3);
+        for (int i = 0; i < vertexCount; i++)
+        {
+            if (groupOfVertex[i] != -1)
+                centers.row(this->indexOfCenter[i]) = groupCenters[groupOfVertex[i]];
+        }
+        this->centersOfRotation = centers;
+    }
+
+    skinningLayout.reset();
     areCentersComputed = true;
 }
 
-void Mesh::FindTriangleWeight(int triangleIndex,
-    std::vector<Eigen::SparseVector<float>> & cacheTriangleWeights)
+std::vector<int> Mesh::GroupBySignature(std::vector<int> & groupOfVertex)
 {
-    auto restTriangleCount = GetRestFaceCount();
-    
-    Eigen::Vector3i triangle = this->triangles.row(triangleIndex);
+    std::unordered_map<WeightSignature, int, WeightSignatureHash> groups;
+    std::vector<int> representatives;
 
-    Eigen::SparseVector<float> triangleWeight = 
-        (weights.col(triangle.x()) + weights.col(triangle.y())
-        + weights.col(triangle.z())) / 3;
+    groupOfVertex.assign(GetRestVertexCount(), -1);
+
+    for (int i = 0; i < GetRestVertexCount(); i++)
+    {
+        // check if vertex has only one bone
+        if (1 == this->weights.col(i).nonZeros()) continue;
+
+        auto signature = MakeWeightSignature(this->weights.col(i), signatureTolerance);
+        auto inserted = groups.emplace(std::move(signature), (int) representatives.size());
+        if (inserted.second) representatives.push_back(i);
+
+        groupOfVertex[i] = inserted.first->second;
+    }
 
-    cacheTriangleWeights.push_back(triangleWeight);
+    return representatives;
 }
 
-// Find the center of rotation for this vertex and store it into the matrix
-// Assumes vertex has more than one bone
-Eigen::Vector3f Mesh::ComputeCenterOfRotation(int vertexIndex,
-    const std::vector<Eigen::SparseVector<float>> & cacheTriangleWeights,
-    const std::vector<float> & cacheTriangleAreas)
+void Mesh::UpdateWeights(const std::vector<int> & vertexIndices,
+    const std::vector<Eigen::SparseVector<float>> & newWeights)
 {
-    // this vertex weight
-    Eigen::SparseVector<float> vertexWeight = this->weights.col(vertexIndex);
+    if (vertexIndices.size() != newWeights.size())
+        throw std::invalid_argument("Vertex and weight counts differ");
 
-    // store progress
-    Eigen::Vector3f nominator;
-    nominator.setZero();
-    float denominator = 0;
+    // the last weight given for a vertex wins
+    std::vector<int> newWeightOfVertex(GetRestVertexCount(), -1);
+    for (int i = 0; i < (int) vertexIndices.size(); i++)
+    {
+        int v = vertexIndices[i];
+        if (v < 0 || v >= GetRestVertexCount())
+            throw std::out_of_range("Vertex index out of range: " + std::to_string(v));
+        if (newWeights[i].size() != GetBoneCount())
+            throw std::invalid_argument("Weight of vertex " + std::to_string(v)
+                + " does not have one entry per bone");
+
+        newWeightOfVertex[v] = i;
+    }
 
-    // loop on all triangles
-    for (int i = 0; i < (int) triangles.rows(); i++)
+    std::vector<Eigen::Triplet<float>> triplets;
+    triplets.reserve(weights.nonZeros());
+    for (int i = 0; i < GetRestVertexCount(); i++)
     {
-        auto similarity = ComputeSimilarity(vertexWeight, cacheTriangleWeights[i]);
+        if (newWeightOfVertex[i] == -1)
+        {
+            for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+                triplets.emplace_back((int) it.row(), i, it.value());
+        }
+        else
+        {
+            for (Eigen::SparseVector<float>::InnerIterator it(newWeights[newWeightOfVertex[i]]); it; ++it)
+                if (it.value() != 0) triplets.emplace_back((int) it.index(), i, it.value());
+        }
+    }
+
+    Eigen::SparseMatrix<float> updated(GetBoneCount(), GetRestVertexCount());
+    updated.setFromTriplets(triplets.begin(), triplets.end());
+    // the subdivision follows the weights, it is redone from scratch and
+    // nothing changes if it fails
+    if (subdivisionThreshold > 0)
+    {
+        auto subdivision = SubdivideByWeightDistance(vertices, triangles, updated,
+            subdivisionThreshold, GetThreadPool());
+        weights = std::move(updated);
+        StoreSubdivision(std::move(subdivision), subdivisionThreshold);
+        skinningLayout.reset();
+        return;
+    }
+
+    // triangles touching a repainted vertex, sorted
+    std::vector<int> changedTriangles;
+    for (int t = 0; t < GetRestFaceCount(); t++)
+    {
+        if (newWeightOfVertex[triangles(t, 0)] != -1 || newWeightOfVertex[triangles(t, 1)] != -1
+            || newWeightOfVertex[triangles(t, 2)] != -1)
+            changedTriangles.push_back(t);
+    }
+
+    // centers read from the cache have sums but no triangle cache yet,
+    // patching them needs the previous triangle weights
+    if (areCentersComputed && areCenterSumsValid) GetTriangleCache();
+
+    // keep the previous triangle weights to remove their terms
+    std::vector<int> oldWeightStart(1, 0);
+    std::vector<int> oldWeightBones;
+    std::vector<float> oldWeightValues;
+    if (triangleCache)
+    {
+        for (int t : changedTriangles)
+        {
+            auto count = triangleCache->GetWeightCount(t);
+            oldWeightBones.insert(oldWeightBones.end(),
+                triangleCache->GetWeightBones(t), triangleCache->GetWeightBones(t) + count);
+            oldWeightValues.insert(oldWeightValues.end(),
+                triangleCache->GetWeightValues(t), triangleCache->GetWeightValues(t) + count);
+            oldWeightStart.push_back((int) oldWeightBones.size());
+        }
+    }
 
-        const auto & triangle = triangles.row(i);
+    weights = std::move(updated);
 
-        Eigen::Vector3f vertexA = vertices.row(triangle.x());
-        Eigen::Vector3f vertexB = vertices.row(triangle.y());
-        Eigen::Vector3f vertexC = vertices.row(triangle.z());
+    if (triangleCache)
+        triangleCache->UpdateWeights(changedTriangles, triangles, weights);
 
-        auto triangleArea = cacheTriangleAreas[i];
+    // nothing to patch, the centers are computed again when asked for
+    if (!areCentersComputed || !areCenterSumsValid)
+    {
+        areCentersComputed = false;
+        areCenterSumsValid = false;
+        return;
+    }
+    areCentersComputed = false;
+    areCenterSumsValid = false;
 
-        nominator += similarity * (vertexA + vertexB + vertexC) / 3 * triangleArea;
-        denominator += similarity * triangleArea;
+    const auto & cache = GetTriangleCache();
+
+    std::vector<int> groupOfVertex;
+    auto representatives = GroupBySignature(groupOfVertex);
+    int groupCount = (int) representatives.size();
+
+    // A group holding a vertex that kept its weights starts from the sums of
+    // that vertex, only the changed triangles are integrated again.
+    // Groups of repainted vertices only are integrated from scratch.
+    // With a tolerance the vertices of a group only have close weights: the
+    // sums are those of the first vertex of the old group, which can only be
+    // patched if it still comes first in its group.
+    std::vector<int> oldRepresentatives;
+    if (signatureTolerance > 0)
+    {
+        oldRepresentatives.assign(centerNominators.size(), -1);
+        for (int i = 0; i < GetRestVertexCount(); i++)
+        {
+            int previous = groupOfCenterSums[i];
+            if (previous != -1 && oldRepresentatives[previous] == -1) oldRepresentatives[previous] = i;
+        }
     }
 
-    if (denominator < DIVISION_BY_ZERO_THRESHOLD)
+    std::vector<int> patchedVertex(groupCount, -1);
+    bool needsIntegrator = false;
+    for (int i = 0; i < GetRestVertexCount(); i++)
     {
-        auto message = std::string("Denominator is close to zero for vertex: ") 
-            + std::to_string(vertexIndex) + std::string("; threshold = ")
-            + std::to_string(DIVISION_BY_ZERO_THRESHOLD)
-            + std::string("; value found = ") 
-            + std::to_string(denominator);
-        throw std::logic_error(message);
+        int g = groupOfVertex[i];
+        if (g == -1 || patchedVertex[g] != -1) continue;
+        if (newWeightOfVertex[i] != -1 || groupOfCenterSums[i] == -1) continue;
+        if (signatureTolerance > 0
+            && (i != representatives[g] || oldRepresentatives[groupOfCenterSums[i]] != i))
+            continue;
+
+        patchedVertex[g] = i;
     }
+    for (int g = 0; g < groupCount; g++)
+    {
+        if (patchedVertex[g] == -1) needsIntegrator = true;
+    }
+
+    std::optional<CenterIntegrator> integrator;
+    if (needsIntegrator) integrator.emplace(weights, cache);
+
+    std::vector<Eigen::Vector3f> computed(groupCount);
+    std::vector<Eigen::Vector3f> nominators(groupCount, Eigen::Vector3f::Zero());
+    std::vector<float> denominators(groupCount);
+
+    std::string failure;
+    bool succeeded = ComputeGroups(groupCount, [&](int g, std::vector<int> & candidateTriangles)
+    {
+        int i = representatives[g];
+        int patched = patchedVertex[g];
+
+        if (patched == -1)
+        {
+            integrator->Accumulate(i, nominators[g], denominators[g], candidateTriangles);
+        }
+        else
+        {
+            const Eigen::SparseVector<float> weight = weights.col(patched);
+            auto previous = groupOfCenterSums[patched];
+            nominators[g] = centerNominators[previous];
+            denominators[g] = centerDenominators[previous];
+
+            for (int c = 0; c < (int) changedTriangles.size(); c++)
+            {
+                int t = changedTriangles[c];
+                int start = oldWeightStart[c];
+
+                CenterIntegrator::AddTriangle(weight, cache, t,
+                    oldWeightBones.data() + start, oldWeightValues.data() + start,
+                    oldWeightStart[c + 1] - start, -1, nominators[g], denominators[g]);
+                CenterIntegrator::AddTriangle(weight, cache, t,
+                    cache.GetWeightBones(t), cache.GetWeightValues(t), cache.GetWeightCount(t),
+                    1, nominators[g], denominators[g]);
+            }
+        }
+
+        CenterIntegrator::CheckDenominator(i, denominators[g]);
+        computed[g] = nominators[g] / denominators[g];
+    }, failure);
+
+    if (!succeeded)
+    {
+        this->failureContextMessage = failure;
+        return;
+    }
+
+    areCenterSumsValid = true;
+    groupOfCenterSums = groupOfVertex;
+    centerNominators = std::move(nominators);
+    centerDenominators = std::move(denominators);
+
+    StoreCenters(groupOfVertex, computed);
+}
+
+void Mesh::SetMaxCenterError(float maxError)
+{
+    if (maxError == maxCenterError) return;
+
+    maxCenterError = std::max(0.0f, maxError);
+    areCentersComputed = false;
+    areCenterSumsValid = false;
+}
+
+void Mesh::SetCenterCacheDirectory(const std::string & directory)
+{
+    centerCacheDirectory = directory;
+}
+
+void Mesh::SetCenterSharing(bool share, float tolerance)
+{
+    if (share == shareCenters && tolerance == signatureTolerance) return;
+
+    shareCenters = share;
+    signatureTolerance = tolerance;
+
+    // the layout of the centers changed
+    areCentersComputed = false;
+    areCenterSumsValid = false;
+}
+
+// Widen the accepted similarity spread until the error bound
+// is under maxCenterError, a spread of 0 is exact up to rounding
+Eigen::Vector3f Mesh::ApproximateCenterOfRotation(int vertexIndex,
+    const TriangleBVH & hierarchy, float & error)
+{
+    const Eigen::SparseVector<float> & vertexWeight = this->weights.col(vertexIndex);
+
+    Eigen::Vector3f nominator;
+    float denominator;
+
+    float relativeSpread = INITIAL_RELATIVE_SPREAD;
+    while (true)
+    {
+        error = hierarchy.Accumulate(vertexWeight, relativeSpread, nominator, denominator);
+
+        if (error <= maxCenterError || relativeSpread == 0) break;
+
+        relativeSpread /= 4;
+        if (relativeSpread < MINIMUM_RELATIVE_SPREAD) relativeSpread = 0;
+    }
+
+    CenterIntegrator::CheckDenominator(vertexIndex, denominator);
     return nominator / denominator;
 }
 
@@ -166,34 +740,48 @@ void Mesh::Serialize(const std::string & path)
 
 void Mesh::ReadCentersOfRotation(const std::string & path)
 {
-    // offset indices
-    this->indexOfCenter.clear();
-
-    int centerCount = 0;
-    for (int i = 0; i < this->weights.cols(); i++)
+    // read from disk, the mesh keeps its centers if the file does not fit
+    try
     {
-        if (1 == this->weights.col(i).nonZeros())
+        auto centers = ReadVertices(path + std::string(".centers"));
+
+        // offset indices
+        // the file either has one center per weight signature
+        // or one center per vertex with more than one bone
+        std::vector<int> groupOfVertex;
+        int groupCount = (int) GroupBySignature(groupOfVertex).size();
+
+        std::vector<int> indexOfCenter;
+        if (centers.rows() == groupCount)
         {
-            this->indexOfCenter.push_back(-1);    
+            indexOfCenter = std::move(groupOfVertex);
         }
         else
         {
-            this->indexOfCenter.push_back(centerCount);
-            centerCount++;
+            indexOfCenter.assign(groupOfVertex.size(), -1);
+            int centerCount = 0;
+            for (int i = 0; i < (int) groupOfVertex.size(); i++)
+            {
+                if (groupOfVertex[i] != -1) indexOfCenter[i] = centerCount++;
+            }
+
+            if (centers.rows() != centerCount)
+            {
+                auto message = std::string("Center count mismatch: ")
+                    + std::to_string(centers.rows()) + std::string(" read, expected ")
+                    + std::to_string(groupCount) + std::string(" or ")
+                    + std::to_string(centerCount);
+                throw std::runtime_error(message);
+            }
         }
-    }
-    // read from disk
-    try
-    {
-        auto centers = ReadVertices(path + std::string(".centers"));
-        this->centersOfRotation = centers;
+
+        // drops the layout skinned with the previous centers
+        SetCentersOfRotation(indexOfCenter, centers);
     }
     catch(const std::exception& e)
     {
         this->failureContextMessage = e.what();
     }
-
-    areCentersComputed = true;
 }
 
 void Mesh::WriteCentersOfRotation(const std::string & path)
@@ -206,6 +794,68 @@ void Mesh::WriteCentersOfRotation(const std::string & path)
         throw std::runtime_error("Centers are not computed yet");
 }
 
+void Mesh::SerializeBundle(const std::string & path, const SkinCompression * compression)
+{
+    try
+    {
+        static const std::vector<int> noCenters;
+        WriteMeshBundle(path, vertices, triangles, weights,
+            areCentersComputed ? indexOfCenter : noCenters, centersOfRotation, compression);
+    }
+    catch(const std::exception& e)
+    {
+        this->failureContextMessage = e.what();
+    }
+}
+
+void Mesh::SetCentersOfRotation(const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers)
+{
+    if ((int) indexOfCenter.size() != GetRestVertexCount())
+        throw std::invalid_argument("Expected one center index per vertex");
+    if (centers.cols() != 3) throw std::invalid_argument("Expected 3 coordinates per center");
+    for (int index : indexOfCenter)
+    {
+        if (index < -1 || index >= centers.rows())
+            throw std::invalid_argument("Center index out of range: " + std::to_string(index));
+    }
+
+    this->indexOfCenter = indexOfCenter;
+    this->centersOfRotation = centers;
+    areCenterSumsValid = false;
+    skinningLayout.reset();
+    areCentersComputed = true;
+}
+
+const SkinningLayout & Mesh::GetSkinningLayout()
+{
+    // storing the centers drops the layout
+    if (!areCentersComputed) ComputeCentersOfRotation();
+    if (!areCentersComputed)
+        throw std::runtime_error("Centers are not computed yet");
+    // centers read from a file that did not match
+    if ((int) indexOfCenter.size() != GetRestVertexCount())
+        throw std::runtime_error("Centers do not match the mesh");
+
+    if (!skinningLayout)
+    {
+        std::vector<int> order;
+        if (reorderVertices) order = LocalityVertexOrder(vertices, weights, indexOfCenter);
+
+        skinningLayout = std::make_unique<SkinningLayout>(vertices, weights,
+            indexOfCenter, centersOfRotation, restNormals, restTangents, order, compactWeightBits);
+        // the scattered writes of the positions can cost more lines than
+        // the grouping saves, the mesh's order is kept then
+        if (!order.empty() && skinningLayout->GetStats().cacheLines > skinningLayout->GetMeshOrderStats().cacheLines)
+        {
+            skinningLayout = std::make_unique<SkinningLayout>(vertices, weights,
+                indexOfCenter, centersOfRotation, restNormals, restTangents, std::vector<int>(), compactWeightBits);
+        }
+        // positions skinned before come from other data
+        hasPreviousFrame = false;
+    }
+    return *skinningLayout;
+}
+
 // Assumes normalized quaternions
 const Eigen::MatrixXf Mesh::SkinCOR(const std::vector<Eigen::Quaternionf> & rotations, 
     const std::vector<Eigen::Vector3f> & translations)
@@ -218,40 +868,428 @@ const Eigen::MatrixXf Mesh::SkinCOR(const std::vector<Eigen::Quaternionf> & rota
         throw std::runtime_error(message);
     }
 
-    Eigen::MatrixXf newVertices(this->vertices.rows(), 3);
+    if ((int) rotations.size() != GetBoneCount())
+    {
+        std::string message = "Expected one transformation per bone: ";
+        message += std::to_string(GetBoneCount()) + std::string(" bones, ")
+            + std::to_string(rotations.size()) + std::string(" transformations");
+        throw std::runtime_error(message);
+    }
+
+    // built before the result, which is not allocated when this fails
+    GetSkinningLayout();
+
+    // incremental frames update the positions kept on the mesh
+    Eigen::MatrixXf newVertices;
+    auto & result = incrementalSkinning ? skinnedVertices : newVertices;
+    result.resize(this->vertices.rows(), 3);
+
+    SkinningOutput output = {};
+    for (int c = 0; c < 3; c++) output.position[c] = result.col(c).data();
+    output.positionStride = 1;
 
-    // Get an equivalent of rotations in matrices
-    std::vector<Eigen::Matrix3f> matrixRotations;
-    matrixRotations.reserve(rotations.size());
-    for (auto &&i : rotations)
+    // Eigen stores a quaternion as x y z w and a vector as x y z
+    const float * rotationData = reinterpret_cast<const float *>(rotations.data());
+    const float * translationData = reinterpret_cast<const float *>(translations.data());
+    Skin(1, &rotationData, &translationData, &output);
+
+    return result;
+}
+
+void Mesh::SkinInto(const float * rotations, const float * translations, float * positions,
+    float * normals, float * tangents)
+{
+    if (normals && restNormals.rows() == 0)
+        throw std::runtime_error("The mesh has no normals");
+    if (tangents && restTangents.rows() == 0)
+        throw std::runtime_error("The mesh has no tangents");
+
+    SkinningOutput output = {};
+    for (int c = 0; c < 3; c++)
     {
-        matrixRotations.push_back(i.toRotationMatrix());
+        output.position[c] = positions + c;
+        output.normal[c] = normals ? normals + c : nullptr;
     }
-    
-    // for each vertex
-    for (int i = 0; i < (int) this->vertices.rows(); i++)
+    for (int c = 0; c < 4; c++)
     {
-        newVertices.row(i) = DeformVertex(i, rotations, matrixRotations, translations);
+        output.tangent[c] = tangents ? tangents + c : nullptr;
     }
+    output.positionStride = 3;
+    output.normalStride = 3;
+    output.tangentStride = 4;
+    output.lbsNormals = lbsNormals;
 
-    return newVertices;
+    Skin(1, &rotations, &translations, &output);
 }
 
-// Runtime algorithm on one vertex
-const Eigen::Vector3f Mesh::DeformVertex(int index, 
-    const std::vector<Eigen::Quaternionf> & rotations,
-    const std::vector<Eigen::Matrix3f> & matrixRotations,
-    const std::vector<Eigen::Vector3f> & translations)
+void Mesh::SkinHalfInto(const float * rotations, const float * translations, uint16_t * positions)
+{
+    SkinningOutput output = {};
+    for (int c = 0; c < 3; c++) output.halfPosition[c] = positions + c;
+    output.positionStride = 3;
+
+    Skin(1, &rotations, &translations, &output);
+}
+
+void Mesh::SkinBatchInto(int instanceCount, const float * const * rotations,
+    const float * const * translations, float * const * positions)
+{
+    if (instanceCount < 0)
+        throw std::invalid_argument("Negative instance count: " + std::to_string(instanceCount));
+
+    // the output of each instance, in storage kept between batches
+    batchOutputs.assign(instanceCount, SkinningOutput{});
+    for (int j = 0; j < instanceCount; j++)
+    {
+        for (int c = 0; c < 3; c++) batchOutputs[j].position[c] = positions[j] + c;
+        batchOutputs[j].positionStride = 3;
+    }
+
+    Skin(instanceCount, rotations, translations, batchOutputs.data());
+}
+
+void Mesh::SetRestNormals(const Eigen::MatrixXf & normals)
+{
+    if (normals.rows() != 0 && (normals.rows() != vertices.rows() || normals.cols() != 3))
+        throw std::invalid_argument("Expected 3 coordinates per vertex for the normals");
+
+    restNormals = normals;
+    skinningLayout.reset();
+}
+
+void Mesh::SetRestTangents(const Eigen::MatrixXf & tangents)
+{
+    if (tangents.rows() != 0 && (tangents.rows() != vertices.rows() || tangents.cols() != 4))
+        throw std::invalid_argument("Expected 4 coordinates per vertex for the tangents");
+
+    restTangents = tangents;
+    skinningLayout.reset();
+}
+
+// Calls skin(firstBlock, endBlock) on the runs of consecutive blocks of the
+// task [begin, end), which are positions in dirtyBlocks when there is one
+template <typename Function>
+static void ForEachBlockRun(const int * dirtyBlocks, int begin, int end, const Function & skin)
+{
+    if (!dirtyBlocks)
+    {
+        skin(begin, end);
+        return;
+    }
+
+    for (int d = begin; d < end;)
+    {
+        int firstBlock = dirtyBlocks[d];
+        int endBlock = firstBlock + 1;
+        for (d++; d < end && dirtyBlocks[d] == endBlock; d++) endBlock++;
+        skin(firstBlock, endBlock);
+    }
+}
+
+static bool IsSameOutput(const SkinningOutput & a, const SkinningOutput & b)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        if (a.position[c] != b.position[c] || a.halfPosition[c] != b.halfPosition[c]
+            || a.normal[c] != b.normal[c]) return false;
+    }
+    for (int c = 0; c < 4; c++)
+    {
+        if (a.tangent[c] != b.tangent[c]) return false;
+    }
+    return a.positionStride == b.positionStride && a.normalStride == b.normalStride
+        && a.tangentStride == b.tangentStride && a.lbsNormals == b.lbsNormals;
+}
+
+// Normal and tangent of the vertex at position i of the blocks, written at
+// index in the output, in the operation order of the kernels
+static void SkinDirections(const SkinningBlocks & blocks, const SkinningOutput & output,
+    int i, int index, const Eigen::Matrix3f & quaternionMatrix, const Eigen::Matrix3f & lbsMatrix)
+{
+    if (output.normal[0])
+    {
+        Eigen::Vector3f normal(blocks.normal[0][i], blocks.normal[1][i], blocks.normal[2][i]);
+        Eigen::Vector3f skinned;
+
+        if (output.lbsNormals)
+        {
+            // cofactors of the blended matrix, its inverse transpose up to the determinant
+            const auto & m = lbsMatrix;
+            Eigen::Matrix3f cofactor;
+            cofactor <<
+                m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1),
+                m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2),
+                m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0),
+                m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2),
+                m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0),
+                m(0, 1) * m(2, 0) - m(0, 0) * m(2, 1),
+                m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1),
+                m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2),
+                m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+
+            // a negative determinant flips the cofactors
+            float determinant = m(0, 0) * cofactor(0, 0)
+                + (m(0, 1) * cofactor(0, 1) + m(0, 2) * cofactor(0, 2));
+
+            skinned = cofactor * normal;
+            if (determinant < 0) skinned = -skinned;
+            skinned.normalize();
+        }
+        else
+        {
+            skinned = quaternionMatrix * normal;
+        }
+
+        for (int c = 0; c < 3; c++) output.normal[c][(size_t) index * output.normalStride] = skinned[c];
+    }
+
+    if (output.tangent[0])
+    {
+        Eigen::Vector3f tangent(blocks.tangent[0][i], blocks.tangent[1][i], blocks.tangent[2][i]);
+        Eigen::Vector3f skinned;
+
+        if (output.lbsNormals)
+        {
+            skinned = lbsMatrix * tangent;
+            skinned.normalize();
+        }
+        else
+        {
+            skinned = quaternionMatrix * tangent;
+        }
+
+        size_t offset = (size_t) index * output.tangentStride;
+        for (int c = 0; c < 3; c++) output.tangent[c][offset] = skinned[c];
+        if (output.tangent[3]) output.tangent[3][offset] = blocks.tangent[3][i];
+    }
+}
+
+int Mesh::FindDirtyBlocks(const float * rotations, const float * translations,
+    const SkinningOutput & output)
+{
+    const auto & layout = *skinningLayout;
+    int boneCount = GetBoneCount();
+    int blockCount = (layout.GetVertexCount() + SKINNING_BLOCK_WIDTH - 1) / SKINNING_BLOCK_WIDTH;
+
+    // the output must still hold the previous frame
+    bool isSameOutput = hasPreviousFrame && IsSameOutput(previousOutput, output);
+
+    int dirtyCount = blockCount;
+    if (isSameOutput)
+    {
+        dirtyBlockMask.assign(blockCount, 0);
+        for (int b = 0; b < boneCount; b++)
+        {
+            // bit for bit, a bone that did not move gives the same positions
+            const float * previous = previousTransformations.data() + 7 * b;
+            if (std::memcmp(previous, rotations + 4 * b, 4 * sizeof(float)) == 0
+                && std::memcmp(previous + 4, translations + 3 * b, 3 * sizeof(float)) == 0)
+                continue;
+
+            int count;
+            const int * influenced = layout.GetInfluencedVertices(b, count);
+            for (int k = 0; k < count; k++) dirtyBlockMask[influenced[k] / SKINNING_BLOCK_WIDTH] = 1;
+        }
+
+        dirtyBlocks.clear();
+        for (int block = 0; block < blockCount; block++)
+        {
+            if (dirtyBlockMask[block]) dirtyBlocks.push_back(block);
+        }
+        dirtyCount = (int) dirtyBlocks.size();
+    }
+
+    // this frame is the previous one of the next
+    previousTransformations.resize((size_t) 7 * boneCount);
+    for (int b = 0; b < boneCount; b++)
+    {
+        std::memcpy(previousTransformations.data() + 7 * b, rotations + 4 * b, 4 * sizeof(float));
+        std::memcpy(previousTransformations.data() + 7 * b + 4, translations + 3 * b, 3 * sizeof(float));
+    }
+    previousOutput = output;
+    hasPreviousFrame = true;
+
+    return dirtyCount;
+}
+
+void Mesh::Skin(int instanceCount, const float * const * rotations,
+    const float * const * translations, const SkinningOutput * outputs)
+{
+    const auto & layout = GetSkinningLayout();
+    int boneCount = GetBoneCount();
+    if (instanceCount == 0) return;
+
+    // Tasks are captured by reference alone, which std::function stores
+    // without allocating
+    struct
+    {
+        int instanceCount;
+        int boneCount;
+        const float * const * rotations;
+        const float * const * translations;
+
+        SkinBlocksFunction kernel;
+        SkinningBlocks blocks;
+        int vertexCount;
+        const SkinningOutput * outputs;
+        // positions of the blocks to skin, null for all of them
+        const int * dirtyBlocks;
+    } task;
+
+    task.instanceCount = instanceCount;
+    task.boneCount = boneCount;
+    task.rotations = rotations;
+    task.translations = translations;
+    task.kernel = GetSkinningKernel(skinningSimd);
+    task.blocks = layout.GetBlocks();
+    task.vertexCount = layout.GetVertexCount();
+    task.outputs = outputs;
+    task.dirtyBlocks = nullptr;
+
+    int blockCount = (task.vertexCount + SKINNING_BLOCK_WIDTH - 1) / SKINNING_BLOCK_WIDTH;
+    int taskBlockCount = blockCount;
+
+    // only the blocks of the bones that moved since the previous frame,
+    // a batch may overwrite that frame
+    if (incrementalSkinning && instanceCount == 1)
+    {
+        int dirtyCount = FindDirtyBlocks(rotations[0], translations[0], outputs[0]);
+        if (dirtyCount == 0) return;
+        if (dirtyCount < blockCount)
+        {
+            task.dirtyBlocks = dirtyBlocks.data();
+            taskBlockCount = dirtyCount;
+        }
+    }
+    else
+    {
+        hasPreviousFrame = false;
+    }
+
+    // Get an equivalent of rotations in matrices, once per bone of each
+    // instance, in storage kept between frames
+    size_t transformationCount = (size_t) instanceCount * boneCount;
+    frameRotations.resize(transformationCount);
+    frameMatrices.resize(transformationCount);
+    frameTranslations.resize(transformationCount);
+    if (task.kernel)
+    {
+        frameData.resize(16 * transformationCount);
+        instanceFrames.resize(instanceCount);
+    }
+
+    // a bone costs about as much as a vertex
+    auto & pool = GetSkinningPool();
+    int instancesPerTask = std::max(1, skinningChunkSize / std::max(1, boneCount));
+    pool.ParallelFor(instanceCount, instancesPerTask, [this, &task](int begin, int end)
+    {
+        int boneCount = task.boneCount;
+        for (int j = begin; j < end; j++)
+        {
+            size_t first = (size_t) j * boneCount;
+            for (int b = 0; b < boneCount; b++)
+            {
+                frameRotations[first + b] = Eigen::Map<const Eigen::Quaternionf>(task.rotations[j] + 4 * b);
+                frameMatrices[first + b] = frameRotations[first + b].toRotationMatrix();
+                frameTranslations[first + b] = Eigen::Map<const Eigen::Vector3f>(task.translations[j] + 3 * b);
+            }
+
+            if (!task.kernel) continue;
+
+            // one array per coefficient, so lanes gather the bones of their vertex
+            float * data = frameData.data() + 16 * first;
+            for (int b = 0; b < boneCount; b++)
+            {
+                for (int c = 0; c < 4; c++) data[c * boneCount + b] = frameRotations[first + b].coeffs()[c];
+                for (int m = 0; m < 9; m++) data[(4 + m) * boneCount + b] = frameMatrices[first + b](m / 3, m % 3);
+                for (int c = 0; c < 3; c++) data[(13 + c) * boneCount + b] = frameTranslations[first + b][c];
+            }
+
+            auto & frame = instanceFrames[j];
+            for (auto & coefficients : frame.quaternion) {coefficients = data; data += boneCount;}
+            for (auto & coefficients : frame.rotation) {coefficients = data; data += boneCount;}
+            for (auto & coefficients : frame.translation) {coefficients = data; data += boneCount;}
+        }
+    });
+
+    // Tasks are whole blocks, 64 bytes of each coordinate column, so two
+    // threads share a cache line of the output at most at a task boundary.
+    // Every instance skins the blocks of a task before the next block range,
+    // so the layout of these vertices stays in cache across the instances.
+    int chunkBlocks = skinningChunkSize / SKINNING_BLOCK_WIDTH;
+    int blocksPerTask = std::max(1, (chunkBlocks + instanceCount - 1) / instanceCount);
+
+    if (task.kernel)
+    {
+        pool.ParallelFor(taskBlockCount, blocksPerTask, [this, &task](int begin, int end)
+        {
+            for (int j = 0; j < task.instanceCount; j++)
+            {
+                ForEachBlockRun(task.dirtyBlocks, begin, end, [&](int firstBlock, int endBlock)
+                {
+                    task.kernel(task.blocks, instanceFrames[j], firstBlock, endBlock,
+                        task.vertexCount, task.outputs[j]);
+                });
+            }
+        });
+        return;
+    }
+
+    // for each vertex, reading the layout front to back. Reordered vertices
+    // with a center come first, so the center branch of DeformVertex
+    // changes once instead of from vertex to vertex.
+    pool.ParallelFor(taskBlockCount, blocksPerTask, [this, &task](int begin, int end)
+    {
+        const auto & layout = *skinningLayout;
+
+        for (int j = 0; j < task.instanceCount; j++)
+        {
+            size_t first = (size_t) j * task.boneCount;
+            const auto & output = task.outputs[j];
+            bool hasDirections = output.normal[0] || output.tangent[0];
+
+            ForEachBlockRun(task.dirtyBlocks, begin, end, [&](int firstBlock, int endBlock)
+            {
+                int last = std::min(task.vertexCount, endBlock * SKINNING_BLOCK_WIDTH);
+                for (int i = firstBlock * SKINNING_BLOCK_WIDTH; i < last; i++)
+                {
+                    Eigen::Matrix3f quaternionMatrix, lbsMatrix;
+                    Eigen::Vector3f deformed = DeformVertex(layout.GetVertex(i),
+                        layout.GetInfluences(i), frameRotations.data() + first,
+                        frameMatrices.data() + first, frameTranslations.data() + first,
+                        hasDirections ? &quaternionMatrix : nullptr,
+                        hasDirections ? &lbsMatrix : nullptr);
+
+                    int index = layout.GetVertexIndex(i);
+                    size_t offset = (size_t) index * output.positionStride;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        if (output.halfPosition[c]) output.halfPosition[c][offset] = FloatToHalf(deformed[c]);
+                        else output.position[c][offset] = deformed[c];
+                    }
+
+                    if (hasDirections)
+                        SkinDirections(task.blocks, output, i, index, quaternionMatrix, lbsMatrix);
+                }
+            });
+        }
+    });
+}
+
+const Eigen::Vector3f Mesh::DeformVertex(const SkinningVertex & vertex,
+    const SkinningInfluence * influences,
+    const Eigen::Quaternionf * rotations,
+    const Eigen::Matrix3f * matrixRotations,
+    const Eigen::Vector3f * translations,
+    Eigen::Matrix3f * quaternionMatrix, Eigen::Matrix3f * lbsMatrix)
 {
     Eigen::Vector4f quaternion;
     quaternion.setZero();
 
-    const Eigen::SparseVector<float> & skinWeights = weights.col(index);
-
-    for (Eigen::SparseVector<float>::InnerIterator it(skinWeights); it; ++it)
+    for (int i = 0; i < vertex.influenceCount; i++)
     {
-        auto boneIndex = it.index();
-        auto boneWeight = it.value();
+        auto boneIndex = influences[i].bone;
+        auto boneWeight = influences[i].weight;
 
         // this weighted quaternion
         Eigen::Vector4f weighted = boneWeight * rotations[boneIndex].coeffs();
@@ -271,24 +1309,21 @@ const Eigen::Vector3f Mesh::DeformVertex(int index,
     auto summedQuaternionMatrix = Eigen::Quaternionf(quaternion).toRotationMatrix();
     
     // get LBS estimates
-    auto lbs = VertexLBSTransformation(index, matrixRotations, translations);
+    auto lbs = VertexLBSTransformation(vertex, influences, matrixRotations, translations);
     const auto & lbsRotation = lbs.first;
     const auto & lbsTranslation = lbs.second;
 
-    // center of rotation
-    const auto centerIndex = this->indexOfCenter[index];
-
     // get COR modified translation
     Eigen::Vector3f finalTranslation;
 
     // no center case
-    if (centerIndex == -1)
+    if (!vertex.hasCenter)
     {
         finalTranslation = lbsTranslation;
     }
     else
     {
-        const Eigen::Vector3f center = this->centersOfRotation.row(centerIndex);
+        const Eigen::Vector3f center = Eigen::Map<const Eigen::Vector3f>(vertex.center);
         finalTranslation = 
             lbsRotation * center
             + lbsTranslation 
@@ -296,31 +1331,34 @@ const Eigen::Vector3f Mesh::DeformVertex(int index,
         ;
     }
 
+    // for the normals and tangents
+    if (quaternionMatrix) *quaternionMatrix = summedQuaternionMatrix;
+    if (lbsMatrix) *lbsMatrix = lbsRotation;
+
     // compute vertex position
-    const Eigen::Vector3f restPosition = this->vertices.row(index);
+    const Eigen::Vector3f restPosition = Eigen::Map<const Eigen::Vector3f>(vertex.restPosition);
     return summedQuaternionMatrix * restPosition + finalTranslation;
 }
 
-const std::pair<Eigen::Matrix3f, Eigen::Vector3f> Mesh::VertexLBSTransformation(int index,
-    const std::vector<Eigen::Matrix3f> & matrixRotations,
-    const std::vector<Eigen::Vector3f> & translations)
+const std::pair<Eigen::Matrix3f, Eigen::Vector3f> Mesh::VertexLBSTransformation(
+    const SkinningVertex & vertex, const SkinningInfluence * influences,
+    const Eigen::Matrix3f * matrixRotations,
+    const Eigen::Vector3f * translations)
 {
-    const Eigen::SparseVector<float> & skinWeights = weights.col(index);
-
     // resulting transformations
     Eigen::Matrix3f rotation;
     rotation.setZero();
     Eigen::Vector3f translation;
     translation.setZero();
 
-    for (Eigen::SparseVector<float>::InnerIterator it(skinWeights); it; ++it)
+    for (int i = 0; i < vertex.influenceCount; i++)
     {
-        auto boneIndex = it.index();
-        auto boneWeight = it.value();
+        auto boneIndex = influences[i].bone;
+        auto boneWeight = influences[i].weight;
 
         rotation += boneWeight * matrixRotations[boneIndex];
         translation += boneWeight * translations[boneIndex];
     }
 
     return std::make_pair(rotation, translation);
-}
\ No newline at end of file
+}
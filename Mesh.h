@@ -3,7 +3,34 @@
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #include <Eigen/Geometry>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <utility>
+
+#include "compute_progress.h"
+#include "skinning_layout.h"
+#include "thread_pool.h"
+#include "triangle_bvh.h"
+#include "triangle_cache.h"
+
+struct SkinCompression;
+struct Subdivision;
+
+// default least number of vertices skinned per task
+#define SKINNING_CHUNK_SIZE 1024
+
+// Compact against float skinning of a pose, distances in mesh units
+struct SkinningAccuracy
+{
+    float maxError;
+    float meanError;
+    // largest errors of the stored data
+    float weightError;
+    float restPositionError;
+    float centerError;
+};
 
 class Mesh
 {
@@ -14,7 +41,8 @@ private:
     const Eigen::MatrixXi triangles;
 
     // skin weights, col is vector of weights for one vertex
-    const Eigen::SparseMatrix<float> weights;
+    // may be repainted with UpdateWeights
+    Eigen::SparseMatrix<float> weights;
 
     // centers of rotation
     bool areCentersComputed = false;
@@ -22,33 +50,146 @@ private:
     std::vector<int> indexOfCenter;
     Eigen::MatrixXf centersOfRotation;
 
-    // // additional subdivision
-    // // the index of a vertex here omits base vertex count
-    // Eigen::MatrixXf subdividedVertices;
-    // // the index of a face here omits base face count
-    // Eigen::MatrixXi subdividedTriangles;
-    // // position in this matrix represents indices of all vertices
-    // Eigen::SparseMatrix<float> subdividedWeights;
-
-    // compute center of rotation for vertex at the given index
-    // carry a cache to hasten computations
-    Eigen::Vector3f ComputeCenterOfRotation(int index,
-        const std::vector<Eigen::SparseVector<float>> & cacheTriangleWeights,
-        const std::vector<float> & cacheTriangleAreas);
-
-    // weight of a triangle is the average of its vertices
-    void FindTriangleWeight(int triangleIndex,
-        std::vector<Eigen::SparseVector<float>> & cacheTriangleWeights);
-
-    // Runtime algorithm on one vertex
-    const Eigen::Vector3f DeformVertex(int index, 
-        const std::vector<Eigen::Quaternionf> & rotations,
-        const std::vector<Eigen::Matrix3f> & matrixRotations,
-        const std::vector<Eigen::Vector3f> & translations);
+    // entries of the computed centers by a hash of what they depend on,
+    // see center_cache.h, not used when empty
+    std::string centerCacheDirectory;
+    bool isCenterCacheHit = false;
 
-    const std::pair<Eigen::Matrix3f, Eigen::Vector3f> VertexLBSTransformation(int index,
-        const std::vector<Eigen::Matrix3f> & matrixRotations,
-        const std::vector<Eigen::Vector3f> & translations);
+    // vertices with the same weight signature get the same center,
+    // computed once and stored once when shared. Off by default, the C API
+    // reads a row of the centers per vertex with a center.
+    bool shareCenters = false;
+    float signatureTolerance = 0;
+
+    // Group multi bone vertices by weight signature, groupOfVertex is -1 for
+    // single bone vertices. Returns the first vertex of each group.
+    std::vector<int> GroupBySignature(std::vector<int> & groupOfVertex);
+
+    // 0 computes the exact centers, otherwise the largest
+    // distance allowed from the exact centers
+    float maxCenterError = 0;
+    // largest error bound over the computed centers
+    float centerError = 0;
+
+    // workers for the precomputation, created on first use
+    int threadCount = 0;
+    std::unique_ptr<ThreadPool> threadPool;
+    ThreadPool & GetThreadPool();
+
+    // additional subdivision, only used to integrate the centers
+    // 0 when the rest triangles are integrated
+    float subdivisionThreshold = 0;
+    // the index of a vertex here omits base vertex count
+    Eigen::MatrixXf subdividedVertices;
+    // all triangles integrated, indices cover rest and subdivided vertices
+    Eigen::MatrixXi subdividedTriangles;
+    // position in this matrix represents indices of all vertices
+    Eigen::SparseMatrix<float> subdividedWeights;
+    // Replace the subdivision, an empty one with threshold 0
+    void StoreSubdivision(Subdivision && subdivision, float threshold);
+
+    // per triangle data of the precomputation, built on first use
+    std::unique_ptr<TriangleCache> triangleCache;
+    const TriangleCache & GetTriangleCache();
+
+    // Sums of the exact centers per weight group, nominator / denominator
+    // is the center. Kept to patch the centers when weights are repainted.
+    bool areCenterSumsValid = false;
+    std::vector<int> groupOfCenterSums;
+    std::vector<Eigen::Vector3f> centerNominators;
+    std::vector<float> centerDenominators;
+
+    // Runs compute(group, scratch) on every group of vertices in parallel.
+    // On failure the lowest failing group's message goes to failure,
+    // like in a serial loop, and false is returned.
+    // With a progress, completed groups are published there and a
+    // cancellation stops the workers, which also counts as a failure.
+    bool ComputeGroups(int groupCount,
+        const std::function<void(int, std::vector<int> &)> & compute,
+        std::string & failure, ComputeProgress * progress = nullptr);
+
+    // Fill indexOfCenter and centersOfRotation from the center of each group
+    void StoreCenters(const std::vector<int> & groupOfVertex,
+        const std::vector<Eigen::Vector3f> & groupCenters);
+
+    // approximate the center within maxCenterError with a hierarchy of triangles
+    Eigen::Vector3f ApproximateCenterOfRotation(int index,
+        const TriangleBVH & hierarchy, float & error);
+
+    // runtime data baked from the rest pose, weights and centers,
+    // dropped whenever the centers are stored again
+    std::unique_ptr<SkinningLayout> skinningLayout;
+    const SkinningLayout & GetSkinningLayout();
+    // store the vertices of the layout in LocalityVertexOrder when it
+    // touches fewer lines than the mesh's order
+    bool reorderVertices = false;
+    // bits of the weights of the compact layout, 0 for floats
+    int compactWeightBits = 0;
+
+    // instruction set of the skinning kernel, Scalar uses DeformVertex
+    SimdLevel skinningSimd = DetectSimdLevel();
+    // bone transformations of the frame, bone b of instance j at
+    // j * bone count + b, kept between frames so skinning does not allocate
+    // once the sizes are known
+    std::vector<Eigen::Quaternionf> frameRotations;
+    std::vector<Eigen::Matrix3f> frameMatrices;
+    std::vector<Eigen::Vector3f> frameTranslations;
+    // the same for the kernels, one array per coefficient
+    std::vector<float> frameData;
+    std::vector<SkinningFrame> instanceFrames;
+    // outputs of the instances of SkinBatchInto
+    std::vector<SkinningOutput> batchOutputs;
+
+    // rest normals (x y z) and tangents (x y z w) per vertex, no rows when
+    // absent, and how they are skinned
+    Eigen::MatrixXf restNormals;
+    Eigen::MatrixXf restTangents;
+    bool lbsNormals = false;
+
+    // Incremental skinning keeps the transformations of the previous frame
+    // (x y z w rotation and x y z translation per bone) and where it was
+    // written, to skin again only the blocks of the bones that moved
+    bool incrementalSkinning = false;
+    bool hasPreviousFrame = false;
+    std::vector<float> previousTransformations;
+    SkinningOutput previousOutput = {};
+    std::vector<unsigned char> dirtyBlockMask;
+    std::vector<int> dirtyBlocks;
+    // what SkinCOR updates in incremental mode
+    Eigen::MatrixXf skinnedVertices;
+
+    // Fills dirtyBlocks with the blocks influenced by bones whose
+    // transformation changed since the previous frame, when it was written
+    // to the same output, and returns their count. Returns the block count
+    // when every block must be skinned. This frame becomes the previous one.
+    int FindDirtyBlocks(const float * rotations, const float * translations,
+        const SkinningOutput & output);
+
+    // workers for SkinCOR, apart from the precomputation so frames never
+    // queue behind a background computation of the centers
+    int skinningThreadCount = 0;
+    int skinningChunkSize = SKINNING_CHUNK_SIZE;
+    std::unique_ptr<ThreadPool> skinningPool;
+    ThreadPool & GetSkinningPool();
+
+    // Skins every vertex for each instance j into outputs[j]. Rotations are
+    // x y z w and translations x y z per bone.
+    void Skin(int instanceCount, const float * const * rotations,
+        const float * const * translations, const SkinningOutput * outputs);
+
+    // Runtime algorithm on one vertex, the blended quaternion rotation and
+    // LBS matrix are also returned when asked for
+    const Eigen::Vector3f DeformVertex(const SkinningVertex & vertex,
+        const SkinningInfluence * influences,
+        const Eigen::Quaternionf * rotations,
+        const Eigen::Matrix3f * matrixRotations,
+        const Eigen::Vector3f * translations,
+        Eigen::Matrix3f * quaternionMatrix = nullptr, Eigen::Matrix3f * lbsMatrix = nullptr);
+
+    const std::pair<Eigen::Matrix3f, Eigen::Vector3f> VertexLBSTransformation(
+        const SkinningVertex & vertex, const SkinningInfluence * influences,
+        const Eigen::Matrix3f * matrixRotations,
+        const Eigen::Vector3f * translations);
 
 public:
     
@@ -56,6 +197,10 @@ public:
     // debug
     std::string failureContextMessage;
 
+    // set while a CenterJob computes the centers of this mesh
+    std::atomic<bool> isComputingCenters{false};
+    bool IsComputingCenters() const {return isComputingCenters.load();}
+
     void ResetFailureMessage()
     {
         failureContextMessage = "";
@@ -63,22 +208,90 @@ public:
 
     const Eigen::MatrixXf & GetVertices() const {return vertices;}
     const Eigen::MatrixXi & GetFaces() const {return triangles;}
+    const Eigen::SparseMatrix<float> & GetWeights() const {return weights;}
 
     int GetRestVertexCount() {return (int) vertices.rows();}
-    // int GetSubdividedVertexCount() {return (int) subdividedVertices.rows();}
+    int GetSubdividedVertexCount() {return (int) subdividedVertices.rows();}
     int GetRestFaceCount() {return (int) triangles.rows();}
-    // int GetSubdividedFaceCount() {return (int) subdividedTriangles.rows();}
+    int GetSubdividedFaceCount() {return (int) subdividedTriangles.rows();}
 
     int GetCenterCount();
     const Eigen::MatrixXf & GetCentersOfRotation();
 
     int GetBoneCount() {return (int) weights.rows();}
 
+    // Vertices whose weights match up to the tolerance (0 for exact)
+    // share a center, and a row of the centers when share is true
+    void SetCenterSharing(bool share, float tolerance);
+
+    // Directory where computed centers are saved and looked up, keyed by a
+    // hash of the rest pose, weights and parameters: the centers are only
+    // computed when nothing there matches. Empty (default) disables it.
+    void SetCenterCacheDirectory(const std::string & directory);
+    // whether the last centers were read from the cache
+    bool IsCenterCacheHit() {return isCenterCacheHit;}
+
+    // Trade accuracy of the centers for speed on large meshes,
+    // 0 (default) computes the exact centers
+    void SetMaxCenterError(float maxError);
+    // bound on the distance to the exact centers of the last computation
+    float GetCenterError() {return centerError;}
+
+    // Only skin the vertices of bones whose transformation changed since the
+    // previous frame, keeping the rest of the output as it is. The buffer of
+    // SkinInto must be left untouched between frames, a different buffer is
+    // skinned in full. Batches are always skinned in full.
+    void SetIncrementalSkinning(bool incremental);
+    bool IsIncrementalSkinning() {return incrementalSkinning;}
+
+    // Skin with SIMD kernels up to the given level, lowered to what the
+    // processor supports. Scalar skins one vertex at a time.
+    void SetSkinningSimd(SimdLevel level);
+    SimdLevel GetSkinningSimd() {return skinningSimd;}
+
+    // Store the vertices for the skinning by center, bone set and position
+    // instead of in the mesh's order, see vertex_order.h, unless the mesh's
+    // order touches fewer lines. Outputs keep the mesh's order.
+    void SetVertexReordering(bool reorder);
+    bool IsVertexReordering() {return reorderVertices;}
+    // what skinning a frame touches with the order in use, and with the
+    // mesh's order, to weigh the reordering
+    const SkinningLayoutStats & GetSkinningStats() {return GetSkinningLayout().GetStats();}
+    const SkinningLayoutStats & GetMeshOrderSkinningStats() {return GetSkinningLayout().GetMeshOrderStats();}
+
+    // Store the weights on 8 or 16 bits, the bone indices on 8 bits up to
+    // 256 bones and 16 otherwise, and the rest positions and centers on a
+    // 16 bit grid over their bounding box, for less memory traffic when
+    // skinning. 0 (default) stores floats.
+    void SetCompactSkinning(int weightBits);
+    int GetCompactSkinning() {return compactWeightBits;}
+    // Skins the pose with the compact and the float storage and compares
+    // them, the float layout is built for the occasion
+    SkinningAccuracy MeasureCompactSkinning(const float * rotations, const float * translations);
+
+    // 0 means one thread per hardware thread
+    void SetThreadCount(int count);
+    int GetThreadCount() {return GetThreadPool().GetThreadCount();}
+
+    // Threads skinning a frame, 0 means one per hardware thread. Meshes
+    // smaller than the chunk size are skinned on the calling thread.
+    void SetSkinningThreadCount(int count);
+    int GetSkinningThreadCount() {return GetSkinningPool().GetThreadCount();}
+    // least number of vertices per task, rounded up to whole blocks
+    void SetSkinningChunkSize(int vertexCount);
+    int GetSkinningChunkSize() {return skinningChunkSize;}
+
     void Serialize(const std::string & path);
     // Read from disk
     void ReadCentersOfRotation(const std::string & path);
     // Write to disk
     void WriteCentersOfRotation(const std::string & path);
+    // Single file binary counterpart of Serialize, see mesh_bundle.h,
+    // with the centers when they are computed, compressed when asked
+    void SerializeBundle(const std::string & path, const SkinCompression * compression = nullptr);
+    // Centers known ahead, indexOfCenter is -1 for vertices without one.
+    // Throws if they do not match the mesh.
+    void SetCentersOfRotation(const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers);
 #pragma endregion
 
     // null mesh for failed construction
@@ -88,26 +301,65 @@ public:
     }
 
     Mesh(Eigen::MatrixXf vertices, Eigen::MatrixXi triangles, Eigen::SparseMatrix<float> weights)
-        : vertices(vertices), triangles(triangles), weights(weights) 
+        : vertices(std::move(vertices)), triangles(std::move(triangles)), weights(std::move(weights))
     {
         this->failureContextMessage = "";
     }
     ~Mesh(){}
 
-    // Compute the centers of rotations and store them in a private field
-    void ComputeCentersOfRotation();
+    // Compute the centers of rotations and store them in a private field.
+    // The optional progress is updated as groups of vertices are done and
+    // can cancel the computation, leaving the centers uncomputed.
+    // Returns false on failure or cancellation, the message goes to error,
+    // or to failureContextMessage without one.
+    bool ComputeCentersOfRotation(ComputeProgress * progress = nullptr,
+        std::string * error = nullptr);
 
-    // additional subdivision
-    // // Compute the skinning weight distance between two vertices: norm(wi - wj)
-    // float SkinningWeightDistance(int vertexIndex1, int vertexIndex2);
+    // Replace the weights of some vertices. Exact centers already computed are
+    // patched: only the triangles touching these vertices are integrated again
+    // for the other vertices, and the repainted vertices are recomputed.
+    // With a subdivision it is redone for the new weights, if that throws
+    // the mesh is left as it was.
+    void UpdateWeights(const std::vector<int> & vertexIndices,
+        const std::vector<Eigen::SparseVector<float>> & newWeights);
 
-    // // Subdivide the mesh to get skinning weight distances under a threshold for all triangles
-    // void SubdivideTriangles(float threshold);
+    // additional subdivision
+    // Compute the skinning weight distance between two vertices: norm(wi - wj)
+    // Indices past the rest vertices refer to subdivided vertices.
+    float SkinningWeightDistance(int vertexIndex1, int vertexIndex2);
 
-    // in case performance is an issue
-    // void SetMeshVertexBuffer(void * );
+    // Subdivide the mesh to get skinning weight distances under a threshold for all triangles.
+    // The subdivided triangles are only integrated for the centers of rotation,
+    // the animated mesh keeps its rest triangles. 0 removes the subdivision.
+    void SubdivideTriangles(float threshold);
 
     // runtime algorithm
     const Eigen::MatrixXf SkinCOR(const std::vector<Eigen::Quaternionf> & rotations,
         const std::vector<Eigen::Vector3f> & translations);
+
+    // SkinCOR without copies: rotations (x y z w) and translations (x y z)
+    // of every bone are read in place and the positions (x y z per vertex)
+    // written in place. Frames after the first do not allocate.
+    // Normals (x y z) and tangents (x y z w) are skinned in the same pass
+    // when given, which needs the rest ones.
+    void SkinInto(const float * rotations, const float * translations, float * positions,
+        float * normals = nullptr, float * tangents = nullptr);
+    // SkinInto with positions written as IEEE half floats
+    void SkinHalfInto(const float * rotations, const float * translations, uint16_t * positions);
+
+    // Rest normals (x y z) and tangents (x y z w, w is copied) per vertex,
+    // an empty matrix removes them
+    void SetRestNormals(const Eigen::MatrixXf & normals);
+    void SetRestTangents(const Eigen::MatrixXf & tangents);
+    // By default normals and tangents are turned by the blended quaternion,
+    // like the positions. Otherwise normals take the inverse transpose of the
+    // blended LBS matrix and tangents that matrix, and both are normalized.
+    void SetLbsNormals(bool lbs) {lbsNormals = lbs;}
+
+    // SkinInto for many poses of this mesh at once, like a crowd. Instance j
+    // reads rotations[j] and translations[j] and writes positions[j]. The
+    // instances skin the same vertices one after the other, so the weights,
+    // centers and rest positions are loaded once for all of them.
+    void SkinBatchInto(int instanceCount, const float * const * rotations,
+        const float * const * translations, float * const * positions);
 };
\ No newline at end of file
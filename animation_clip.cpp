@@ -0,0 +1,255 @@
+#include "animation_clip.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#define CLIP_MAGIC "CORC"
+#define CLIP_VERSION 1
+
+AnimationClip::AnimationClip(const std::vector<BoneTrack> & tracks)
+{
+    boneCount = (int) tracks.size();
+    rotationStart.assign(1, 0);
+    translationStart.assign(1, 0);
+
+    for (int b = 0; b < boneCount; b++)
+    {
+        const auto & track = tracks[b];
+        if (track.rotationTimes.size() != track.rotations.size()
+            || track.translationTimes.size() != track.translations.size())
+            throw std::invalid_argument("Bone " + std::to_string(b) + " has not one time per key");
+
+        rotationTimes.insert(rotationTimes.end(), track.rotationTimes.begin(), track.rotationTimes.end());
+        rotations.insert(rotations.end(), track.rotations.begin(), track.rotations.end());
+        translationTimes.insert(translationTimes.end(),
+            track.translationTimes.begin(), track.translationTimes.end());
+        translations.insert(translations.end(), track.translations.begin(), track.translations.end());
+
+        rotationStart.push_back((int) rotationTimes.size());
+        translationStart.push_back((int) translationTimes.size());
+    }
+
+    Validate();
+}
+
+void AnimationClip::Validate()
+{
+    duration = 0;
+
+    for (auto times : {std::make_pair(&rotationStart, &rotationTimes),
+        std::make_pair(&translationStart, &translationTimes)})
+    {
+        const auto & start = *times.first;
+        const auto & keyTimes = *times.second;
+
+        for (int b = 0; b < boneCount; b++)
+        {
+            for (int k = start[b]; k < start[b + 1]; k++)
+            {
+                if (k > start[b] && !(keyTimes[k] > keyTimes[k - 1]))
+                    throw std::invalid_argument("Key times of bone " + std::to_string(b)
+                        + " are not increasing");
+                duration = std::max(duration, keyTimes[k]);
+            }
+        }
+    }
+}
+
+AnimationClip AnimationClip::Read(const std::string & path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot open " + path);
+
+    auto readInts = [&](std::vector<int> & values, size_t count)
+    {
+        std::vector<std::int32_t> read(count);
+        file.read((char *) read.data(), count * sizeof(std::int32_t));
+        values.assign(read.begin(), read.end());
+    };
+    auto readFloats = [&](std::vector<float> & values, size_t count)
+    {
+        values.resize(count);
+        file.read((char *) values.data(), count * sizeof(float));
+    };
+
+    char magic[4];
+    std::int32_t header[2];
+    file.read(magic, sizeof(magic));
+    file.read((char *) header, sizeof(header));
+    if (!file || std::memcmp(magic, CLIP_MAGIC, sizeof(magic)) != 0)
+        throw std::runtime_error(path + " is not an animation clip");
+    if (header[0] != CLIP_VERSION)
+        throw std::runtime_error("Unsupported clip version " + std::to_string(header[0]));
+    if (header[1] < 0) throw std::runtime_error("Negative bone count in " + path);
+
+    std::vector<BoneTrack> tracks(header[1]);
+    std::vector<int> rotationCounts, translationCounts;
+    readInts(rotationCounts, tracks.size());
+    readInts(translationCounts, tracks.size());
+    if (!file) throw std::runtime_error("Truncated clip " + path);
+
+    std::vector<float> times, values;
+    for (auto counts : {&rotationCounts, &translationCounts})
+    {
+        bool isRotation = counts == &rotationCounts;
+        int size = isRotation ? 4 : 3;
+
+        long long keyCount = 0;
+        for (int count : *counts)
+        {
+            if (count < 0) throw std::runtime_error("Negative key count in " + path);
+            keyCount += count;
+        }
+
+        readFloats(times, keyCount);
+        readFloats(values, keyCount * size);
+        if (!file) throw std::runtime_error("Truncated clip " + path);
+
+        size_t key = 0;
+        for (size_t b = 0; b < tracks.size(); b++)
+        {
+            auto & track = tracks[b];
+            for (int k = 0; k < (*counts)[b]; k++, key++)
+            {
+                const float * value = values.data() + key * size;
+                if (isRotation)
+                {
+                    track.rotationTimes.push_back(times[key]);
+                    track.rotations.emplace_back(value[3], value[0], value[1], value[2]);
+                }
+                else
+                {
+                    track.translationTimes.push_back(times[key]);
+                    track.translations.emplace_back(value[0], value[1], value[2]);
+                }
+            }
+        }
+    }
+
+    if (file.peek() != std::ifstream::traits_type::eof())
+        throw std::runtime_error("Unexpected data after the clip in " + path);
+
+    return AnimationClip(tracks);
+}
+
+void AnimationClip::Write(const std::string & path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot open " + path);
+
+    std::int32_t header[2] = {CLIP_VERSION, boneCount};
+    file.write(CLIP_MAGIC, 4);
+    file.write((const char *) header, sizeof(header));
+
+    for (const auto * start : {&rotationStart, &translationStart})
+    {
+        for (int b = 0; b < boneCount; b++)
+        {
+            std::int32_t count = (*start)[b + 1] - (*start)[b];
+            file.write((const char *) &count, sizeof(count));
+        }
+    }
+
+    file.write((const char *) rotationTimes.data(), rotationTimes.size() * sizeof(float));
+    for (const auto & rotation : rotations)
+    {
+        file.write((const char *) rotation.coeffs().data(), 4 * sizeof(float));
+    }
+    file.write((const char *) translationTimes.data(), translationTimes.size() * sizeof(float));
+    for (const auto & translation : translations)
+    {
+        file.write((const char *) translation.data(), 3 * sizeof(float));
+    }
+
+    if (!file) throw std::runtime_error("Cannot write " + path);
+}
+
+// Key before the time and how far the time is towards the next one,
+// clamped to the first and last keys
+static int FindKey(const float * times, int count, float time, float & alpha)
+{
+    alpha = 0;
+    if (count == 1 || time <= times[0]) return 0;
+    if (time >= times[count - 1]) return count - 1;
+
+    int key = (int) (std::upper_bound(times, times + count, time) - times) - 1;
+    alpha = (time - times[key]) / (times[key + 1] - times[key]);
+    return key;
+}
+
+void AnimationClip::Sample(float time, float * boneRotations, float * boneTranslations) const
+{
+    // a NaN is before no key and after none, the keys cannot be found
+    if (!std::isfinite(time)) throw std::invalid_argument("The time of a clip sample must be finite");
+
+    for (int b = 0; b < boneCount; b++)
+    {
+        Eigen::Quaternionf rotation = Eigen::Quaternionf::Identity();
+        int first = rotationStart[b];
+        int count = rotationStart[b + 1] - first;
+        if (count > 0)
+        {
+            float alpha;
+            int key = first + FindKey(rotationTimes.data() + first, count, time, alpha);
+            rotation = alpha > 0 ? rotations[key].slerp(alpha, rotations[key + 1]) : rotations[key];
+        }
+
+        Eigen::Vector3f translation = Eigen::Vector3f::Zero();
+        first = translationStart[b];
+        count = translationStart[b + 1] - first;
+        if (count > 0)
+        {
+            float alpha;
+            int key = first + FindKey(translationTimes.data() + first, count, time, alpha);
+            translation = alpha > 0
+                ? Eigen::Vector3f((1 - alpha) * translations[key] + alpha * translations[key + 1])
+                : translations[key];
+        }
+
+        std::memcpy(boneRotations + 4 * b, rotation.coeffs().data(), 4 * sizeof(float));
+        std::memcpy(boneTranslations + 3 * b, translation.data(), 3 * sizeof(float));
+    }
+}
+
+void BakeClip(Mesh & mesh, const AnimationClip & clip, float startTime, float frameRate,
+    int frameCount, float * cache)
+{
+    if (clip.GetBoneCount() != mesh.GetBoneCount())
+    {
+        throw std::runtime_error("The clip has " + std::to_string(clip.GetBoneCount())
+            + " bones, the mesh " + std::to_string(mesh.GetBoneCount()));
+    }
+    if (!(frameRate > 0)) throw std::invalid_argument("The frame rate must be positive");
+    if (!std::isfinite(startTime)) throw std::invalid_argument("The start time must be finite");
+
+    int boneCount = clip.GetBoneCount();
+    size_t frameSize = (size_t) 3 * mesh.GetRestVertexCount();
+
+    std::vector<float> rotations((size_t) CLIP_BAKE_BATCH_SIZE * 4 * boneCount);
+    std::vector<float> translations((size_t) CLIP_BAKE_BATCH_SIZE * 3 * boneCount);
+    std::vector<const float *> rotationOf(CLIP_BAKE_BATCH_SIZE);
+    std::vector<const float *> translationOf(CLIP_BAKE_BATCH_SIZE);
+    std::vector<float *> positionOf(CLIP_BAKE_BATCH_SIZE);
+
+    // frames of a batch are skinned together, the mesh spreads them over threads
+    for (int batchStart = 0; batchStart < frameCount; batchStart += CLIP_BAKE_BATCH_SIZE)
+    {
+        int batchSize = std::min(CLIP_BAKE_BATCH_SIZE, frameCount - batchStart);
+        for (int j = 0; j < batchSize; j++)
+        {
+            int frame = batchStart + j;
+            rotationOf[j] = rotations.data() + (size_t) j * 4 * boneCount;
+            translationOf[j] = translations.data() + (size_t) j * 3 * boneCount;
+            positionOf[j] = cache + frame * frameSize;
+
+            clip.Sample(startTime + frame / frameRate, rotations.data() + (size_t) j * 4 * boneCount,
+                translations.data() + (size_t) j * 3 * boneCount);
+        }
+
+        mesh.SkinBatchInto(batchSize, rotationOf.data(), translationOf.data(), positionOf.data());
+    }
+}
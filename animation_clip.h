@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include <string>
+#include <vector>
+
+// frames skinned together when a clip is baked
+#define CLIP_BAKE_BATCH_SIZE 32
+
+// keyframes of one bone, times strictly increasing
+struct BoneTrack
+{
+    std::vector<float> rotationTimes;
+    // unit quaternions
+    std::vector<Eigen::Quaternionf> rotations;
+    std::vector<float> translationTimes;
+    std::vector<Eigen::Vector3f> translations;
+};
+
+// Keyframed bone transformations, sampled at any time: rotations are
+// slerped and translations lerped between the keys around the time, and held
+// before the first and after the last key. A bone without keys keeps the
+// identity.
+//
+// Files are little endian:
+//   char[4] "CORC", int32 version (1), int32 bone count
+//   int32 rotation key count of each bone, int32 translation key count of each bone
+//   float rotation times, float rotations (x y z w), all bones one after the other
+//   float translation times, float translations (x y z), likewise
+class AnimationClip
+{
+private:
+    int boneCount = 0;
+    float duration = 0;
+
+    // keys of bone b are [start[b], start[b + 1])
+    std::vector<int> rotationStart;
+    std::vector<float> rotationTimes;
+    std::vector<Eigen::Quaternionf> rotations;
+    std::vector<int> translationStart;
+    std::vector<float> translationTimes;
+    std::vector<Eigen::Vector3f> translations;
+
+    // checks the keys and finds the duration
+    void Validate();
+
+public:
+    // debug
+    std::string failureContextMessage;
+
+    // null clip for failed construction
+    AnimationClip(std::string failureMessage)
+    {
+        failureContextMessage = failureMessage;
+    }
+
+    // throws if the times of a track are not strictly increasing
+    explicit AnimationClip(const std::vector<BoneTrack> & tracks);
+
+    // Read from disk, throws if the file is not a clip
+    static AnimationClip Read(const std::string & path);
+    // Write to disk
+    void Write(const std::string & path) const;
+
+    int GetBoneCount() const {return boneCount;}
+    // time of the last key
+    float GetDuration() const {return duration;}
+
+    // Transformations of every bone at the time, rotations as x y z w and
+    // translations as x y z, the layout Mesh::SkinInto reads.
+    // Throws if the time is not finite.
+    void Sample(float time, float * boneRotations, float * boneTranslations) const;
+};
+
+// Skins frameCount frames of the clip, frame f at startTime + f / frameRate,
+// into the cache: frame f at cache + f * 3 * vertex count, x y z per vertex.
+// Frames are sampled by batch and skinned with Mesh::SkinBatchInto.
+void BakeClip(Mesh & mesh, const AnimationClip & clip, float startTime, float frameRate,
+    int frameCount, float * cache);
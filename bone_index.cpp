@@ -0,0 +1,42 @@
+#include "bone_index.h"
+
+#include <algorithm>
+
+BoneIndex::BoneIndex(const TriangleCache & triangles, int boneCount)
+    : trianglesOfBone(boneCount)
+{
+    // triangles are visited in order, so every list ends up sorted
+    for (int t = 0; t < triangles.GetTriangleCount(); t++)
+    {
+        const int * bones = triangles.GetWeightBones(t);
+        const float * values = triangles.GetWeightValues(t);
+
+        for (int i = 0; i < triangles.GetWeightCount(t); i++)
+        {
+            if (values[i] != 0) trianglesOfBone[bones[i]].push_back(t);
+        }
+    }
+}
+
+void BoneIndex::FindCandidates(const Eigen::SparseVector<float> & weight,
+    std::vector<int> & candidates) const
+{
+    candidates.clear();
+
+    int listCount = 0;
+    for (Eigen::SparseVector<float>::InnerIterator it(weight); it; ++it)
+    {
+        if (it.value() == 0) continue;
+
+        const auto & list = trianglesOfBone[it.index()];
+        candidates.insert(candidates.end(), list.begin(), list.end());
+        listCount++;
+    }
+
+    // a triangle may be listed under several bones of this vertex
+    if (listCount > 1)
+    {
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "triangle_cache.h"
+
+#include <Eigen/Sparse>
+
+#include <vector>
+
+// Inverted index from a bone to the triangles whose weight is non zero on it.
+// In ComputeSimilarity every term carries w1_j * w1_k * w2_k * w2_k
+// (w2_j is read at bone k), so a triangle only contributes to a vertex
+// when it shares at least one bone with it. Only the triangles listed
+// under the bones of a vertex have to be visited.
+class BoneIndex
+{
+private:
+    // triangle indices are sorted in each list
+    std::vector<std::vector<int>> trianglesOfBone;
+
+public:
+    BoneIndex() {}
+    BoneIndex(const TriangleCache & triangles, int boneCount);
+
+    // Sorted triangles sharing at least one bone with the weight.
+    // The result is written into candidates to reuse its storage.
+    void FindCandidates(const Eigen::SparseVector<float> & weight,
+        std::vector<int> & candidates) const;
+};
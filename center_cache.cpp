@@ -0,0 +1,165 @@
+#include "center_cache.h"
+#include "similarity.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#define CENTER_CACHE_MAGIC "CORCACHE"
+
+namespace
+{
+    // Multiply and rotate over 64 bit words, with a final avalanche
+    class ContentHash
+    {
+    private:
+        uint64_t hash = 0x9E3779B97F4A7C15ull;
+
+    public:
+        void Add(uint64_t word)
+        {
+            hash ^= word * 0xC2B2AE3D27D4EB4Full;
+            hash = ((hash << 31) | (hash >> 33)) * 0x9E3779B185EBCA87ull;
+        }
+
+        void Add(const void * data, size_t size)
+        {
+            const unsigned char * bytes = (const unsigned char *) data;
+            Add((uint64_t) size);
+            for (; size >= 8; bytes += 8, size -= 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, bytes, 8);
+                Add(word);
+            }
+            if (size > 0)
+            {
+                uint64_t word = 0;
+                std::memcpy(&word, bytes, size);
+                Add(word);
+            }
+        }
+
+        void Add(float value)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            Add((uint64_t) bits);
+        }
+
+        uint64_t Get() const
+        {
+            uint64_t result = hash;
+            result ^= result >> 33;
+            result *= 0xFF51AFD7ED558CCDull;
+            result ^= result >> 33;
+            result *= 0xC4CEB9FE1A85EC53ull;
+            result ^= result >> 33;
+            return result;
+        }
+    };
+}
+
+uint64_t CenterCacheKey(const Eigen::MatrixXf & vertices, const Eigen::MatrixXi & triangles,
+    const Eigen::SparseMatrix<float> & weights, const CenterCacheParameters & parameters)
+{
+    ContentHash hash;
+    hash.Add((uint64_t) CENTER_CACHE_VERSION);
+    hash.Add((float) KERNEL_WIDTH);
+    hash.Add(parameters.maxCenterError);
+    hash.Add(parameters.signatureTolerance);
+    hash.Add(parameters.subdivisionThreshold);
+
+    hash.Add(vertices.data(), vertices.size() * sizeof(float));
+    hash.Add(triangles.data(), triangles.size() * sizeof(int));
+
+    // by column, which does not depend on the weights being compressed
+    hash.Add((uint64_t) weights.rows());
+    hash.Add((uint64_t) weights.cols());
+    for (int i = 0; i < weights.cols(); i++)
+    {
+        hash.Add((uint64_t) -1);
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+        {
+            hash.Add((uint64_t) it.row());
+            hash.Add(it.value());
+        }
+    }
+
+    return hash.Get();
+}
+
+std::string CenterCachePath(const std::string & directory, uint64_t key)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.centers", (unsigned long long) key);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+bool ReadCenterCache(const std::string & directory, uint64_t key, int groupCount,
+    CenterCacheEntry & entry)
+{
+    std::ifstream file(CenterCachePath(directory, key), std::ios::binary);
+    if (!file) return false;
+
+    char magic[8];
+    std::int32_t header[2];
+    uint64_t readKey;
+    std::int32_t hasSums;
+    float centerError;
+    file.read(magic, sizeof(magic));
+    file.read((char *) header, sizeof(header));
+    file.read((char *) &readKey, sizeof(readKey));
+    file.read((char *) &hasSums, sizeof(hasSums));
+    file.read((char *) &centerError, sizeof(centerError));
+    if (!file || std::memcmp(magic, CENTER_CACHE_MAGIC, sizeof(magic)) != 0
+        || header[0] != CENTER_CACHE_VERSION || header[1] != groupCount || readKey != key)
+        return false;
+
+    entry.centerError = centerError;
+    entry.centers.resize(groupCount);
+    file.read((char *) entry.centers.data(), groupCount * 3 * sizeof(float));
+    entry.nominators.resize(hasSums ? groupCount : 0);
+    entry.denominators.resize(hasSums ? groupCount : 0);
+    file.read((char *) entry.nominators.data(), entry.nominators.size() * 3 * sizeof(float));
+    file.read((char *) entry.denominators.data(), entry.denominators.size() * sizeof(float));
+
+    return file && file.peek() == std::ifstream::traits_type::eof();
+}
+
+void WriteCenterCache(const std::string & directory, uint64_t key, const CenterCacheEntry & entry)
+{
+    std::filesystem::create_directories(directory);
+
+    // unique so writers of the same entry do not share the file
+    auto path = CenterCachePath(directory, key);
+    auto temporaryPath = path + "." + std::to_string(std::random_device()()) + ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        if (!file) throw std::runtime_error("Cannot open " + temporaryPath);
+
+        std::int32_t header[2] = {CENTER_CACHE_VERSION, (std::int32_t) entry.centers.size()};
+        std::int32_t hasSums = entry.nominators.empty() ? 0 : 1;
+        file.write(CENTER_CACHE_MAGIC, 8);
+        file.write((const char *) header, sizeof(header));
+        file.write((const char *) &key, sizeof(key));
+        file.write((const char *) &hasSums, sizeof(hasSums));
+        file.write((const char *) &entry.centerError, sizeof(entry.centerError));
+        file.write((const char *) entry.centers.data(), entry.centers.size() * 3 * sizeof(float));
+        file.write((const char *) entry.nominators.data(), entry.nominators.size() * 3 * sizeof(float));
+        file.write((const char *) entry.denominators.data(), entry.denominators.size() * sizeof(float));
+
+        if (!file)
+        {
+            file.close();
+            std::filesystem::remove(temporaryPath);
+            throw std::runtime_error("Cannot write " + temporaryPath);
+        }
+    }
+
+    std::filesystem::rename(temporaryPath, path);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// bumped whenever the centers computed from the same inputs change
+#define CENTER_CACHE_VERSION 1
+
+// What the centers of a weight group depend on besides the mesh
+struct CenterCacheParameters
+{
+    float maxCenterError;
+    float signatureTolerance;
+    float subdivisionThreshold;
+};
+
+// Centers of the weight groups of a mesh (Mesh::GroupBySignature), what
+// Mesh::ComputeCentersOfRotation computes before storing them
+struct CenterCacheEntry
+{
+    std::vector<Eigen::Vector3f> centers;
+    // sums of the exact centers, empty for approximate centers
+    std::vector<Eigen::Vector3f> nominators;
+    std::vector<float> denominators;
+    float centerError = 0;
+};
+
+// 64 bit hash of the rest pose, weights and parameters, KERNEL_WIDTH and
+// CENTER_CACHE_VERSION
+uint64_t CenterCacheKey(const Eigen::MatrixXf & vertices, const Eigen::MatrixXi & triangles,
+    const Eigen::SparseMatrix<float> & weights, const CenterCacheParameters & parameters);
+
+// Entries are files named by their key in the directory, little endian:
+//   char[8] "CORCACHE", int32 version, int32 group count, uint64 key,
+//   int32 has sums, float center error, float centers[group count][3],
+//   with sums float nominators[group count][3], float denominators[group count]
+std::string CenterCachePath(const std::string & directory, uint64_t key);
+
+// False when the directory has no valid entry of the key for groupCount groups
+bool ReadCenterCache(const std::string & directory, uint64_t key, int groupCount,
+    CenterCacheEntry & entry);
+
+// Creates the directory if needed. The entry is written aside and renamed
+// into place, so readers never see it partly written. Throws on failure.
+void WriteCenterCache(const std::string & directory, uint64_t key, const CenterCacheEntry & entry);
@@ -0,0 +1,107 @@
+#include "center_integrator.h"
+#include "similarity.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#define DIVISION_BY_ZERO_THRESHOLD 1e-10
+
+CenterIntegrator::CenterIntegrator(const Eigen::SparseMatrix<float> & weights,
+    const TriangleCache & triangles)
+    : weights(weights), triangles(triangles), boneIndex(triangles, (int) weights.rows())
+{
+    // a triangle may hold the bones of 3 vertices
+    int widestWeight = std::max(MaximumInfluences(weights), triangles.GetMaximumWeightCount());
+    if (widestWeight > 8) return;
+
+    for (int t = 0; t < triangles.GetTriangleCount(); t++)
+    {
+        if (widestWeight <= 4)
+            packedTriangleWeights4.push_back(PackInfluences<4>(triangles.GetWeightBones(t),
+                triangles.GetWeightValues(t), triangles.GetWeightCount(t)));
+        else
+            packedTriangleWeights8.push_back(PackInfluences<8>(triangles.GetWeightBones(t),
+                triangles.GetWeightValues(t), triangles.GetWeightCount(t)));
+    }
+}
+
+// Triangles outside of the candidates have a similarity of zero and are skipped,
+// the candidates are sorted so the sums are accumulated in the same order
+template <typename Similarity>
+void CenterIntegrator::Accumulate(const std::vector<int> & candidateTriangles,
+    const Similarity & similarityToTriangle,
+    Eigen::Vector3f & nominator, float & denominator) const
+{
+    // loop on the triangles sharing a bone with this vertex
+    for (int i : candidateTriangles)
+    {
+        auto similarity = similarityToTriangle(i);
+
+        auto triangleArea = triangles.GetArea(i);
+
+        nominator += similarity * triangles.GetCornerSum(i) / 3 * triangleArea;
+        denominator += similarity * triangleArea;
+    }
+}
+
+void CenterIntegrator::Accumulate(int vertexIndex, Eigen::Vector3f & nominator,
+    float & denominator, std::vector<int> & candidateTriangles) const
+{
+    const Eigen::SparseVector<float> vertexWeight = weights.col(vertexIndex);
+
+    boneIndex.FindCandidates(vertexWeight, candidateTriangles);
+
+    if (!packedTriangleWeights4.empty())
+    {
+        auto packed = PackInfluences<4>(vertexWeight);
+        Accumulate(candidateTriangles,
+            [&](int t) { return PackedSimilarity(packed, packedTriangleWeights4[t]); },
+            nominator, denominator);
+    }
+    else if (!packedTriangleWeights8.empty())
+    {
+        auto packed = PackInfluences<8>(vertexWeight);
+        Accumulate(candidateTriangles,
+            [&](int t) { return PackedSimilarity(packed, packedTriangleWeights8[t]); },
+            nominator, denominator);
+    }
+    else
+    {
+        Accumulate(candidateTriangles,
+            [&](int t)
+            {
+                return ComputeSimilarity(vertexWeight, triangles.GetWeightBones(t),
+                    triangles.GetWeightValues(t), triangles.GetWeightCount(t));
+            },
+            nominator, denominator);
+    }
+}
+
+void CenterIntegrator::CheckDenominator(int vertexIndex, float denominator)
+{
+    if (denominator < DIVISION_BY_ZERO_THRESHOLD)
+    {
+        auto message = std::string("Denominator is close to zero for vertex: ") 
+            + std::to_string(vertexIndex) + std::string("; threshold = ")
+            + std::to_string(DIVISION_BY_ZERO_THRESHOLD)
+            + std::string("; value found = ") 
+            + std::to_string(denominator);
+        throw std::logic_error(message);
+    }
+}
+
+void CenterIntegrator::AddTriangle(const Eigen::SparseVector<float> & weight,
+    const TriangleCache & triangles, int t,
+    const int * triangleBones, const float * triangleWeights, int triangleBoneCount,
+    float sign, Eigen::Vector3f & nominator, float & denominator)
+{
+    auto similarity = sign * ComputeSimilarity(weight, triangleBones,
+        triangleWeights, triangleBoneCount);
+    if (similarity == 0) return;
+
+    auto triangleArea = triangles.GetArea(t);
+
+    nominator += similarity * triangles.GetCornerSum(t) / 3 * triangleArea;
+    denominator += similarity * triangleArea;
+}
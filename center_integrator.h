@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bone_index.h"
+#include "packed_influences.h"
+#include "triangle_cache.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <vector>
+
+// Exact integral of the center of rotation of a vertex over the triangles.
+// It picks the similarity kernel once per mesh: packed weights when every
+// weight fits in 4 or 8 slots, sparse weights otherwise, and only visits
+// the triangles sharing a bone with the vertex.
+class CenterIntegrator
+{
+private:
+    const Eigen::SparseMatrix<float> & weights;
+    const TriangleCache & triangles;
+
+    // triangles that can contribute through each bone
+    BoneIndex boneIndex;
+
+    // only one of them is filled, if any
+    std::vector<PackedInfluences<4>> packedTriangleWeights4;
+    std::vector<PackedInfluences<8>> packedTriangleWeights8;
+
+    template <typename Similarity>
+    void Accumulate(const std::vector<int> & candidateTriangles,
+        const Similarity & similarityToTriangle,
+        Eigen::Vector3f & nominator, float & denominator) const;
+
+public:
+    CenterIntegrator(const Eigen::SparseMatrix<float> & weights,
+        const TriangleCache & triangles);
+
+    // Adds similarity * area * centroid and similarity * area over the
+    // triangles to the sums, the center is their ratio. Sums carried over
+    // several caches of consecutive triangles add up in triangle order.
+    // candidateTriangles is scratch storage, reused between calls.
+    void Accumulate(int vertexIndex, Eigen::Vector3f & nominator, float & denominator,
+        std::vector<int> & candidateTriangles) const;
+
+    // throws when the sums of a vertex are too small to give a center
+    static void CheckDenominator(int vertexIndex, float denominator);
+
+    // Term of triangle t in the sums, for a weight given as sorted bones and values
+    static void AddTriangle(const Eigen::SparseVector<float> & weight,
+        const TriangleCache & triangles, int t,
+        const int * triangleBones, const float * triangleWeights, int triangleBoneCount,
+        float sign, Eigen::Vector3f & nominator, float & denominator);
+};
@@ -0,0 +1,49 @@
+#include "center_job.h"
+
+#include <stdexcept>
+
+CenterJob::CenterJob(Mesh & mesh)
+    : mesh(mesh)
+{
+    if (mesh.isComputingCenters.exchange(true))
+        throw std::runtime_error("Centers are already being computed");
+
+    worker = std::thread(&CenterJob::Run, this);
+}
+
+CenterJob::~CenterJob()
+{
+    Cancel();
+    Wait();
+}
+
+void CenterJob::Wait()
+{
+    if (worker.joinable()) worker.join();
+}
+
+void CenterJob::Run()
+{
+    // the error stays in the job, the mesh is read by the caller meanwhile
+    std::string failure;
+    bool succeeded = false;
+
+    try
+    {
+        succeeded = mesh.ComputeCentersOfRotation(&progress, &failure);
+    }
+    catch (const std::exception & e)
+    {
+        failure = e.what();
+    }
+
+    Status result = Completed;
+    if (!succeeded)
+    {
+        result = progress.cancelled.load() ? Cancelled : Failed;
+        if (result == Failed) error = failure;
+    }
+
+    mesh.isComputingCenters.store(false);
+    status.store(result, std::memory_order_release);
+}
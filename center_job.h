@@ -0,0 +1,53 @@
+#pragma once
+
+#include "compute_progress.h"
+#include "Mesh.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Computes the centers of rotation of a mesh on a background thread.
+// The mesh must outlive the job, and only the job may use it while running:
+// the centers are read from the mesh once the job is completed.
+class CenterJob
+{
+public:
+    enum Status
+    {
+        Running = 0,
+        Completed = 1,
+        Failed = 2,
+        Cancelled = 3
+    };
+
+private:
+    Mesh & mesh;
+    ComputeProgress progress;
+
+    std::atomic<int> status{Running};
+    // written before status leaves Running
+    std::string error;
+
+    std::thread worker;
+
+    void Run();
+
+public:
+    // Starts computing, throws if another job is running on the mesh
+    explicit CenterJob(Mesh & mesh);
+    // cancels and waits for the computation
+    ~CenterJob();
+
+    CenterJob(const CenterJob &) = delete;
+    CenterJob & operator=(const CenterJob &) = delete;
+
+    float GetProgress() const {return progress.GetFraction();}
+    Status GetStatus() const {return (Status) status.load(std::memory_order_acquire);}
+    // empty unless the job failed
+    const std::string & GetError() const {return error;}
+
+    // The workers stop at their next chunk, the centers are left uncomputed
+    void Cancel() {progress.cancelled.store(true, std::memory_order_relaxed);}
+    void Wait();
+};
@@ -2,16 +2,22 @@
 
 #include "center_of_rotation_api.h"
 #include "Mesh.h"
+#include "gltf_import.h"
+#include "mesh_bundle.h"
+#include "streaming_centers.h"
 
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 #include <Eigen/Geometry>
 
+#include <algorithm>
 #include <vector>
 // #include <fstream>
 // #include <iostream>
 #include <sstream>
+#include <string>
 #include <string.h>
+#include <utility>
 
 /// Creates a mesh in cpp
 /// The bones parameter is an array of length equal
@@ -115,13 +121,12 @@ CENTER_OF_ROTATION_API Mesh *CreateMesh(
 
     // logFile.close();
 
-    return new Mesh(verts, faces, boneWeights);
+    return new Mesh(std::move(verts), std::move(faces), std::move(boneWeights));
 }
 
-// empty string means no error
-const char* GetFailureMessage(Mesh* mesh)
+// copy on the heap, freed with FreeErrorMessage
+const char* CopyMessage(const std::string & error)
 {
-    auto error = mesh->failureContextMessage;
     auto length = std::strlen(error.c_str()) + 1;
     auto message = new char[length];
 
@@ -131,12 +136,30 @@ const char* GetFailureMessage(Mesh* mesh)
     strcpy_s(message, length, error.c_str());
 #endif
 
+    return message;
+}
+
+// empty string means no error
+const char* GetFailureMessage(Mesh* mesh)
+{
+    auto message = CopyMessage(mesh->failureContextMessage);
+
     // reset failure message in mesh to empty string
     mesh->ResetFailureMessage();
 
     return message;
 }
 
+// A running CenterJob owns the mesh: calls that read or change it do
+// nothing and leave this error for the error getter of the call
+static bool IsBusy(Mesh * mesh)
+{
+    if (!mesh->IsComputingCenters()) return false;
+
+    mesh->failureContextMessage = "The centers of the mesh are being computed by a job";
+    return true;
+}
+
 CENTER_OF_ROTATION_API const char* HasFailedMeshConstruction(Mesh * mesh)
 {
     return GetFailureMessage(mesh);
@@ -161,25 +184,167 @@ CENTER_OF_ROTATION_API int GetRestFaceCount(Mesh *mesh)
 {
     return mesh->GetRestFaceCount();
 }
-// CENTER_OF_ROTATION_API int GetSubdividedVertexCount(Mesh *mesh)
-// {
-//     return mesh->GetSubdividedVertexCount();
-// }
-// CENTER_OF_ROTATION_API int GetSubdividedFaceCount(Mesh *mesh)
-// {
-//     return mesh->GetSubdividedFaceCount();
-// }
+CENTER_OF_ROTATION_API int GetSubdividedVertexCount(Mesh *mesh)
+{
+    return mesh->GetSubdividedVertexCount();
+}
+CENTER_OF_ROTATION_API int GetSubdividedFaceCount(Mesh *mesh)
+{
+    return mesh->GetSubdividedFaceCount();
+}
+
+CENTER_OF_ROTATION_API void SubdivideTriangles(Mesh * mesh, float threshold)
+{
+    if (IsBusy(mesh)) return;
+
+    try
+    {
+        mesh->SubdivideTriangles(threshold);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API const char * SubdivisionError(Mesh * mesh)
+{
+    return GetFailureMessage(mesh);
+}
+
+CENTER_OF_ROTATION_API void SetThreadCount(Mesh * mesh, int threadCount)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetThreadCount(threadCount);
+}
+
+CENTER_OF_ROTATION_API void SetCenterSharing(Mesh * mesh, int shareCenters, float tolerance)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetCenterSharing(shareCenters != 0, tolerance);
+}
+
+CENTER_OF_ROTATION_API void SetMaxCenterError(Mesh * mesh, float maxError)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetMaxCenterError(maxError);
+}
+
+CENTER_OF_ROTATION_API float GetCenterError(Mesh * mesh)
+{
+    if (IsBusy(mesh)) return 0;
+
+    return mesh->GetCenterError();
+}
+
+// background computation
+CENTER_OF_ROTATION_API CenterJob * StartComputeCenters(Mesh * mesh)
+{
+    try
+    {
+        return new CenterJob(*mesh);
+    }
+    catch(const std::exception&)
+    {
+        return nullptr;
+    }
+}
+
+CENTER_OF_ROTATION_API float GetJobProgress(CenterJob * job)
+{
+    return job->GetProgress();
+}
+
+CENTER_OF_ROTATION_API int GetJobStatus(CenterJob * job)
+{
+    return job->GetStatus();
+}
+
+CENTER_OF_ROTATION_API void CancelJob(CenterJob * job)
+{
+    job->Cancel();
+}
+
+CENTER_OF_ROTATION_API void WaitForJob(CenterJob * job)
+{
+    job->Wait();
+}
+
+CENTER_OF_ROTATION_API const char * JobError(CenterJob * job)
+{
+    if (job->GetStatus() != CenterJob::Failed) return CopyMessage("");
+
+    return CopyMessage(job->GetError());
+}
+
+CENTER_OF_ROTATION_API void DestroyJob(CenterJob * job)
+{
+    delete job;
+}
 
 // get centers of rotation
 CENTER_OF_ROTATION_API int GetCenterCount(Mesh * mesh)
 {
+    // not ready until the job is done
+    if (IsBusy(mesh)) return 0;
+
     return mesh->GetCenterCount();
 }
 
 // vertices pointer should point to an allocated Vector3[] in C#
+CENTER_OF_ROTATION_API void UpdateWeights(Mesh * mesh, int * vertexIndices, int vertexCount,
+    BoneWeight * weights, uint8_t * bones)
+{
+    if (IsBusy(mesh)) return;
+
+    std::vector<int> indices(vertexIndices, vertexIndices + vertexCount);
+    std::vector<Eigen::SparseVector<float>> newWeights;
+
+    int index = 0;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        Eigen::SparseVector<float> weight(mesh->GetBoneCount());
+
+        for (int j = 0; j < bones[i]; j++)
+        {
+            const auto & bone = weights[index];
+            if (bone.boneIndex < 0 || bone.boneIndex >= mesh->GetBoneCount())
+            {
+                mesh->failureContextMessage = "Bone index out of range: "
+                    + std::to_string(bone.boneIndex);
+                return;
+            }
+            weight.coeffRef(bone.boneIndex) += bone.weight;
+
+            index++;
+        }
+
+        newWeights.push_back(weight);
+    }
+
+    try
+    {
+        mesh->UpdateWeights(indices, newWeights);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API const char * WeightUpdateError(Mesh * mesh)
+{
+    return GetFailureMessage(mesh);
+}
+
 CENTER_OF_ROTATION_API void GetCentersOfRotation(Mesh * mesh, 
     float * vertices, int vertexCount)
 {
+    if (IsBusy(mesh)) return;
+
     const auto& centers = mesh->GetCentersOfRotation();
 
     for (int i = 0; i < vertexCount; i++)
@@ -203,96 +368,390 @@ CENTER_OF_ROTATION_API const char * HasFailedGettingCentersOfRotation(Mesh * mes
 // Serialization
 CENTER_OF_ROTATION_API void SerializeMesh(Mesh * mesh, const char * path)
 {
+    if (IsBusy(mesh)) return;
+
     mesh->Serialize(std::string(path));
 }
 
 CENTER_OF_ROTATION_API void ReadCenters(Mesh * mesh, const char * path)
 {
+    if (IsBusy(mesh)) return;
+
     mesh->ReadCentersOfRotation(path);
 }
 
 CENTER_OF_ROTATION_API void SerializeCenters(Mesh * mesh, const char * path)
 {
+    if (IsBusy(mesh)) return;
+
     mesh->WriteCentersOfRotation(path);
 }
 
+CENTER_OF_ROTATION_API void SetCenterCacheDirectory(Mesh * mesh, const char * directory)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetCenterCacheDirectory(directory ? directory : "");
+}
+
+CENTER_OF_ROTATION_API int IsCenterCacheHit(Mesh * mesh)
+{
+    if (IsBusy(mesh)) return 0;
+
+    return mesh->IsCenterCacheHit() ? 1 : 0;
+}
+
+CENTER_OF_ROTATION_API Mesh * LoadMeshBundle(const char * path)
+{
+    try
+    {
+        return ReadMeshBundle(path);
+    }
+    catch(const std::exception& e)
+    {
+        // null mesh carrying the error
+        return new Mesh(std::string(e.what()));
+    }
+}
+
+CENTER_OF_ROTATION_API Mesh * LoadGltfMesh(const char * path)
+{
+    try
+    {
+        return ReadGltfMesh(path);
+    }
+    catch(const std::exception& e)
+    {
+        // null mesh carrying the error
+        return new Mesh(std::string(e.what()));
+    }
+}
+
+CENTER_OF_ROTATION_API void SaveMeshBundle(Mesh * mesh, const char * path)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SerializeBundle(path);
+}
+
+CENTER_OF_ROTATION_API void SaveCompressedMeshBundle(Mesh * mesh, const char * path,
+    int weightBits, int centerBits)
+{
+    if (IsBusy(mesh)) return;
+
+    SkinCompression compression;
+    compression.weightBits = weightBits;
+    compression.centerBits = centerBits;
+    mesh->SerializeBundle(path, &compression);
+}
+
 CENTER_OF_ROTATION_API const char * SerializationError(Mesh * mesh)
 {
     return GetFailureMessage(mesh);
 }
 
+CENTER_OF_ROTATION_API const char * ComputeCentersFromFiles(const char * path,
+    int vertexTileSize, int triangleChunkSize)
+{
+    StreamingOptions options;
+    if (vertexTileSize > 0) options.vertexTileSize = vertexTileSize;
+    if (triangleChunkSize > 0) options.triangleChunkSize = triangleChunkSize;
+
+    try
+    {
+        ComputeCentersStreaming(path, options);
+    }
+    catch(const std::exception& e)
+    {
+        return CopyMessage(e.what());
+    }
+
+    return CopyMessage("");
+}
+
 // runtime algorithm
 // Transformations are in the frame of the vertices
 CENTER_OF_ROTATION_API void Animate(Mesh * mesh, BoneQuaternion * boneRotations,
     BoneTranslation * boneTranslations, float* transformed)
 {
-    std::vector<Eigen::Quaternionf> rotations;
-    std::vector<Eigen::Vector3f> translations;
+    // the structs are read in place as x y z w and x y z floats
+    static_assert(sizeof(BoneQuaternion) == 4 * sizeof(float), "BoneQuaternion is padded");
+    static_assert(sizeof(BoneTranslation) == 3 * sizeof(float), "BoneTranslation is padded");
 
-    // // debug
-    // std::ofstream logFile;
-    // logFile.open("C:/Users/Song/Documents/UDEM/ift6113/project/skinning_cor/logs/animation.log");
+    if (IsBusy(mesh)) return;
 
-    for (int i = 0; i < mesh->GetBoneCount(); i++)
+    try
     {
-        const auto & boneRotation = boneRotations[i];
+        mesh->SkinInto(&boneRotations->quaternionX, &boneTranslations->translationX,
+            transformed);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
 
-        rotations.push_back(Eigen::Quaternionf(
-            boneRotation.quaternionW,
-            boneRotation.quaternionX,
-            boneRotation.quaternionY,
-            boneRotation.quaternionZ
-        ));
+CENTER_OF_ROTATION_API void AnimateWithNormals(Mesh * mesh, BoneQuaternion * boneRotations,
+    BoneTranslation * boneTranslations, float * transformed, float * normals, float * tangents)
+{
+    if (IsBusy(mesh)) return;
 
-        const auto & boneTranslation = boneTranslations[i];
+    try
+    {
+        mesh->SkinInto(&boneRotations->quaternionX, &boneTranslations->translationX,
+            transformed, normals, tangents);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
 
-        translations.push_back(Eigen::Vector3f(
-            boneTranslation.translationX,
-            boneTranslation.translationY,
-            boneTranslation.translationZ
-        ));
+CENTER_OF_ROTATION_API void SetRestNormals(Mesh * mesh, float * normals)
+{
+    if (IsBusy(mesh)) return;
 
-        // // debug
-        // logFile << boneRotation.quaternionW << " "
-        //     << boneRotation.quaternionX << " "
-        //     << boneRotation.quaternionY << " "
-        //     << boneRotation.quaternionZ << " " << std::endl;
-        // logFile << boneTranslation.translationX << " "
-        //     << boneTranslation.translationY << " "
-        //     << boneTranslation.translationZ << " " << std::endl;
+    try
+    {
+        Eigen::MatrixXf restNormals;
+        if (normals) restNormals = Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor>>(
+            normals, mesh->GetRestVertexCount(), 3);
+        mesh->SetRestNormals(restNormals);
     }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API void SetRestTangents(Mesh * mesh, float * tangents)
+{
+    if (IsBusy(mesh)) return;
 
-    Eigen::MatrixXf newVertices;
     try
     {
-        newVertices = mesh->SkinCOR(rotations, translations);
+        Eigen::MatrixXf restTangents;
+        if (tangents) restTangents = Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, 4, Eigen::RowMajor>>(
+            tangents, mesh->GetRestVertexCount(), 4);
+        mesh->SetRestTangents(restTangents);
     }
     catch(const std::exception& e)
     {
         mesh->failureContextMessage = e.what();
     }
+}
 
-    // logFile << newVertices.topRows(5) << std::endl;
+CENTER_OF_ROTATION_API void SetLbsNormals(Mesh * mesh, int lbsNormals)
+{
+    if (IsBusy(mesh)) return;
 
-    // write vertex positions
-    for (int i = 0; i < (int) newVertices.rows(); i++)
-    {
-        Eigen::Vector3f vertex = newVertices.row(i);
-        *transformed = vertex.x();
-        *(transformed + 1) = vertex.y();
-        *(transformed + 2) = vertex.z();
+    mesh->SetLbsNormals(lbsNormals != 0);
+}
+
+CENTER_OF_ROTATION_API void AnimateBatch(Mesh * mesh, int instanceCount,
+    BoneQuaternion ** boneRotations, BoneTranslation ** boneTranslations, float ** transformed)
+{
+    if (IsBusy(mesh)) return;
 
-        // if (i < 10)
-        //     std::cout << vertex << std::endl;
+    // first float of every instance, kept for the next batches of this thread
+    thread_local std::vector<const float *> rotations;
+    thread_local std::vector<const float *> translations;
 
-        transformed += 3; // struct of 3 floats
+    try
+    {
+        rotations.resize(std::max(0, instanceCount));
+        translations.resize(std::max(0, instanceCount));
+        for (int j = 0; j < instanceCount; j++)
+        {
+            rotations[j] = &boneRotations[j]->quaternionX;
+            translations[j] = &boneTranslations[j]->translationX;
+        }
+
+        mesh->SkinBatchInto(instanceCount, rotations.data(), translations.data(), transformed);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
     }
-    
-    // // debug
-    // logFile.close();
 }
 
 CENTER_OF_ROTATION_API const char * AnimationError(Mesh * mesh)
 {
     return GetFailureMessage(mesh);
-}
\ No newline at end of file
+}
+
+CENTER_OF_ROTATION_API void SetSkinningSimd(Mesh * mesh, int level)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetSkinningSimd((SimdLevel) std::max(0, std::min(level, (int) SimdLevel::AVX512)));
+}
+
+CENTER_OF_ROTATION_API int GetSkinningSimd(Mesh * mesh)
+{
+    return (int) mesh->GetSkinningSimd();
+}
+
+CENTER_OF_ROTATION_API void SetIncrementalSkinning(Mesh * mesh, int incremental)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetIncrementalSkinning(incremental != 0);
+}
+
+CENTER_OF_ROTATION_API void SetSkinningThreadCount(Mesh * mesh, int threadCount)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetSkinningThreadCount(threadCount);
+}
+
+CENTER_OF_ROTATION_API void SetSkinningChunkSize(Mesh * mesh, int vertexCount)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetSkinningChunkSize(vertexCount);
+}
+
+CENTER_OF_ROTATION_API void SetVertexReordering(Mesh * mesh, int reorder)
+{
+    if (IsBusy(mesh)) return;
+
+    mesh->SetVertexReordering(reorder != 0);
+}
+
+CENTER_OF_ROTATION_API double GetSkinningCacheLines(Mesh * mesh, int meshOrder)
+{
+    if (IsBusy(mesh)) return -1;
+
+    try
+    {
+        const auto & stats = meshOrder ? mesh->GetMeshOrderSkinningStats() : mesh->GetSkinningStats();
+        return stats.cacheLines;
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+        return -1;
+    }
+}
+
+CENTER_OF_ROTATION_API void SetCompactSkinning(Mesh * mesh, int weightBits)
+{
+    if (IsBusy(mesh)) return;
+
+    try
+    {
+        mesh->SetCompactSkinning(weightBits);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API void MeasureCompactSkinning(Mesh * mesh, BoneQuaternion * boneRotations,
+    BoneTranslation * boneTranslations, SkinningAccuracy * accuracy)
+{
+    if (IsBusy(mesh)) return;
+
+    try
+    {
+        *accuracy = mesh->MeasureCompactSkinning(&boneRotations->quaternionX,
+            &boneTranslations->translationX);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API void AnimateHalf(Mesh * mesh, BoneQuaternion * boneRotations,
+    BoneTranslation * boneTranslations, uint16_t * transformed)
+{
+    if (IsBusy(mesh)) return;
+
+    try
+    {
+        mesh->SkinHalfInto(&boneRotations->quaternionX, &boneTranslations->translationX,
+            transformed);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API AnimationClip * LoadAnimationClip(const char * path)
+{
+    try
+    {
+        return new AnimationClip(AnimationClip::Read(path));
+    }
+    catch(const std::exception& e)
+    {
+        // null clip carrying the error
+        return new AnimationClip(std::string(e.what()));
+    }
+}
+
+CENTER_OF_ROTATION_API const char * AnimationClipError(AnimationClip * clip)
+{
+    auto message = CopyMessage(clip->failureContextMessage);
+    clip->failureContextMessage = "";
+    return message;
+}
+
+CENTER_OF_ROTATION_API void DestroyAnimationClip(AnimationClip * clip)
+{
+    delete clip;
+}
+
+CENTER_OF_ROTATION_API float GetAnimationClipDuration(AnimationClip * clip)
+{
+    return clip->GetDuration();
+}
+
+CENTER_OF_ROTATION_API void AnimateClip(Mesh * mesh, AnimationClip * clip, float time,
+    float * transformed)
+{
+    if (IsBusy(mesh)) return;
+
+    // pose of the clip, kept for the next frames of this thread
+    thread_local std::vector<float> rotations;
+    thread_local std::vector<float> translations;
+
+    try
+    {
+        if (clip->GetBoneCount() != mesh->GetBoneCount())
+        {
+            throw std::runtime_error("The clip has " + std::to_string(clip->GetBoneCount())
+                + " bones, the mesh " + std::to_string(mesh->GetBoneCount()));
+        }
+
+        rotations.resize(4 * clip->GetBoneCount());
+        translations.resize(3 * clip->GetBoneCount());
+        clip->Sample(time, rotations.data(), translations.data());
+
+        mesh->SkinInto(rotations.data(), translations.data(), transformed);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
+
+CENTER_OF_ROTATION_API void BakeAnimationClip(Mesh * mesh, AnimationClip * clip,
+    float startTime, float frameRate, int frameCount, float * cache)
+{
+    if (IsBusy(mesh)) return;
+
+    try
+    {
+        BakeClip(*mesh, *clip, startTime, frameRate, frameCount, cache);
+    }
+    catch(const std::exception& e)
+    {
+        mesh->failureContextMessage = e.what();
+    }
+}
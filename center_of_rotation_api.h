@@ -20,6 +20,8 @@
 
 #endif
 
+#include "animation_clip.h"
+#include "center_job.h"
 #include "Mesh.h"
 
 typedef struct _boneWeight {
@@ -63,8 +65,55 @@ extern "C"
     // get debug data
     CENTER_OF_ROTATION_API int GetRestVertexCount(Mesh * mesh);
     CENTER_OF_ROTATION_API int GetRestFaceCount(Mesh * mesh);
-    // CENTER_OF_ROTATION_API int GetSubdividedVertexCount(Mesh * mesh);
-    // CENTER_OF_ROTATION_API int GetSubdividedFaceCount(Mesh * mesh);
+    CENTER_OF_ROTATION_API int GetSubdividedVertexCount(Mesh * mesh);
+    CENTER_OF_ROTATION_API int GetSubdividedFaceCount(Mesh * mesh);
+
+    // Split the triangles integrated for the centers until the skinning weight
+    // distance of every edge is under threshold, 0 removes the subdivision.
+    // The animated mesh is not changed. Thresholds making too many
+    // triangles leave the subdivision as it was, with a SubdivisionError.
+    CENTER_OF_ROTATION_API void SubdivideTriangles(Mesh * mesh, float threshold);
+    CENTER_OF_ROTATION_API const char * SubdivisionError(Mesh * mesh);
+
+    // threads used by the precomputation, 0 means all hardware threads
+    CENTER_OF_ROTATION_API void SetThreadCount(Mesh * mesh, int threadCount);
+
+    // vertices with the same weights (up to tolerance, 0 for exact)
+    // share one center of rotation, stored once if shareCenters is non zero.
+    // Off by default: GetCentersOfRotation reads a center per vertex with
+    // more than one bone, which stored once centers do not give.
+    CENTER_OF_ROTATION_API void SetCenterSharing(Mesh * mesh, int shareCenters, float tolerance);
+
+    // approximate centers within a distance of the exact ones, 0 for exact
+    CENTER_OF_ROTATION_API void SetMaxCenterError(Mesh * mesh, float maxError);
+    // error bound reached by the last computation of the centers
+    CENTER_OF_ROTATION_API float GetCenterError(Mesh * mesh);
+
+    // Replace the weights of some vertices, the weights are laid out like
+    // in CreateMesh with one bone count per repainted vertex.
+    // Exact centers already computed are patched instead of recomputed.
+    // A subdivision making too many triangles for the new weights leaves
+    // the mesh as it was, with a WeightUpdateError.
+    CENTER_OF_ROTATION_API void UpdateWeights(Mesh * mesh, int * vertexIndices, int vertexCount,
+        BoneWeight * weights, uint8_t * bones);
+    CENTER_OF_ROTATION_API const char * WeightUpdateError(Mesh * mesh);
+
+    // Compute the centers on a background thread without blocking the caller.
+    // Returns null if a job is already running on the mesh. Until the job
+    // is done the mesh reports no centers, then they are read as usual.
+    // Meanwhile the calls that read or change the mesh do nothing and report
+    // an error in their error getter, the vertex and face counts still work.
+    CENTER_OF_ROTATION_API CenterJob * StartComputeCenters(Mesh * mesh);
+    // fraction of the centers computed, from 0 to 1
+    CENTER_OF_ROTATION_API float GetJobProgress(CenterJob * job);
+    // 0 running, 1 completed, 2 failed, 3 cancelled
+    CENTER_OF_ROTATION_API int GetJobStatus(CenterJob * job);
+    CENTER_OF_ROTATION_API void CancelJob(CenterJob * job);
+    CENTER_OF_ROTATION_API void WaitForJob(CenterJob * job);
+    // empty string unless the job failed
+    CENTER_OF_ROTATION_API const char * JobError(CenterJob * job);
+    // cancels the job if it is still running
+    CENTER_OF_ROTATION_API void DestroyJob(CenterJob * job);
 
     // get centers of rotation
     CENTER_OF_ROTATION_API int GetCenterCount(Mesh * mesh);
@@ -77,12 +126,93 @@ extern "C"
     CENTER_OF_ROTATION_API void SerializeMesh(Mesh * mesh, const char * path);
     CENTER_OF_ROTATION_API void ReadCenters(Mesh * mesh, const char * path);
     CENTER_OF_ROTATION_API void SerializeCenters(Mesh * mesh, const char * path);
+    // Computed centers are saved in the directory and read back for the same
+    // mesh, weights and parameters instead of computed again, null disables it
+    CENTER_OF_ROTATION_API void SetCenterCacheDirectory(Mesh * mesh, const char * directory);
+    // non zero when the last centers were read from the cache
+    CENTER_OF_ROTATION_API int IsCenterCacheHit(Mesh * mesh);
+    // single file binary mesh with its centers, see mesh_bundle.h, mapped
+    // and copied without parsing. Check the loaded mesh with
+    // HasFailedMeshConstruction, saving with SerializationError.
+    CENTER_OF_ROTATION_API Mesh * LoadMeshBundle(const char * path);
+    CENTER_OF_ROTATION_API void SaveMeshBundle(Mesh * mesh, const char * path);
+    // skinned mesh of a glTF 2.0 file (.gltf or .glb), see gltf_import.h,
+    // checked with HasFailedMeshConstruction
+    CENTER_OF_ROTATION_API Mesh * LoadGltfMesh(const char * path);
+    // SaveMeshBundle with weights of weightBits (1 to 16) and center
+    // coordinates of centerBits (1 to 24) compressed, read by LoadMeshBundle
+    CENTER_OF_ROTATION_API void SaveCompressedMeshBundle(Mesh * mesh, const char * path,
+        int weightBits, int centerBits);
     CENTER_OF_ROTATION_API const char * SerializationError(Mesh * mesh);
 
+    // Out-of-core computation from the files at path (no extension) to
+    // path.centers, for meshes too large to load. 0 sizes use the defaults.
+    // Returns an error message, empty on success, to free with FreeErrorMessage.
+    CENTER_OF_ROTATION_API const char * ComputeCentersFromFiles(const char * path,
+        int vertexTileSize, int triangleChunkSize);
+
     // runtime animation
     // CENTER_OF_ROTATION_API void SetMeshVertexBuffer(Mesh * mesh, void * vertexBufferHandle);
     CENTER_OF_ROTATION_API void Animate(Mesh * mesh, BoneQuaternion * rotations,
         BoneTranslation * translations, float* transformed);
+    // Animate that also turns the normals (3 floats per vertex) and tangents
+    // (4 floats, w copied) in the same pass, either may be null
+    CENTER_OF_ROTATION_API void AnimateWithNormals(Mesh * mesh, BoneQuaternion * rotations,
+        BoneTranslation * translations, float * transformed, float * normals, float * tangents);
+    // rest normals (3 floats per vertex) and tangents (4 floats per vertex)
+    // for AnimateWithNormals, null removes them
+    CENTER_OF_ROTATION_API void SetRestNormals(Mesh * mesh, float * normals);
+    CENTER_OF_ROTATION_API void SetRestTangents(Mesh * mesh, float * tangents);
+    // non zero turns normals by the inverse transpose of the blended LBS
+    // matrix and tangents by that matrix instead of the blended quaternion
+    CENTER_OF_ROTATION_API void SetLbsNormals(Mesh * mesh, int lbsNormals);
+    // Animate for many poses of the mesh, like a crowd: instance i reads the
+    // bone transformations rotations[i] and translations[i] and writes
+    // transformed[i]. Faster than one call per instance.
+    CENTER_OF_ROTATION_API void AnimateBatch(Mesh * mesh, int instanceCount,
+        BoneQuaternion ** rotations, BoneTranslation ** translations, float ** transformed);
     CENTER_OF_ROTATION_API const char * AnimationError(Mesh * mesh);
+    // widest SIMD skinning allowed: 0 scalar, 1 SSE4, 2 AVX2, 3 AVX-512,
+    // lowered to what the processor supports
+    CENTER_OF_ROTATION_API void SetSkinningSimd(Mesh * mesh, int level);
+    CENTER_OF_ROTATION_API int GetSkinningSimd(Mesh * mesh);
+    // non zero skins only the vertices of the bones that moved since the
+    // previous Animate, which must have written to the same, untouched buffer
+    CENTER_OF_ROTATION_API void SetIncrementalSkinning(Mesh * mesh, int incremental);
+    // threads skinning a frame, 0 means all hardware threads, and the least
+    // number of vertices per task; smaller meshes are skinned serially
+    CENTER_OF_ROTATION_API void SetSkinningThreadCount(Mesh * mesh, int threadCount);
+    CENTER_OF_ROTATION_API void SetSkinningChunkSize(Mesh * mesh, int vertexCount);
+    // non zero stores the vertices for the skinning by center, bone set and
+    // position when that touches fewer lines than the mesh's order, outputs
+    // keep the mesh's order
+    CENTER_OF_ROTATION_API void SetVertexReordering(Mesh * mesh, int reorder);
+    // 64 byte lines of skinning data and positions a frame touches with the
+    // order in use, or with the mesh's order when meshOrder is non zero,
+    // -1 with an AnimationError on failure
+    CENTER_OF_ROTATION_API double GetSkinningCacheLines(Mesh * mesh, int meshOrder);
+    // 8 or 16 stores the skinning data compactly with weights of that many
+    // bits and 16 bit rest positions and centers, 0 stores floats
+    CENTER_OF_ROTATION_API void SetCompactSkinning(Mesh * mesh, int weightBits);
+    // compact against float skinning of the pose, errors in AnimationError
+    CENTER_OF_ROTATION_API void MeasureCompactSkinning(Mesh * mesh, BoneQuaternion * rotations,
+        BoneTranslation * translations, SkinningAccuracy * accuracy);
+    // Animate with the positions written as half floats, 3 per vertex
+    CENTER_OF_ROTATION_API void AnimateHalf(Mesh * mesh, BoneQuaternion * rotations,
+        BoneTranslation * translations, uint16_t * transformed);
+
+    // keyframe clips, see animation_clip.h for the file format
+    CENTER_OF_ROTATION_API AnimationClip * LoadAnimationClip(const char * path);
+    CENTER_OF_ROTATION_API const char * AnimationClipError(AnimationClip * clip);
+    CENTER_OF_ROTATION_API void DestroyAnimationClip(AnimationClip * clip);
+    CENTER_OF_ROTATION_API float GetAnimationClipDuration(AnimationClip * clip);
+    // Animate with the pose of the clip at the time, which must be finite.
+    // Errors go to AnimationError.
+    CENTER_OF_ROTATION_API void AnimateClip(Mesh * mesh, AnimationClip * clip, float time,
+        float * transformed);
+    // Skin frameCount frames at startTime + f / frameRate in one call, frame f
+    // written at cache + f * 3 * vertex count. Errors go to AnimationError.
+    CENTER_OF_ROTATION_API void BakeAnimationClip(Mesh * mesh, AnimationClip * clip,
+        float startTime, float frameRate, int frameCount, float * cache);
 }
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <atomic>
+
+// Progress of a computation watched from another thread.
+// Workers add to completed once per chunk and read cancelled with relaxed
+// atomics, so publishing progress takes no lock while computing.
+struct ComputeProgress
+{
+    std::atomic<int> completed{0};
+    std::atomic<int> total{0};
+    std::atomic<bool> cancelled{false};
+
+    // fraction of the work done, 0 until the amount of work is known
+    float GetFraction() const
+    {
+        int count = total.load(std::memory_order_relaxed);
+        if (count == 0) return 0;
+
+        return (float) completed.load(std::memory_order_relaxed) / count;
+    }
+};
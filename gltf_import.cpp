@@ -0,0 +1,778 @@
+#include "gltf_import.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#define GLB_MAGIC 0x46546C67
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+// deepest nesting of arrays and objects accepted
+#define JSON_MAX_DEPTH 256
+
+// influences of a vertex with two joint and weight sets
+#define GLTF_MAX_INFLUENCES 8
+
+// strides of vertex buffer views allowed by the specification
+#define GLTF_MIN_STRIDE 4
+#define GLTF_MAX_STRIDE 252
+
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+
+namespace
+{
+    struct JsonValue
+    {
+        enum Type
+        {
+            Null,
+            Bool,
+            Number,
+            String,
+            Array,
+            Object
+        };
+
+        Type type = Null;
+        bool boolean = false;
+        double number = 0;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue>> members;
+
+        // member of an object, null if absent
+        const JsonValue * Find(const std::string & key) const
+        {
+            for (const auto & member : members)
+            {
+                if (member.first == key) return &member.second;
+            }
+            return nullptr;
+        }
+    };
+
+    // Recursive descent over RFC 8259 JSON
+    class JsonParser
+    {
+    private:
+        const char * begin;
+        const char * text;
+        const char * end;
+        int depth = 0;
+
+        [[noreturn]] void Fail(const char * what) const
+        {
+            throw std::runtime_error(std::string(what) + std::string(" at byte ")
+                + std::to_string(text - begin) + std::string(" of the glTF JSON"));
+        }
+
+        void SkipSpaces()
+        {
+            while (text < end && (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r')) text++;
+        }
+
+        void Expect(char c)
+        {
+            SkipSpaces();
+            if (text == end || *text != c) Fail((std::string("Expected ") + c).c_str());
+            text++;
+        }
+
+        bool Consume(const char * word)
+        {
+            size_t length = std::strlen(word);
+            if ((size_t) (end - text) < length || std::memcmp(text, word, length) != 0) return false;
+            text += length;
+            return true;
+        }
+
+        static void AppendUtf8(std::string & out, uint32_t code)
+        {
+            if (code < 0x80) out += (char) code;
+            else if (code < 0x800)
+            {
+                out += (char) (0xC0 | (code >> 6));
+                out += (char) (0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000)
+            {
+                out += (char) (0xE0 | (code >> 12));
+                out += (char) (0x80 | ((code >> 6) & 0x3F));
+                out += (char) (0x80 | (code & 0x3F));
+            }
+            else
+            {
+                out += (char) (0xF0 | (code >> 18));
+                out += (char) (0x80 | ((code >> 12) & 0x3F));
+                out += (char) (0x80 | ((code >> 6) & 0x3F));
+                out += (char) (0x80 | (code & 0x3F));
+            }
+        }
+
+        uint32_t ParseHex4()
+        {
+            if (end - text < 4) Fail("Truncated escape");
+            uint32_t code = 0;
+            auto result = std::from_chars(text, text + 4, code, 16);
+            if (result.ptr != text + 4) Fail("Invalid escape");
+            text += 4;
+            return code;
+        }
+
+        std::string ParseString()
+        {
+            Expect('"');
+            std::string out;
+            while (true)
+            {
+                if (text == end) Fail("Unterminated string");
+                char c = *text++;
+                if (c == '"') return out;
+                if ((unsigned char) c < 0x20) Fail("Control character in string");
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+
+                if (text == end) Fail("Unterminated string");
+                switch (*text++)
+                {
+                    case '"': out += '"'; break;
+                    case '\\': out += '\\'; break;
+                    case '/': out += '/'; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u':
+                    {
+                        uint32_t code = ParseHex4();
+                        // surrogate pair
+                        if (code >= 0xD800 && code < 0xDC00 && Consume("\\u"))
+                        {
+                            uint32_t low = ParseHex4();
+                            if (low < 0xDC00 || low >= 0xE000) Fail("Invalid surrogate pair");
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        AppendUtf8(out, code);
+                        break;
+                    }
+                    default: Fail("Invalid escape");
+                }
+            }
+        }
+
+        JsonValue ParseValue()
+        {
+            SkipSpaces();
+            if (text == end) Fail("Unexpected end");
+
+            JsonValue value;
+            if (*text == '{' || *text == '[')
+            {
+                if (++depth > JSON_MAX_DEPTH) Fail("Too deeply nested");
+                bool isObject = *text++ == '{';
+                value.type = isObject ? JsonValue::Object : JsonValue::Array;
+
+                SkipSpaces();
+                char close = isObject ? '}' : ']';
+                if (text < end && *text == close)
+                {
+                    text++;
+                }
+                else
+                {
+                    while (true)
+                    {
+                        if (isObject)
+                        {
+                            auto key = ParseString();
+                            Expect(':');
+                            value.members.emplace_back(std::move(key), ParseValue());
+                        }
+                        else
+                        {
+                            value.items.push_back(ParseValue());
+                        }
+
+                        SkipSpaces();
+                        if (text < end && *text == ',')
+                        {
+                            text++;
+                            continue;
+                        }
+                        Expect(close);
+                        break;
+                    }
+                }
+                depth--;
+            }
+            else if (*text == '"')
+            {
+                value.type = JsonValue::String;
+                value.text = ParseString();
+            }
+            else if (Consume("true"))
+            {
+                value.type = JsonValue::Bool;
+                value.boolean = true;
+            }
+            else if (Consume("false"))
+            {
+                value.type = JsonValue::Bool;
+            }
+            else if (Consume("null"))
+            {
+                value.type = JsonValue::Null;
+            }
+            else
+            {
+                value.type = JsonValue::Number;
+                auto result = std::from_chars(text, end, value.number);
+                if (result.ec != std::errc()) Fail("Invalid value");
+                text = result.ptr;
+            }
+            return value;
+        }
+
+    public:
+        JsonParser(const char * data, size_t size) : begin(data), text(data), end(data + size) {}
+
+        JsonValue Parse()
+        {
+            // byte order mark
+            if (end - text >= 3 && std::memcmp(text, "\xEF\xBB\xBF", 3) == 0) text += 3;
+
+            auto value = ParseValue();
+            SkipSpaces();
+            if (text != end) Fail("Unexpected data after the JSON");
+            return value;
+        }
+    };
+
+    std::vector<uint8_t> DecodeBase64(const char * text, size_t size)
+    {
+        auto digit = [](char c) -> int
+        {
+            if (c >= 'A' && c <= 'Z') return c - 'A';
+            if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+            if (c >= '0' && c <= '9') return c - '0' + 52;
+            if (c == '+' || c == '-') return 62;
+            if (c == '/' || c == '_') return 63;
+            return -1;
+        };
+
+        std::vector<uint8_t> bytes;
+        bytes.reserve(size / 4 * 3);
+        uint32_t buffer = 0;
+        int bits = 0;
+        for (size_t i = 0; i < size && text[i] != '='; i++)
+        {
+            int value = digit(text[i]);
+            if (value < 0) throw std::runtime_error("Invalid base64 in a glTF data URI");
+            buffer = (buffer << 6) | (uint32_t) value;
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                bytes.push_back((uint8_t) (buffer >> bits));
+            }
+        }
+        return bytes;
+    }
+
+    std::string DecodePercents(const std::string & uri)
+    {
+        std::string path;
+        for (size_t i = 0; i < uri.size(); i++)
+        {
+            unsigned value = 0;
+            if (uri[i] == '%' && i + 2 < uri.size()
+                && std::from_chars(uri.data() + i + 1, uri.data() + i + 3, value, 16).ptr == uri.data() + i + 3)
+            {
+                path += (char) value;
+                i += 2;
+            }
+            else
+            {
+                path += uri[i];
+            }
+        }
+        return path;
+    }
+
+    // A buffer mapped from its file, decoded from a data URI or in the
+    // binary chunk of a .glb
+    struct GltfBuffer
+    {
+        MappedFile file;
+        std::vector<uint8_t> decoded;
+        const uint8_t * data = nullptr;
+        size_t size = 0;
+    };
+
+    // Elements of an accessor read in place, with the conversions of glTF
+    class AccessorReader
+    {
+    private:
+        // null for accessors without a buffer view, which are zeros
+        const uint8_t * data = nullptr;
+        size_t stride = 0;
+        int componentType = GLTF_FLOAT;
+        int componentSize = 4;
+        bool normalized = false;
+
+    public:
+        int count = 0;
+        int components = 0;
+
+        AccessorReader() {}
+        AccessorReader(const uint8_t * data, size_t stride, int componentType, int componentSize,
+            bool normalized, int count, int components)
+            : data(data), stride(stride), componentType(componentType), componentSize(componentSize),
+            normalized(normalized), count(count), components(components) {}
+
+        bool IsPresent() const {return count > 0 || components > 0;}
+        int GetComponentType() const {return componentType;}
+        bool IsNormalized() const {return normalized;}
+
+        // component c of element i, exact for every integer type
+        double Get(int i, int c) const
+        {
+            if (!data) return 0;
+            const uint8_t * at = data + i * stride + c * componentSize;
+
+            auto read = [&](auto value) -> double
+            {
+                std::memcpy(&value, at, sizeof(value));
+                if (!normalized) return (double) value;
+
+                // glTF maps the signed range to [-1, 1] and clamps the lowest value
+                using T = decltype(value);
+                float scaled = (float) value / (float) std::numeric_limits<T>::max();
+                return (double) std::max(scaled, -1.0f);
+            };
+
+            switch (componentType)
+            {
+                case 5120: return read(int8_t());
+                case GLTF_UNSIGNED_BYTE: return read(uint8_t());
+                case 5122: return read(int16_t());
+                case GLTF_UNSIGNED_SHORT: return read(uint16_t());
+                case GLTF_UNSIGNED_INT: return read(uint32_t());
+                default: return read(float());
+            }
+        }
+    };
+
+    class GltfReader
+    {
+    private:
+        std::string path;
+        MappedFile file;
+        JsonValue root;
+        std::vector<GltfBuffer> buffers;
+
+    public:
+        [[noreturn]] void Fail(const std::string & what) const
+        {
+            throw std::runtime_error(what + std::string(" in glTF: ") + path);
+        }
+
+        const JsonValue & Member(const JsonValue & object, const char * key) const
+        {
+            const JsonValue * value = object.Find(key);
+            if (!value) Fail(std::string("Missing ") + key);
+            return *value;
+        }
+
+        // non negative integer below limit
+        int Index(const JsonValue & value, size_t limit, const char * what) const
+        {
+            if (value.type != JsonValue::Number || !(value.number >= 0 && value.number < (double) limit)
+                || value.number != std::floor(value.number))
+                Fail(std::string("Invalid ") + what);
+            return (int) value.number;
+        }
+
+        int64_t Integer(const JsonValue & object, const char * key, int64_t fallback) const
+        {
+            const JsonValue * value = object.Find(key);
+            if (!value) return fallback;
+            // integers of JSON are exact up to 2^53
+            if (value->type != JsonValue::Number || !(value->number >= 0 && value->number <= 9007199254740992.0)
+                || value->number != std::floor(value->number))
+                Fail(std::string("Invalid ") + key);
+            return (int64_t) value->number;
+        }
+
+        // element of a top level array
+        const JsonValue & Item(const char * array, const JsonValue & index) const
+        {
+            const auto & items = Member(root, array).items;
+            return items[Index(index, items.size(), array)];
+        }
+
+        explicit GltfReader(const std::string & path) : path(path), file(path)
+        {
+            const char * json = file.GetData();
+            size_t jsonSize = file.GetSize();
+            const uint8_t * binary = nullptr;
+            size_t binarySize = 0;
+
+            uint32_t glb[3] = {};
+            if (file.GetSize() >= sizeof(glb)) std::memcpy(glb, file.GetData(), sizeof(glb));
+            if (glb[0] == GLB_MAGIC)
+            {
+                if (glb[1] != 2) Fail("Unsupported GLB version " + std::to_string(glb[1]));
+                if (glb[2] > file.GetSize()) Fail("Truncated GLB");
+
+                // JSON chunk first, then an optional binary chunk
+                size_t offset = sizeof(glb);
+                for (int chunk = 0; offset + 8 <= glb[2]; chunk++)
+                {
+                    uint32_t header[2];
+                    std::memcpy(header, file.GetData() + offset, sizeof(header));
+                    offset += sizeof(header);
+                    if (header[0] > glb[2] - offset) Fail("Truncated GLB chunk");
+
+                    if (chunk == 0 && header[1] != GLB_CHUNK_JSON) Fail("GLB without a JSON chunk first");
+                    if (chunk == 0)
+                    {
+                        json = file.GetData() + offset;
+                        jsonSize = header[0];
+                    }
+                    else if (chunk == 1 && header[1] == GLB_CHUNK_BIN)
+                    {
+                        binary = (const uint8_t *) file.GetData() + offset;
+                        binarySize = header[0];
+                    }
+                    // chunks are padded to 4 bytes
+                    offset += (header[0] + 3) / 4 * 4;
+                }
+                if (json == file.GetData()) Fail("GLB without a JSON chunk");
+            }
+
+            try
+            {
+                root = JsonParser(json, jsonSize).Parse();
+            }
+            catch (const std::exception & e)
+            {
+                Fail(e.what());
+            }
+            if (root.type != JsonValue::Object) Fail("No JSON object");
+
+            const auto & version = Member(Member(root, "asset"), "version");
+            if (version.type != JsonValue::String || version.text.rfind("2.", 0) != 0)
+                Fail("Unsupported glTF version");
+
+            const JsonValue * bufferList = root.Find("buffers");
+            if (!bufferList) return;
+            buffers.resize(bufferList->items.size());
+            for (size_t b = 0; b < buffers.size(); b++)
+            {
+                const auto & description = bufferList->items[b];
+                auto & buffer = buffers[b];
+                const JsonValue * uri = description.Find("uri");
+
+                if (!uri)
+                {
+                    if (b != 0 || !binary) Fail("Buffer " + std::to_string(b) + " without data");
+                    buffer.data = binary;
+                    buffer.size = binarySize;
+                }
+                else if (uri->text.rfind("data:", 0) == 0)
+                {
+                    auto comma = uri->text.find(',');
+                    if (comma == std::string::npos || uri->text.rfind(";base64", comma) == std::string::npos)
+                        Fail("Data URI of buffer " + std::to_string(b) + " is not base64");
+                    buffer.decoded = DecodeBase64(uri->text.data() + comma + 1, uri->text.size() - comma - 1);
+                    buffer.data = buffer.decoded.data();
+                    buffer.size = buffer.decoded.size();
+                }
+                else
+                {
+                    auto bufferPath = std::filesystem::path(path).parent_path()
+                        / std::filesystem::path((const char8_t *) DecodePercents(uri->text).c_str());
+                    buffer.file = MappedFile(bufferPath.string());
+                    buffer.data = (const uint8_t *) buffer.file.GetData();
+                    buffer.size = buffer.file.GetSize();
+                }
+
+                if ((uint64_t) Integer(description, "byteLength", 0) > buffer.size)
+                    Fail("Buffer " + std::to_string(b) + " shorter than its byteLength");
+            }
+        }
+
+        const JsonValue & GetRoot() const {return root;}
+
+        // Checks that the accessor fits in its buffer view and buffer
+        AccessorReader Accessor(const JsonValue & index, const char * what) const
+        {
+            const auto & accessor = Item("accessors", index);
+            auto fail = [&](const char * problem) {Fail(std::string(what) + std::string(" accessor ") + problem);};
+
+            if (accessor.Find("sparse")) fail("is sparse, which is not supported");
+
+            const auto & type = Member(accessor, "type").text;
+            int components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3
+                : type == "VEC4" ? 4 : type == "MAT4" ? 16 : 0;
+            if (components == 0) fail("has an unsupported type");
+
+            int componentType = (int) Integer(accessor, "componentType", 0);
+            int componentSize = componentType == 5120 || componentType == GLTF_UNSIGNED_BYTE ? 1
+                : componentType == 5122 || componentType == GLTF_UNSIGNED_SHORT ? 2
+                : componentType == GLTF_UNSIGNED_INT || componentType == GLTF_FLOAT ? 4 : 0;
+            if (componentSize == 0) fail("has an unknown component type");
+            // matrices of small components have padded columns
+            if (components == 16 && componentSize != 4) fail("is a matrix of small components");
+
+            int64_t count = Integer(accessor, "count", -1);
+            if (count < 1 || count > std::numeric_limits<int>::max()) fail("has an invalid count");
+
+            const JsonValue * boolean = accessor.Find("normalized");
+            bool normalized = boolean && boolean->type == JsonValue::Bool && boolean->boolean;
+
+            const JsonValue * viewIndex = accessor.Find("bufferView");
+            if (!viewIndex)
+                return AccessorReader(nullptr, 0, componentType, componentSize, normalized, (int) count, components);
+
+            const auto & view = Item("bufferViews", *viewIndex);
+            const auto & buffer = buffers[Index(Member(view, "buffer"), buffers.size(), "buffer")];
+
+            uint64_t elementSize = (uint64_t) components * componentSize;
+            uint64_t stride = elementSize;
+            if (view.Find("byteStride"))
+            {
+                stride = Integer(view, "byteStride", 0);
+                if (stride < GLTF_MIN_STRIDE || stride > GLTF_MAX_STRIDE || stride % 4 != 0)
+                    fail("has an invalid stride");
+                if (stride < elementSize) fail("has a stride shorter than its elements");
+            }
+
+            // the values are under 2^53, the sums cannot wrap around, the
+            // product of the stride and the count could
+            uint64_t viewOffset = Integer(view, "byteOffset", 0);
+            uint64_t viewLength = Integer(view, "byteLength", 0);
+            uint64_t offset = Integer(accessor, "byteOffset", 0);
+            if (viewOffset + viewLength > buffer.size) fail("has a buffer view past its buffer");
+            if (offset + elementSize > viewLength
+                || (viewLength - offset - elementSize) / stride < (uint64_t) count - 1)
+                fail("is past its buffer view");
+
+            return AccessorReader(buffer.data + viewOffset + offset, stride, componentType, componentSize,
+                normalized, (int) count, components);
+        }
+    };
+
+    // joint and weight sets of a primitive
+    struct InfluenceSet
+    {
+        AccessorReader joints;
+        AccessorReader weights;
+    };
+}
+
+GltfSkin ReadGltfSkin(const std::string & path)
+{
+    GltfReader reader(path);
+    const auto & root = reader.GetRoot();
+
+    // the first skinned mesh, its node transform does not apply to it
+    const JsonValue * skinnedNode = nullptr;
+    if (const JsonValue * nodes = root.Find("nodes"))
+    {
+        for (const auto & node : nodes->items)
+        {
+            if (node.Find("mesh") && node.Find("skin"))
+            {
+                skinnedNode = &node;
+                break;
+            }
+        }
+    }
+    if (!skinnedNode) reader.Fail("No node with a mesh and a skin");
+
+    GltfSkin skin;
+    const auto & skinObject = reader.Item("skins", reader.Member(*skinnedNode, "skin"));
+    const auto & joints = reader.Member(skinObject, "joints").items;
+    int jointCount = (int) joints.size();
+    if (jointCount == 0) reader.Fail("Skin without joints");
+
+    const auto & nodes = reader.Member(root, "nodes").items;
+    for (const auto & joint : joints)
+    {
+        int node = reader.Index(joint, nodes.size(), "joint");
+        const JsonValue * name = nodes[node].Find("name");
+        skin.jointNodes.push_back(node);
+        skin.jointNames.push_back(name ? name->text : std::string());
+    }
+
+    skin.inverseBindMatrices.assign(jointCount, Eigen::Matrix4f::Identity());
+    if (const JsonValue * index = skinObject.Find("inverseBindMatrices"))
+    {
+        auto matrices = reader.Accessor(*index, "inverseBindMatrices");
+        if (matrices.components != 16 || matrices.GetComponentType() != GLTF_FLOAT || matrices.count < jointCount)
+            reader.Fail("Expected a float matrix per joint in inverseBindMatrices");
+
+        for (int j = 0; j < jointCount; j++)
+        {
+            for (int k = 0; k < 16; k++) skin.inverseBindMatrices[j](k % 4, k / 4) = (float) matrices.Get(j, k);
+        }
+    }
+
+    // accessors of every primitive, checked before anything is allocated
+    const auto & primitives = reader.Member(reader.Item("meshes", reader.Member(*skinnedNode, "mesh")),
+        "primitives").items;
+    int primitiveCount = (int) primitives.size();
+    std::vector<AccessorReader> positions(primitiveCount), indices(primitiveCount);
+    std::vector<std::vector<InfluenceSet>> influences(primitiveCount);
+    int64_t vertexCount = 0, triangleCount = 0, weightCapacity = 0;
+
+    for (int p = 0; p < primitiveCount; p++)
+    {
+        const auto & primitive = primitives[p];
+        auto primitiveName = "Primitive " + std::to_string(p);
+        if (reader.Integer(primitive, "mode", 4) != 4) reader.Fail(primitiveName + " is not a triangle list");
+
+        const auto & attributes = reader.Member(primitive, "attributes");
+        positions[p] = reader.Accessor(reader.Member(attributes, "POSITION"), "POSITION");
+        if (positions[p].components != 3 || positions[p].GetComponentType() != GLTF_FLOAT)
+            reader.Fail(primitiveName + " positions are not float VEC3");
+
+        for (int set = 0; set < 2; set++)
+        {
+            auto jointName = "JOINTS_" + std::to_string(set);
+            auto weightName = "WEIGHTS_" + std::to_string(set);
+            const JsonValue * jointIndex = attributes.Find(jointName);
+            const JsonValue * weightIndex = attributes.Find(weightName);
+            if (!jointIndex && !weightIndex && set > 0) continue;
+            if (!jointIndex || !weightIndex) reader.Fail(primitiveName + " without " + jointName + " and " + weightName);
+
+            InfluenceSet influence = {reader.Accessor(*jointIndex, jointName.c_str()),
+                reader.Accessor(*weightIndex, weightName.c_str())};
+            int jointType = influence.joints.GetComponentType();
+            int weightType = influence.weights.GetComponentType();
+            if (influence.joints.components != 4 || influence.joints.IsNormalized()
+                || (jointType != GLTF_UNSIGNED_BYTE && jointType != GLTF_UNSIGNED_SHORT))
+                reader.Fail(primitiveName + " " + jointName + " is not unsigned byte or short VEC4");
+            if (influence.weights.components != 4 || (weightType != GLTF_FLOAT && !influence.weights.IsNormalized()))
+                reader.Fail(primitiveName + " " + weightName + " is not float or normalized VEC4");
+            if (influence.joints.count != positions[p].count || influence.weights.count != positions[p].count)
+                reader.Fail(primitiveName + " has not one joint and weight per vertex");
+
+            influences[p].push_back(influence);
+        }
+
+        int64_t indexCount = positions[p].count;
+        if (const JsonValue * index = primitive.Find("indices"))
+        {
+            indices[p] = reader.Accessor(*index, "indices");
+            int type = indices[p].GetComponentType();
+            if (indices[p].components != 1 || (type != GLTF_UNSIGNED_BYTE && type != GLTF_UNSIGNED_SHORT
+                && type != GLTF_UNSIGNED_INT))
+                reader.Fail(primitiveName + " indices are not unsigned scalars");
+            indexCount = indices[p].count;
+        }
+        if (indexCount % 3 != 0) reader.Fail(primitiveName + " has a partial triangle");
+
+        vertexCount += positions[p].count;
+        triangleCount += indexCount / 3;
+        weightCapacity += (int64_t) 4 * influences[p].size() * positions[p].count;
+    }
+    if (vertexCount > std::numeric_limits<int>::max() || triangleCount > std::numeric_limits<int>::max())
+        reader.Fail("Too many vertices or triangles");
+
+    // decoded straight into the storage of the mesh
+    skin.vertices.resize(vertexCount, 3);
+    skin.triangles.resize(triangleCount, 3);
+    skin.weights.resize(jointCount, vertexCount);
+    skin.weights.reserve(weightCapacity);
+
+    int firstVertex = 0, firstTriangle = 0;
+    for (int p = 0; p < primitiveCount; p++)
+    {
+        int count = positions[p].count;
+        for (int i = 0; i < count; i++)
+        {
+            for (int c = 0; c < 3; c++) skin.vertices(firstVertex + i, c) = (float) positions[p].Get(i, c);
+        }
+
+        int primitiveTriangles = (indices[p].IsPresent() ? indices[p].count : count) / 3;
+        for (int t = 0; t < primitiveTriangles; t++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                double index = indices[p].IsPresent() ? indices[p].Get(3 * t + c, 0) : 3 * t + c;
+                if (index >= count) reader.Fail("Primitive " + std::to_string(p) + " index out of range");
+                skin.triangles(firstTriangle + t, c) = firstVertex + (int) index;
+            }
+        }
+
+        // joints sorted, repeated joints summed and zero weights dropped,
+        // negative, infinite and NaN weights rejected
+        for (int i = 0; i < count; i++)
+        {
+            std::pair<int, float> vertexInfluences[GLTF_MAX_INFLUENCES];
+            int influenceCount = 0;
+            for (const auto & set : influences[p])
+            {
+                for (int c = 0; c < 4; c++)
+                {
+                    float weight = (float) set.weights.Get(i, c);
+                    if (!(weight >= 0) || !std::isfinite(weight))
+                        reader.Fail("Invalid weight at vertex " + std::to_string(firstVertex + i));
+                    if (weight == 0) continue;
+
+                    double joint = set.joints.Get(i, c);
+                    if (joint >= jointCount)
+                        reader.Fail("Joint out of range at vertex " + std::to_string(firstVertex + i));
+                    vertexInfluences[influenceCount++] = {(int) joint, weight};
+                }
+            }
+            // insertion sort of the few influences, which std::sort makes
+            // gcc warn about reading past them
+            for (int k = 1; k < influenceCount; k++)
+            {
+                for (int m = k; m > 0 && vertexInfluences[m - 1].first > vertexInfluences[m].first; m--)
+                    std::swap(vertexInfluences[m - 1], vertexInfluences[m]);
+            }
+
+            skin.weights.startVec(firstVertex + i);
+            for (int k = 0; k < influenceCount; k++)
+            {
+                float weight = vertexInfluences[k].second;
+                while (k + 1 < influenceCount && vertexInfluences[k + 1].first == vertexInfluences[k].first)
+                    weight += vertexInfluences[++k].second;
+                skin.weights.insertBack(vertexInfluences[k].first, firstVertex + i) = weight;
+            }
+        }
+
+        firstVertex += count;
+        firstTriangle += primitiveTriangles;
+    }
+    skin.weights.finalize();
+
+    return skin;
+}
+
+Mesh * ReadGltfMesh(const std::string & path)
+{
+    auto skin = ReadGltfSkin(path);
+    return new Mesh(std::move(skin.vertices), std::move(skin.triangles), std::move(skin.weights));
+}
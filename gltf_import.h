@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Mesh.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <string>
+#include <vector>
+
+// Skinned mesh of a glTF 2.0 asset, the primitives of its mesh merged in
+// order: the vertices and triangles of a primitive follow those before it
+struct GltfSkin
+{
+    Eigen::MatrixXf vertices;
+    Eigen::MatrixXi triangles;
+    // bone b is joint b of the skin
+    Eigen::SparseMatrix<float> weights;
+
+    // node and name of each joint
+    std::vector<int> jointNodes;
+    std::vector<std::string> jointNames;
+    // column major like glTF, identity when the skin has none
+    std::vector<Eigen::Matrix4f> inverseBindMatrices;
+};
+
+// Reads the first node with a mesh and a skin of a .gltf file, its buffers
+// in files next to it or in data URIs, or of a .glb file. Primitives must
+// be triangle lists with POSITION, JOINTS_0 and WEIGHTS_0, and may have
+// indices and JOINTS_1 and WEIGHTS_1. Accessors are decoded in place from
+// the mapped buffers into the matrices, sparse accessors are not supported.
+// Throws if the asset has no skinned mesh or is malformed.
+GltfSkin ReadGltfSkin(const std::string & path);
+
+// ReadGltfSkin as a mesh, allocated with new
+Mesh * ReadGltfMesh(const std::string & path);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// IEEE 754 half precision conversions. Static so the copies in the SIMD
+// kernel files, built for wider instruction sets, stay in their files.
+
+// rounded to the nearest half, ties to even, too large values become infinite
+static inline uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    // infinity and not a number, which stays one
+    if (magnitude >= 0x7f800000)
+        return (uint16_t) (sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+    // 65520 and above round past the largest half
+    if (magnitude >= 0x477ff000) return (uint16_t) (sign | 0x7c00);
+
+    // under 2^-14 the half is subnormal, a multiple of 2^-24
+    if (magnitude < 0x38800000)
+    {
+        float scaled = std::fabs(value) * 16777216.0f;
+        return (uint16_t) (sign | (uint16_t) std::nearbyint(scaled));
+    }
+
+    // exponent bias from 127 to 15, then 13 bits of mantissa rounded off
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t rest = magnitude & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return (uint16_t) (sign | half);
+}
+
+static inline float HalfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0)
+    {
+        float value = (float) mantissa / 16777216.0f;
+        return sign ? -value : value;
+    }
+    else if (exponent == 31) bits = sign | 0x7f800000 | (mantissa << 13);
+    else bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
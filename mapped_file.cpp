@@ -0,0 +1,101 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string & path)
+{
+    auto fail = [&](const char * what)
+    {
+        Close();
+        throw std::runtime_error(std::string(what) + std::string(" file at: ") + path);
+    };
+
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        fail("Cannot open");
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) fail("Cannot read the size of");
+    size = (size_t) fileSize.QuadPart;
+
+    // empty files cannot be mapped
+    if (size == 0) return;
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) fail("Cannot map");
+
+    data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) fail("Cannot map");
+#else
+    file = open(path.c_str(), O_RDONLY);
+    if (file == -1) fail("Cannot open");
+
+    struct stat status;
+    if (fstat(file, &status) != 0) fail("Cannot read the size of");
+    size = (size_t) status.st_size;
+
+    // empty files cannot be mapped
+    if (size == 0) return;
+
+    void * view = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+    if (view == MAP_FAILED) fail("Cannot map");
+    data = (const char *) view;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile && other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile & MappedFile::operator=(MappedFile && other) noexcept
+{
+    if (this == &other) return *this;
+
+    Close();
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(file, other.file);
+#ifdef _WIN32
+    std::swap(mapping, other.mapping);
+#endif
+    return *this;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (data) munmap((void *) data, size);
+    if (file != -1) close(file);
+    file = -1;
+#endif
+    data = nullptr;
+    size = 0;
+}
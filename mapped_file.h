@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read only memory mapping of a whole file.
+// Pages are loaded by the system on access and can be dropped under memory
+// pressure, so files larger than the memory can be read at random.
+class MappedFile
+{
+private:
+    const char * data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    void * file = nullptr;
+    void * mapping = nullptr;
+#else
+    int file = -1;
+#endif
+
+    void Close();
+
+public:
+    MappedFile() {}
+    // throws if the file cannot be opened or mapped
+    explicit MappedFile(const std::string & path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile && other) noexcept;
+    MappedFile & operator=(MappedFile && other) noexcept;
+
+    const char * GetData() const {return data;}
+    size_t GetSize() const {return size;}
+
+    // the file seen as an array of T
+    template <typename T>
+    const T * As() const {return reinterpret_cast<const T *>(data);}
+    template <typename T>
+    size_t CountOf() const {return size / sizeof(T);}
+};
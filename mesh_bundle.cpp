@@ -0,0 +1,238 @@
+#include "mesh_bundle.h"
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#define MESH_BUNDLE_MAGIC "CORMESH"
+
+static uint64_t Align(uint64_t offset)
+{
+    return (offset + MESH_BUNDLE_ALIGNMENT - 1) / MESH_BUNDLE_ALIGNMENT * MESH_BUNDLE_ALIGNMENT;
+}
+
+MeshBundle::MeshBundle(const std::string & path) : file(path)
+{
+    auto fail = [&](const std::string & what)
+    {
+        throw std::runtime_error(what + std::string(" in mesh bundle: ") + path);
+    };
+
+    if (file.GetSize() < sizeof(MeshBundleHeader)) fail("Truncated header");
+    header = file.As<MeshBundleHeader>();
+    if (std::memcmp(header->magic, MESH_BUNDLE_MAGIC, sizeof(header->magic)) != 0)
+        fail("No magic number");
+    if (header->version < 1 || header->version > MESH_BUNDLE_VERSION)
+        fail("Unsupported version " + std::to_string(header->version));
+    if (header->headerSize != sizeof(MeshBundleHeader)) fail("Unexpected header size");
+    if ((header->flags & ~MESH_BUNDLE_COMPRESSED) != 0 || (header->version == 1 && header->flags != 0))
+        fail("Unknown flags");
+
+    if (header->vertexCount < 0 || header->triangleCount < 0 || header->boneCount < 0
+        || header->weightCount < 0 || header->centerCount < -1)
+        fail("Negative count");
+
+    // bytes each section must hold
+    uint64_t vertexCount = header->vertexCount;
+    uint64_t weightCount = header->weightCount;
+    uint64_t expected[(int) MeshBundleSection::Count] = {
+        vertexCount * 3 * sizeof(float),
+        (uint64_t) header->triangleCount * 3 * sizeof(int32_t),
+        (vertexCount + 1) * sizeof(int32_t),
+        weightCount * sizeof(int32_t),
+        weightCount * sizeof(float),
+        HasCenters() ? vertexCount * sizeof(int32_t) : 0,
+        HasCenters() ? (uint64_t) header->centerCount * 3 * sizeof(float) : 0};
+
+    for (int s = 0; s < (int) MeshBundleSection::Count; s++)
+    {
+        uint64_t offset = header->sectionOffset[s];
+        uint64_t size = header->sectionSize[s];
+        // streams are checked as they are decoded
+        bool isStream = IsCompressed() && s > (int) MeshBundleSection::WeightStart;
+        if (IsCompressed() && s == (int) MeshBundleSection::WeightStart) expected[s] = 0;
+        if (!HasCenters() && s >= (int) MeshBundleSection::CenterIndex) isStream = false;
+        if (size != expected[s] && !isStream)
+            fail("Section " + std::to_string(s) + " has an unexpected size");
+        if (offset % MESH_BUNDLE_ALIGNMENT != 0) fail("Section " + std::to_string(s) + " is not aligned");
+        if (offset > file.GetSize() || size > file.GetSize() - offset)
+            fail("Section " + std::to_string(s) + " past the end of the file");
+    }
+}
+
+void WriteMeshBundle(const std::string & path, const Eigen::MatrixXf & vertices,
+    const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights,
+    const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers,
+    const SkinCompression * compression)
+{
+    // row major, one vertex or triangle after the other
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> vertexRows = vertices;
+    Eigen::Matrix<int32_t, Eigen::Dynamic, 3, Eigen::RowMajor> triangleRows = triangles.cast<int32_t>();
+    Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> centerRows = centers;
+    Eigen::SparseMatrix<float> compressed = weights;
+    compressed.makeCompressed();
+
+    bool hasCenters = !indexOfCenter.empty();
+    int vertexCount = (int) vertices.rows();
+    if (hasCenters && (int) indexOfCenter.size() != vertexCount)
+        throw std::invalid_argument("Expected one center index per vertex");
+    if (weights.cols() != vertexCount)
+        throw std::invalid_argument("Expected one weight column per vertex");
+
+    MeshBundleHeader header = {};
+    std::memcpy(header.magic, MESH_BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = MESH_BUNDLE_VERSION;
+    header.headerSize = sizeof(MeshBundleHeader);
+    header.vertexCount = vertexCount;
+    header.triangleCount = (int32_t) triangles.rows();
+    header.boneCount = (int32_t) weights.rows();
+    header.weightCount = (int32_t) compressed.nonZeros();
+    header.centerCount = hasCenters ? (int32_t) centers.rows() : -1;
+    header.flags = compression ? MESH_BUNDLE_COMPRESSED : 0;
+
+    const void * data[(int) MeshBundleSection::Count] = {
+        vertexRows.data(), triangleRows.data(),
+        compressed.outerIndexPtr(), compressed.innerIndexPtr(), compressed.valuePtr(),
+        indexOfCenter.data(), centerRows.data()};
+    uint64_t size[(int) MeshBundleSection::Count] = {
+        (uint64_t) vertexRows.size() * sizeof(float),
+        (uint64_t) triangleRows.size() * sizeof(int32_t),
+        (uint64_t) (vertexCount + 1) * sizeof(int32_t),
+        (uint64_t) header.weightCount * sizeof(int32_t),
+        (uint64_t) header.weightCount * sizeof(float),
+        hasCenters ? (uint64_t) vertexCount * sizeof(int32_t) : 0,
+        hasCenters ? (uint64_t) centerRows.size() * sizeof(float) : 0};
+    static_assert(sizeof(Eigen::SparseMatrix<float>::StorageIndex) == sizeof(int32_t),
+        "Weight indices are written as they are stored");
+
+    // the streams replace the arrays of the weights and centers
+    std::vector<uint8_t> streams[(int) MeshBundleSection::Count];
+    if (compression)
+    {
+        using Section = MeshBundleSection;
+        EncodeWeights(compressed, compression->weightBits,
+            streams[(int) Section::WeightBones], streams[(int) Section::WeightValues]);
+        if (hasCenters)
+            EncodeCenters(vertices, indexOfCenter, centers, compression->centerBits,
+                streams[(int) Section::CenterIndex], streams[(int) Section::Centers]);
+
+        for (int s = (int) Section::WeightStart; s < (int) Section::Count; s++)
+        {
+            data[s] = streams[s].data();
+            size[s] = streams[s].size();
+        }
+    }
+
+    uint64_t offset = Align(sizeof(MeshBundleHeader));
+    for (int s = 0; s < (int) MeshBundleSection::Count; s++)
+    {
+        header.sectionOffset[s] = offset;
+        header.sectionSize[s] = size[s];
+        offset = Align(offset + size[s]);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot open file at: " + path);
+
+    const char padding[MESH_BUNDLE_ALIGNMENT] = {};
+    uint64_t written = 0;
+    auto write = [&](const void * bytes, uint64_t count)
+    {
+        file.write((const char *) bytes, (std::streamsize) count);
+        written += count;
+    };
+
+    write(&header, sizeof(header));
+    for (int s = 0; s < (int) MeshBundleSection::Count; s++)
+    {
+        write(padding, header.sectionOffset[s] - written);
+        if (size[s] > 0) write(data[s], size[s]);
+    }
+
+    if (!file) throw std::runtime_error("Cannot write file at: " + path);
+}
+
+Mesh * ReadMeshBundle(const std::string & path)
+{
+    MeshBundle bundle(path);
+    int vertexCount = bundle.GetVertexCount();
+    int boneCount = bundle.GetBoneCount();
+
+    auto fail = [&](const std::string & what)
+    {
+        throw std::runtime_error(what + std::string(" in mesh bundle: ") + path);
+    };
+
+    const int32_t * triangleData = bundle.GetTriangles();
+    for (size_t k = 0; k < (size_t) 3 * bundle.GetTriangleCount(); k++)
+    {
+        if (triangleData[k] < 0 || triangleData[k] >= vertexCount) fail("Triangle vertex out of range");
+    }
+
+    // straight copies of the mapped arrays into the storage of the mesh
+    typedef Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> Rows;
+    Eigen::MatrixXf vertices = Eigen::Map<const Rows>(bundle.GetVertices(), vertexCount, 3);
+    Eigen::MatrixXi triangles = Eigen::Map<const Eigen::Matrix<int32_t, Eigen::Dynamic, 3, Eigen::RowMajor>>(
+        triangleData, bundle.GetTriangleCount(), 3).cast<int>();
+
+    if (bundle.IsCompressed())
+    {
+        using Section = MeshBundleSection;
+        std::vector<int> indexOfCenter;
+        Eigen::MatrixXf centers;
+        try
+        {
+            auto weights = DecodeWeights(bundle.GetSectionData(Section::WeightBones),
+                bundle.GetSectionSize(Section::WeightBones), bundle.GetSectionData(Section::WeightValues),
+                bundle.GetSectionSize(Section::WeightValues), boneCount, vertexCount, bundle.GetWeightCount());
+            if (bundle.HasCenters())
+                DecodeCenters(bundle.GetSectionData(Section::CenterIndex),
+                    bundle.GetSectionSize(Section::CenterIndex), bundle.GetSectionData(Section::Centers),
+                    bundle.GetSectionSize(Section::Centers), vertexCount, bundle.GetCenterCount(),
+                    indexOfCenter, centers);
+
+            std::unique_ptr<Mesh> mesh(new Mesh(std::move(vertices), std::move(triangles), std::move(weights)));
+            if (bundle.HasCenters()) mesh->SetCentersOfRotation(indexOfCenter, centers);
+            return mesh.release();
+        }
+        catch (const std::exception & e)
+        {
+            fail(e.what());
+        }
+    }
+
+    // Eigen and the skinning layout index with these without checks
+    const int32_t * start = bundle.GetWeightStart();
+    const int32_t * bones = bundle.GetWeightBones();
+    if (start[0] != 0 || start[vertexCount] != bundle.GetWeightCount()) fail("Weight starts do not cover the weights");
+    for (int i = 0; i < vertexCount; i++)
+    {
+        if (start[i + 1] < start[i]) fail("Decreasing weight starts");
+        for (int k = start[i]; k < start[i + 1]; k++)
+        {
+            if (bones[k] < 0 || bones[k] >= boneCount || (k > start[i] && bones[k] <= bones[k - 1]))
+                fail("Bones of vertex " + std::to_string(i) + " out of range or order");
+        }
+    }
+
+    Eigen::SparseMatrix<float> weights = Eigen::Map<const Eigen::SparseMatrix<float>>(boneCount, vertexCount,
+        bundle.GetWeightCount(), start, bones, bundle.GetWeightValues());
+
+    auto mesh = new Mesh(std::move(vertices), std::move(triangles), std::move(weights));
+    if (!bundle.HasCenters()) return mesh;
+
+    try
+    {
+        std::vector<int> indexOfCenter(bundle.GetCenterIndex(), bundle.GetCenterIndex() + vertexCount);
+        Eigen::MatrixXf centers = Eigen::Map<const Rows>(bundle.GetCenters(), bundle.GetCenterCount(), 3);
+        mesh->SetCentersOfRotation(indexOfCenter, centers);
+    }
+    catch (...)
+    {
+        delete mesh;
+        throw;
+    }
+    return mesh;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "Mesh.h"
+#include "skin_codec.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Single file binary form of a mesh and its centers of rotation, read in
+// place from a memory mapping without parsing. Little endian, every
+// section starts at a multiple of MESH_BUNDLE_ALIGNMENT from the start of
+// the file, and is in this order:
+//   vertices      float[vertexCount][3]
+//   triangles     int32[triangleCount][3]
+//   weightStart   int32[vertexCount + 1], the weights of vertex i are
+//   weightBones   int32[weightCount]      entries weightStart[i] to
+//   weightValues  float[weightCount]      weightStart[i + 1] - 1, by bone
+//   centerIndex   int32[vertexCount], -1 without a center   } empty without
+//   centers       float[centerCount][3]                     } centers
+// Compressed bundles (MESH_BUNDLE_COMPRESSED) hold the streams of
+// skin_codec.h in the weight bones, weight values, center index and centers
+// sections instead, the weight starts are empty, and are decoded on read.
+#define MESH_BUNDLE_VERSION 2
+#define MESH_BUNDLE_ALIGNMENT 64
+
+// flags of the header
+#define MESH_BUNDLE_COMPRESSED 1
+
+enum class MeshBundleSection
+{
+    Vertices = 0,
+    Triangles,
+    WeightStart,
+    WeightBones,
+    WeightValues,
+    CenterIndex,
+    Centers,
+    Count
+};
+
+struct MeshBundleHeader
+{
+    // "CORMESH" and a 0
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+
+    int32_t vertexCount;
+    int32_t triangleCount;
+    int32_t boneCount;
+    int32_t weightCount;
+    // -1 when the centers are not stored
+    int32_t centerCount;
+    // MESH_BUNDLE_COMPRESSED or 0, always 0 in version 1
+    int32_t flags;
+
+    // in bytes from the start of the file
+    uint64_t sectionOffset[(int) MeshBundleSection::Count];
+    uint64_t sectionSize[(int) MeshBundleSection::Count];
+};
+
+// A bundle mapped in memory, the arrays point into the mapping
+class MeshBundle
+{
+private:
+    MappedFile file;
+    const MeshBundleHeader * header = nullptr;
+
+    template <typename T>
+    const T * GetSection(MeshBundleSection section) const
+    {
+        return reinterpret_cast<const T *>(file.GetData() + header->sectionOffset[(int) section]);
+    }
+
+public:
+    // throws if the file is not a bundle or its sections do not fit in it
+    explicit MeshBundle(const std::string & path);
+
+    int GetVertexCount() const {return header->vertexCount;}
+    int GetTriangleCount() const {return header->triangleCount;}
+    int GetBoneCount() const {return header->boneCount;}
+    int GetWeightCount() const {return header->weightCount;}
+    bool HasCenters() const {return header->centerCount >= 0;}
+    int GetCenterCount() const {return header->centerCount;}
+    bool IsCompressed() const {return (header->flags & MESH_BUNDLE_COMPRESSED) != 0;}
+
+    // bytes of a section, the streams of compressed bundles
+    const uint8_t * GetSectionData(MeshBundleSection section) const {return GetSection<uint8_t>(section);}
+    uint64_t GetSectionSize(MeshBundleSection section) const {return header->sectionSize[(int) section];}
+
+    // the arrays of the weights and centers are only there when not compressed
+
+    const float * GetVertices() const {return GetSection<float>(MeshBundleSection::Vertices);}
+    const int32_t * GetTriangles() const {return GetSection<int32_t>(MeshBundleSection::Triangles);}
+    const int32_t * GetWeightStart() const {return GetSection<int32_t>(MeshBundleSection::WeightStart);}
+    const int32_t * GetWeightBones() const {return GetSection<int32_t>(MeshBundleSection::WeightBones);}
+    const float * GetWeightValues() const {return GetSection<float>(MeshBundleSection::WeightValues);}
+    const int32_t * GetCenterIndex() const {return GetSection<int32_t>(MeshBundleSection::CenterIndex);}
+    const float * GetCenters() const {return GetSection<float>(MeshBundleSection::Centers);}
+};
+
+// Write a bundle, the centers are left out when indexOfCenter is empty.
+// With a compression the weights and centers are compressed to its precision.
+void WriteMeshBundle(const std::string & path, const Eigen::MatrixXf & vertices,
+    const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights,
+    const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers,
+    const SkinCompression * compression = nullptr);
+
+// Counterpart of ReadMesh, with the centers when the bundle has them.
+// Throws if the indices in the bundle are out of range. Allocated with new.
+Mesh * ReadMeshBundle(const std::string & path);
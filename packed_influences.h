@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <algorithm>
+#include <vector>
+
+// Skin weight of a vertex or triangle in a fixed number of slots,
+// sorted by bone and padded with bone -1 and weight 0.
+// Unlike a sparse vector, reading the weight of a bone is a fixed width
+// comparison instead of a binary search, and the slots fit SIMD registers.
+template <int Width>
+struct PackedInfluences
+{
+    Eigen::Array<int, Width, 1> bones;
+    Eigen::Array<float, Width, 1> weights;
+    // slots in use
+    int count;
+};
+
+// Largest number of non zeros in a set of weights
+inline int MaximumInfluences(const Eigen::SparseMatrix<float> & weights)
+{
+    int largest = 0;
+    for (int i = 0; i < weights.outerSize(); i++)
+    {
+        largest = std::max(largest, (int) weights.col(i).nonZeros());
+    }
+    return largest;
+}
+
+// Assumes count is at most Width
+template <int Width>
+PackedInfluences<Width> PackInfluences(const int * bones, const float * weights, int count)
+{
+    PackedInfluences<Width> packed;
+    packed.bones.setConstant(-1);
+    packed.weights.setZero();
+
+    for (int slot = 0; slot < count; slot++)
+    {
+        packed.bones[slot] = bones[slot];
+        packed.weights[slot] = weights[slot];
+    }
+    packed.count = count;
+
+    return packed;
+}
+
+// Assumes the weight has at most Width non zeros
+template <int Width>
+PackedInfluences<Width> PackInfluences(const Eigen::SparseVector<float> & weight)
+{
+    return PackInfluences<Width>(weight.innerIndexPtr(), weight.valuePtr(), (int) weight.nonZeros());
+}
@@ -1,14 +1,19 @@
 #include "serialize.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
 
 #include <fstream>
 #include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <functional>
 #include <iterator>
-#include <regex>
+#include <memory>
+#include <stdexcept>
+#include <utility>
 
 using namespace std;
 
-regex whitespace("\\s+");
-
 void SerializeVertices(const Eigen::MatrixXf &vertices, const std::string &path)
 {
     ofstream file;
@@ -55,62 +60,146 @@ void SerializeWeights(const Eigen::SparseMatrix<float> &weights, const std::stri
     metadata.close();
 }
 
-// Read one line of data separated by spaces
-// https://stackoverflow.com/questions/12153573/c11-regex-token-iterator
-std::vector<std::string> tokenize(const std::string &line, int expectedTokenCount)
-{
-    // Tokenization (non-matched fragments)
-    // Note that regex is matched only two times; when the third value is obtained
-    // the iterator is a suffix iterator.
-    
-    sregex_token_iterator iter(line.begin(), line.end(), whitespace, -1);
-    sregex_token_iterator end;
-
-    vector<string> tokens;
-    for (; iter != end; ++iter)
-    {
-        string token = *iter;
-        if (token.length() != 0)
-            tokens.push_back(token);
-    }
-
-    // some elements per line
-    assert(tokens.size() == expectedTokenCount);
+// bytes of text parsed per task, cut at the next line end
+#define TEXT_CHUNK_SIZE (1 << 20)
 
-    return tokens;
+static bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
 }
 
-// Read triplets
-std::vector<Eigen::Triplet<float>> read_triplets(const std::string &path)
+// Parses the value at text after spaces, and moves text past it
+template <typename T>
+static bool ParseValue(const char *& text, const char * end, T & value)
 {
-    vector<Eigen::Triplet<float>> triplets;
+    while (text < end && IsBlank(*text)) text++;
+    auto result = from_chars(text, end, value);
+    if (result.ec != errc()) return false;
+    text = result.ptr;
+    return true;
+}
 
-    ifstream file;
-    file.open(path);
+// Maps the file and calls parse(text, lineEnd, row) on every line that is not
+// blank, row counting those lines. parse reads the values of the line and
+// returns false when it cannot, the rest of the line must be blank.
+// allocate(rowCount) is called first, so rows are written in place.
+// Large files are parsed in parallel, chunk by chunk on line boundaries.
+template <typename Allocate, typename Parse>
+static void ParseLines(const string & path, const Allocate & allocate, const Parse & parse)
+{
+    MappedFile file(path);
+    const char * data = file.GetData();
+    const char * fileEnd = data + file.GetSize();
 
-    if(!file.good())
+    vector<const char *> chunkStart = {data};
+    while (chunkStart.back() < fileEnd)
     {
-        file.close();
-        string message = string("Cannot open file at: ") + string(path);
-        throw runtime_error(message.c_str());
+        const char * end = chunkStart.back() + min<size_t>(TEXT_CHUNK_SIZE, fileEnd - chunkStart.back());
+        auto newline = (const char *) memchr(end, '\n', fileEnd - end);
+        chunkStart.push_back(end < fileEnd && newline ? newline + 1 : fileEnd);
     }
+    int chunkCount = (int) chunkStart.size() - 1;
+
+    unique_ptr<ThreadPool> pool;
+    if (chunkCount > 1) pool = make_unique<ThreadPool>();
+    auto forEachChunk = [&](const function<void(int, int)> & task)
+    {
+        if (pool) pool->ParallelFor(chunkCount, 1, task);
+        else task(0, chunkCount);
+    };
 
-    string line;
-    while (getline(file, line))
+    // Calls line(begin, end, isBlank) on the lines of a chunk
+    auto forEachLine = [&](int chunk, const auto & line)
+    {
+        for (const char * text = chunkStart[chunk]; text < chunkStart[chunk + 1];)
+        {
+            auto newline = (const char *) memchr(text, '\n', chunkStart[chunk + 1] - text);
+            const char * end = newline ? newline : chunkStart[chunk + 1];
+            if (!line(text, end, all_of(text, end, IsBlank))) break;
+            text = end + 1;
+        }
+    };
+
+    // first line and row of each chunk
+    vector<int> firstLine(chunkCount + 1, 0), firstRow(chunkCount + 1, 0);
+    forEachChunk([&](int begin, int end)
     {
-        auto tokens = tokenize(line, 3);
-        triplets.push_back(Eigen::Triplet<float>(stoi(tokens[0]), stoi(tokens[1]), stof(tokens[2])));
+        for (int chunk = begin; chunk < end; chunk++)
+        {
+            forEachLine(chunk, [&](const char *, const char *, bool isBlank)
+            {
+                firstLine[chunk + 1]++;
+                if (!isBlank) firstRow[chunk + 1]++;
+                return true;
+            });
+        }
+    });
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+    {
+        firstLine[chunk + 1] += firstLine[chunk];
+        firstRow[chunk + 1] += firstRow[chunk];
     }
 
-    file.close();
+    allocate(firstRow[chunkCount]);
 
-    return triplets;
+    // the first failing line of each chunk, -1 if none
+    vector<int> failedLine(chunkCount, -1);
+    forEachChunk([&](int begin, int end)
+    {
+        for (int chunk = begin; chunk < end; chunk++)
+        {
+            int line = firstLine[chunk];
+            int row = firstRow[chunk];
+            forEachLine(chunk, [&](const char * text, const char * lineEnd, bool isBlank)
+            {
+                if (!isBlank)
+                {
+                    if (!parse(text, lineEnd, row) || !all_of(text, lineEnd, IsBlank))
+                    {
+                        failedLine[chunk] = line;
+                        return false;
+                    }
+                    row++;
+                }
+                line++;
+                return true;
+            });
+        }
+    });
+
+    // reported like a serial read would
+    for (int line : failedLine)
+    {
+        if (line != -1)
+            throw runtime_error(string("Cannot parse line ") + to_string(line + 1)
+                + string(" of: ") + path);
+    }
 }
 
 // assume the path does not have an extension
 Eigen::SparseMatrix<float> ReadWeights(const std::string &path, int rows, int cols)
 {
-    auto triplets = read_triplets(path + string(".weights"));
+    // bone, vertex and weight per line
+    string weightPath = path + string(".weights");
+    vector<Eigen::Triplet<float>> triplets;
+    ParseLines(weightPath, [&](int rowCount) { triplets.resize(rowCount); },
+        [&](const char *& text, const char * end, int row)
+    {
+        int bone, vertex;
+        float value;
+        if (!ParseValue(text, end, bone) || !ParseValue(text, end, vertex)
+            || !ParseValue(text, end, value)) return false;
+
+        triplets[row] = Eigen::Triplet<float>(bone, vertex, value);
+        return true;
+    });
+
+    for (const auto & triplet : triplets)
+    {
+        if (triplet.row() < 0 || triplet.row() >= rows || triplet.col() < 0 || triplet.col() >= cols)
+            throw runtime_error(string("Weight out of range: bone ") + to_string(triplet.row())
+                + string(" vertex ") + to_string(triplet.col()) + string(" in: ") + weightPath);
+    }
 
     Eigen::SparseMatrix<float> weights(rows, cols);
 
@@ -119,74 +208,31 @@ Eigen::SparseMatrix<float> ReadWeights(const std::string &path, int rows, int co
     return weights;
 }
 
-Eigen::MatrixXf ReadVertices(const std::string &path)
+// rows of Columns values of type T
+template <typename T, int Columns>
+static Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> ReadRows(const string & path)
 {
-    ifstream file;
-    file.open(path);
-
-    if(!file.good())
-    {
-        file.close();
-        string message = string("Cannot open file at: ") + string(path);
-        throw runtime_error(message.c_str());
-    }
-
-    vector<vector<string>> lines;
-
-    string line;
-    while (getline(file, line))
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> matrix;
+    ParseLines(path, [&](int rowCount) { matrix.resize(rowCount, Columns); },
+        [&](const char *& text, const char * end, int row)
     {
-        auto tokens = tokenize(line, 3);
-
-        lines.push_back(tokens);
-    }
-
-    file.close();
-
-    Eigen::MatrixXf vertices(lines.size(), 3);
-
-    for (int i = 0; i < (int) lines.size(); i++)
-    {
-        const auto &line = lines[i];
-        vertices.row(i) << stof(line[0]), stof(line[1]), stof(line[2]);
-    }
+        for (int c = 0; c < Columns; c++)
+        {
+            if (!ParseValue(text, end, matrix(row, c))) return false;
+        }
+        return true;
+    });
+    return matrix;
+}
 
-    return vertices;
+Eigen::MatrixXf ReadVertices(const std::string &path)
+{
+    return ReadRows<float, 3>(path);
 }
 
 Eigen::MatrixXi ReadTriangles(const std::string &path)
 {
-    ifstream file;
-    file.open(path);
-
-    if(!file.good())
-    {
-        file.close();
-        string message = string("Cannot open file at: ") + string(path);
-        throw runtime_error(message.c_str());
-    }
-
-    vector<vector<string>> lines;
-
-    string line;
-    while (getline(file, line))
-    {
-        auto tokens = tokenize(line, 3);
-
-        lines.push_back(tokens);
-    }
-
-    file.close();
-
-    Eigen::MatrixXi triangles(lines.size(), 3);
-
-    for (int i = 0; i < (int) lines.size(); i++)
-    {
-        const auto &line = lines[i];
-        triangles.row(i) << stoi(line[0]), stoi(line[1]), stoi(line[2]);
-    }
-
-    return triangles;
+    return ReadRows<int, 3>(path);
 }
 
 Mesh* ReadMesh(const string & path)
@@ -194,28 +240,12 @@ Mesh* ReadMesh(const string & path)
     auto vertices = ReadVertices(path + string(".vertices"));
     auto triangles = ReadTriangles(path + string(".triangles"));
 
-    int rows = 0, cols = 0;
-
     string size = path + string(".weights.size");
-    fstream sizeFile(size);
+    auto dimensions = ReadRows<int, 2>(size);
+    if (dimensions.rows() != 1)
+        throw runtime_error(string("Expected one line with the bone and vertex counts in: ") + size);
 
-    if(!sizeFile.good())
-    {
-        sizeFile.close();
-        string message = string("Cannot open file at: ") + string(size);
-        throw runtime_error(message.c_str());
-    }
-
-    string line;
-    while (getline(sizeFile, line))
-    {
-        auto tokens = tokenize(line, 2);
+    auto weights = ReadWeights(path, dimensions(0, 0), dimensions(0, 1));
 
-        rows = stoi(tokens[0]);
-        cols = stoi(tokens[1]);
-    }
-
-    auto weights = ReadWeights(path, rows, cols);
-
-    return new Mesh(vertices, triangles, weights);
-}
\ No newline at end of file
+    return new Mesh(std::move(vertices), std::move(triangles), std::move(weights));
+}
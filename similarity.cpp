@@ -1,13 +1,20 @@
 #include "similarity.h"
 
 #include <Eigen/Sparse>
+#include <algorithm>
 #include <cmath>
 
 // #include <iostream>
 
-#ifndef KERNEL_WIDTH
-#define KERNEL_WIDTH 1
-#endif
+// one j,k term of the similarity, kept in the precision exp returns
+static inline auto SimilarityTerm(float w1_j, float w1_k, float w2_j, float w2_k)
+{
+    auto coef = w1_j * w1_k * w2_j * w2_k;
+
+    // exponential part
+    auto difference = w1_j * w2_k - w1_k * w2_j;
+    return coef * exp(- difference * difference / KERNEL_WIDTH * KERNEL_WIDTH);
+}
 
 // The similarity between two weight vectors is a float.
 // s(w1,w2) = sum_over_all_different_jk w1j * w1k * w2j * w2k 
@@ -22,20 +29,114 @@ float ComputeSimilarity(const Eigen::SparseVector<float> & weight1,
         {
             if (it1.index() == it2.index()) continue; // same bone
 
-            auto j = it1.index();
             auto k = it2.index();
             auto w1_j = it1.value();
             auto w1_k = weight1.coeff(k); // O(log n)
             auto w2_j = weight2.coeff(k); // O(log n)
             auto w2_k = it2.value();
 
-            auto coef = w1_j * w1_k * w2_j * w2_k;
+            similarity += SimilarityTerm(w1_j, w1_k, w2_j, w2_k);
+        }
+
+
+    return similarity;
+}
+
+float ComputeSimilarity(const Eigen::SparseVector<float> & weight1,
+    const int * bones2, const float * weights2, int count2)
+{
+    float similarity = 0;
+
+    for (Eigen::SparseVector<float>::InnerIterator it1(weight1); it1; ++it1)
+        for (int i2 = 0; i2 < count2; i2++)
+        {
+            if (it1.index() == bones2[i2]) continue; // same bone
+
+            auto k = bones2[i2];
+            auto w1_j = it1.value();
+            auto w1_k = weight1.coeff(k); // O(log n)
+            auto w2_j = weights2[i2]; // weight2.coeff(k)
+            auto w2_k = weights2[i2];
 
-            // exponential part
-            auto difference = w1_j * w2_k - w1_k * w2_j;
-            similarity += coef * exp(- difference * difference / KERNEL_WIDTH * KERNEL_WIDTH);
+            similarity += SimilarityTerm(w1_j, w1_k, w2_j, w2_k);
         }
 
+    return similarity;
+}
+
+// The weights of weight1 at the bones of weight2 are found with fixed width
+// SIMD comparisons instead of binary searches. The exponential is only taken
+// on terms with a non zero coefficient, in double like ComputeSimilarity,
+// and terms are summed in the same order, so the result is the same.
+template <int Width>
+float PackedSimilarity(const PackedInfluences<Width> & weight1,
+    const PackedInfluences<Width> & weight2)
+{
+    // weight1 at the bones of weight2, replaces coeff(k)
+    Eigen::Array<float, Width, 1> weight1AtBones2;
+    for (int k = 0; k < weight2.count; k++)
+    {
+        weight1AtBones2[k] = (weight1.bones == weight2.bones[k])
+            .select(weight1.weights, 0.0f).sum();
+    }
+
+    float similarity = 0;
+
+    for (int j = 0; j < weight1.count; j++)
+        for (int k = 0; k < weight2.count; k++)
+        {
+            if (weight1.bones[j] == weight2.bones[k]) continue; // same bone
+
+            auto w1_j = weight1.weights[j];
+            auto w1_k = weight1AtBones2[k];
+            if (w1_k == 0) continue; // zero term
+
+            // w2_j is read at bone k too, see ComputeSimilarity
+            auto w2_j = weight2.weights[k];
+            auto w2_k = weight2.weights[k];
+
+            similarity += SimilarityTerm(w1_j, w1_k, w2_j, w2_k);
+        }
 
     return similarity;
+}
+
+template float PackedSimilarity<4>(const PackedInfluences<4> &, const PackedInfluences<4> &);
+template float PackedSimilarity<8>(const PackedInfluences<8> &, const PackedInfluences<8> &);
+
+// In ComputeSimilarity w2_j is read at bone k, so with x = w2_k a term is
+// w1_j * w1_k * x^2 * exp(-((w1_j - w1_k) * x)^2).
+// x^2 exp(-g^2 x^2) rises up to x = 1/|g| and falls after,
+// so its extrema over [lower, upper] are at the ends or at the peak.
+void BoundSimilarity(const Eigen::SparseVector<float> & weight,
+    const std::vector<WeightBound> & bounds, float & lower, float & upper)
+{
+    lower = 0;
+    upper = 0;
+
+    for (Eigen::SparseVector<float>::InnerIterator it1(weight); it1; ++it1)
+        for (const auto & bound : bounds)
+        {
+            if (it1.index() == bound.bone) continue; // same bone
+
+            auto w1_j = it1.value();
+            auto w1_k = weight.coeff(bound.bone); // O(log n)
+            if (w1_j * w1_k == 0) continue;
+
+            auto atLower = SimilarityTerm(w1_j, w1_k, bound.lower, bound.lower);
+            auto atUpper = SimilarityTerm(w1_j, w1_k, bound.upper, bound.upper);
+
+            auto smallest = std::min(atLower, atUpper);
+            auto largest = std::max(atLower, atUpper);
+
+            auto slope = std::abs(w1_j - w1_k);
+            if (slope > 0 && bound.lower * slope < 1 && 1 < bound.upper * slope)
+            {
+                auto peak = 1 / slope;
+                largest = std::max(largest, SimilarityTerm(w1_j, w1_k, peak, peak));
+            }
+
+            lower += smallest;
+            upper += largest;
+        }
 }
\ No newline at end of file
@@ -1,6 +1,39 @@
 #pragma once
 
+#include "packed_influences.h"
+
 #include <Eigen/Sparse>
 
+#include <vector>
+
+// width of the exponential kernel of the similarity
+#ifndef KERNEL_WIDTH
+#define KERNEL_WIDTH 1
+#endif
+
+float ComputeSimilarity(const Eigen::SparseVector<float> & weight1,
+    const Eigen::SparseVector<float> & weight2);
+
+// Same with weight2 given as count2 sorted bones and their weights
 float ComputeSimilarity(const Eigen::SparseVector<float> & weight1,
-    const Eigen::SparseVector<float> & weight2);
\ No newline at end of file
+    const int * bones2, const float * weights2, int count2);
+
+// Same as ComputeSimilarity on weights packed in Width slots,
+// instantiated for 4 and 8 slots
+template <int Width>
+float PackedSimilarity(const PackedInfluences<Width> & weight1,
+    const PackedInfluences<Width> & weight2);
+
+// range of the weight of one bone over a set of weights
+struct WeightBound
+{
+    int bone;
+    float lower;
+    float upper;
+};
+
+// Lower and upper bounds of ComputeSimilarity(weight, w) over every w
+// within the bounds. Bounds are sorted by bone, missing bones weigh 0.
+// Assumes non negative weights.
+void BoundSimilarity(const Eigen::SparseVector<float> & weight,
+    const std::vector<WeightBound> & bounds, float & lower, float & upper);
\ No newline at end of file
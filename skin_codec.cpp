@@ -0,0 +1,344 @@
+#include "skin_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    void WriteVarint(std::vector<uint8_t> & bytes, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            bytes.push_back((uint8_t) (value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back((uint8_t) value);
+    }
+
+    void WriteSigned(std::vector<uint8_t> & bytes, int64_t value)
+    {
+        WriteVarint(bytes, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+    }
+
+    template <typename T>
+    void WriteRaw(std::vector<uint8_t> & bytes, const T & value)
+    {
+        auto start = bytes.size();
+        bytes.resize(start + sizeof(T));
+        std::memcpy(bytes.data() + start, &value, sizeof(T));
+    }
+
+    // Packs values of a fixed number of bits, least significant first
+    class BitWriter
+    {
+    private:
+        std::vector<uint8_t> & bytes;
+        uint64_t buffer = 0;
+        int bufferBits = 0;
+
+    public:
+        explicit BitWriter(std::vector<uint8_t> & bytes) : bytes(bytes) {}
+
+        void Write(uint32_t value, int bits)
+        {
+            buffer |= (uint64_t) value << bufferBits;
+            for (bufferBits += bits; bufferBits >= 8; bufferBits -= 8)
+            {
+                bytes.push_back((uint8_t) buffer);
+                buffer >>= 8;
+            }
+        }
+
+        // the last byte is padded with zeros
+        void Flush()
+        {
+            if (bufferBits > 0) bytes.push_back((uint8_t) buffer);
+            buffer = 0;
+            bufferBits = 0;
+        }
+    };
+
+    // Reads a stream front to back, throws at its end
+    class StreamReader
+    {
+    private:
+        const uint8_t * data;
+        const uint8_t * end;
+        const char * name;
+
+        [[noreturn]] void Fail(const std::string & what) const
+        {
+            throw std::runtime_error(what + std::string(" in the ") + name + std::string(" stream"));
+        }
+
+    public:
+        StreamReader(const uint8_t * data, size_t size, const char * name)
+            : data(data), end(data + size), name(name) {}
+
+        uint64_t ReadVarint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (data == end) Fail("Truncated value");
+                uint8_t byte = *data++;
+                value |= (uint64_t) (byte & 0x7F) << shift;
+                if (!(byte & 0x80)) return value;
+            }
+            Fail("Overlong value");
+        }
+
+        int64_t ReadSigned()
+        {
+            uint64_t value = ReadVarint();
+            return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+        }
+
+        // varint no larger than limit
+        uint64_t ReadBounded(uint64_t limit, const char * what)
+        {
+            uint64_t value = ReadVarint();
+            if (value > limit) Fail(std::string(what) + std::string(" out of range"));
+            return value;
+        }
+
+        // value of the given bits packed by a BitWriter from here,
+        // bitOffset counting the bits read so far
+        uint32_t ReadBits(int bits, uint64_t & bitOffset)
+        {
+            if ((bitOffset + bits + 7) / 8 > (uint64_t) (end - data)) Fail("Truncated value");
+
+            uint32_t value = 0;
+            for (int read = 0; read < bits;)
+            {
+                int shift = (int) (bitOffset % 8);
+                int count = std::min(8 - shift, bits - read);
+                value |= (uint32_t) ((data[bitOffset / 8] >> shift) & ((1u << count) - 1)) << read;
+                read += count;
+                bitOffset += count;
+            }
+            return value;
+        }
+
+        // skips the bytes holding bitCount bits
+        void SkipBits(uint64_t bitCount)
+        {
+            data += (bitCount + 7) / 8;
+        }
+
+        template <typename T>
+        T ReadRaw()
+        {
+            if ((size_t) (end - data) < sizeof(T)) Fail("Truncated header");
+            T value;
+            std::memcpy(&value, data, sizeof(T));
+            data += sizeof(T);
+            return value;
+        }
+
+        void ExpectEnd() const
+        {
+            if (data != end) Fail("Unexpected data at the end");
+        }
+    };
+
+    void CheckBits(int bits, int maximum, const char * what)
+    {
+        if (bits < 1 || bits > maximum)
+            throw std::invalid_argument(std::string(what) + std::string(" bits must be from 1 to ")
+                + std::to_string(maximum));
+    }
+}
+
+void EncodeWeights(const Eigen::SparseMatrix<float> & weights, int bits,
+    std::vector<uint8_t> & bones, std::vector<uint8_t> & values)
+{
+    CheckBits(bits, 16, "Weight");
+    uint32_t levels = (1u << bits) - 1;
+
+    float largest = 0;
+    for (int i = 0; i < weights.cols(); i++)
+    {
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+        {
+            if (!(it.value() >= 0)) throw std::invalid_argument("Compressed weights must not be negative");
+            largest = std::max(largest, it.value());
+        }
+    }
+
+    values.push_back((uint8_t) bits);
+    WriteRaw(values, largest);
+    BitWriter valueBits(values);
+
+    for (int i = 0; i < weights.cols(); i++)
+    {
+        // sorted by bone in compressed and uncompressed storage alike
+        int count = 0;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it) count++;
+        WriteVarint(bones, count);
+
+        int previous = -1;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+        {
+            int bone = (int) it.row();
+            WriteVarint(bones, (uint64_t) (bone - previous - 1));
+            previous = bone;
+
+            float scaled = largest > 0 ? it.value() / largest * levels : 0;
+            valueBits.Write((uint32_t) std::min<float>(std::round(scaled), (float) levels), bits);
+        }
+    }
+    valueBits.Flush();
+}
+
+Eigen::SparseMatrix<float> DecodeWeights(const uint8_t * bones, size_t bonesSize,
+    const uint8_t * values, size_t valuesSize, int boneCount, int vertexCount, int weightCount)
+{
+    StreamReader boneReader(bones, bonesSize, "weight bones");
+    StreamReader valueReader(values, valuesSize, "weight values");
+
+    int bits = valueReader.ReadRaw<uint8_t>();
+    float largest = valueReader.ReadRaw<float>();
+    CheckBits(bits, 16, "Weight");
+    if (!(largest >= 0 && std::isfinite(largest)))
+        throw std::runtime_error("Invalid largest weight in the weight values stream");
+    uint32_t levels = (1u << bits) - 1;
+
+    // columns filled in order, Eigen's low level insertion
+    Eigen::SparseMatrix<float> weights(boneCount, vertexCount);
+    weights.reserve(weightCount);
+
+    int64_t decoded = 0;
+    uint64_t valueBit = 0;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        weights.startVec(i);
+
+        int count = (int) boneReader.ReadBounded(boneCount, "Bone count");
+        if (decoded + count > weightCount)
+            throw std::runtime_error("More weights than expected in the weight bones stream");
+        decoded += count;
+
+        int bone = -1;
+        for (int k = 0; k < count; k++)
+        {
+            bone += 1 + (int) boneReader.ReadBounded(boneCount, "Bone");
+            if (bone >= boneCount)
+                throw std::runtime_error("Bone out of range in the weight bones stream");
+
+            uint32_t q = valueReader.ReadBits(bits, valueBit);
+            weights.insertBack(bone, i) = (float) q * largest / (float) levels;
+        }
+    }
+    weights.finalize();
+
+    if (decoded != weightCount)
+        throw std::runtime_error("Fewer weights than expected in the weight bones stream");
+    boneReader.ExpectEnd();
+    valueReader.SkipBits(valueBit);
+    valueReader.ExpectEnd();
+
+    return weights;
+}
+
+void EncodeCenters(const Eigen::MatrixXf & vertices, const std::vector<int> & indexOfCenter,
+    const Eigen::MatrixXf & centers, int bits,
+    std::vector<uint8_t> & index, std::vector<uint8_t> & coordinates)
+{
+    CheckBits(bits, 24, "Center");
+    if (indexOfCenter.size() != (size_t) vertices.rows())
+        throw std::invalid_argument("Expected one center index per vertex");
+
+    int centerCount = (int) centers.rows();
+    int next = 0;
+    for (int c : indexOfCenter)
+    {
+        if (c < -1 || c >= centerCount) throw std::invalid_argument("Center index out of range");
+
+        WriteVarint(index, c == -1 ? 0 : c == next ? 1 : (uint64_t) c + 2);
+        if (c == next) next++;
+    }
+
+    // grid over the mesh, widened to the centers in case some lie outside
+    Eigen::Array3f lower = Eigen::Array3f::Zero(), upper = Eigen::Array3f::Zero();
+    if (vertices.rows() + centerCount > 0)
+    {
+        lower = Eigen::Array3f::Constant(INFINITY);
+        upper = Eigen::Array3f::Constant(-INFINITY);
+    }
+    for (const auto * points : {&vertices, &centers})
+    {
+        if (points->rows() == 0) continue;
+        lower = lower.min(points->colwise().minCoeff().transpose().array());
+        upper = upper.max(points->colwise().maxCoeff().transpose().array());
+    }
+    if (!lower.isFinite().all() || !upper.isFinite().all())
+        throw std::invalid_argument("Cannot compress centers that are not finite");
+
+    float levels = (float) ((1u << bits) - 1);
+    Eigen::Array3f step = (upper - lower) / levels;
+
+    coordinates.push_back((uint8_t) bits);
+    for (int k = 0; k < 3; k++) WriteRaw(coordinates, lower[k]);
+    for (int k = 0; k < 3; k++) WriteRaw(coordinates, step[k]);
+
+    int64_t previous[3] = {0, 0, 0};
+    for (int c = 0; c < centerCount; c++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            float scaled = step[k] > 0 ? (centers(c, k) - lower[k]) / step[k] : 0;
+            int64_t q = (int64_t) std::clamp(std::round(scaled), 0.0f, levels);
+            WriteSigned(coordinates, q - previous[k]);
+            previous[k] = q;
+        }
+    }
+}
+
+void DecodeCenters(const uint8_t * index, size_t indexSize,
+    const uint8_t * coordinates, size_t coordinatesSize, int vertexCount, int centerCount,
+    std::vector<int> & indexOfCenter, Eigen::MatrixXf & centers)
+{
+    StreamReader indexReader(index, indexSize, "center index");
+    StreamReader coordinateReader(coordinates, coordinatesSize, "centers");
+
+    indexOfCenter.resize(vertexCount);
+    int next = 0;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        uint64_t token = indexReader.ReadBounded((uint64_t) centerCount + 1, "Center index");
+        if (token == 1 && next == centerCount)
+            throw std::runtime_error("More centers than expected in the center index stream");
+
+        indexOfCenter[i] = token == 0 ? -1 : token == 1 ? next++ : (int) (token - 2);
+    }
+    indexReader.ExpectEnd();
+
+    int bits = coordinateReader.ReadRaw<uint8_t>();
+    CheckBits(bits, 24, "Center");
+    float origin[3], step[3];
+    for (int k = 0; k < 3; k++) origin[k] = coordinateReader.ReadRaw<float>();
+    for (int k = 0; k < 3; k++) step[k] = coordinateReader.ReadRaw<float>();
+    int64_t levels = ((int64_t) 1 << bits) - 1;
+
+    centers.resize(centerCount, 3);
+    int64_t q[3] = {0, 0, 0};
+    for (int c = 0; c < centerCount; c++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            // checked before the sum, which could overflow
+            int64_t delta = coordinateReader.ReadSigned();
+            if (delta < -levels || delta > levels)
+                throw std::runtime_error("Center off the grid in the centers stream");
+            q[k] += delta;
+            if (q[k] < 0 || q[k] > levels)
+                throw std::runtime_error("Center off the grid in the centers stream");
+            centers(c, k) = origin[k] + (float) q[k] * step[k];
+        }
+    }
+    coordinateReader.ExpectEnd();
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bits kept by the compressed storage of the skin, more bits for less error
+struct SkinCompression
+{
+    // 1 to 16 per weight, the error is at most largest weight / (2^(bits + 1) - 2)
+    int weightBits = 12;
+    // 1 to 24 per coordinate of the centers, over the bounding box of the
+    // vertices and centers
+    int centerBits = 16;
+};
+
+// Compressed weights and centers of rotation, byte streams of LEB128
+// varints, zigzag coded when signed, apart from the weight values:
+//   weight bones   per vertex its bone count, its first bone, then the gap
+//                  to the previous bone minus 1
+//   weight values  uint8 bits, float largest weight, then per weight
+//                  round(weight / largest * (2^bits - 1)) packed on bits
+//                  bits, least significant first
+//   center index   per vertex 0 without a center, 1 for the center after
+//                  the last new one, otherwise its index + 2
+//   centers        uint8 bits, float origin[3], float step[3], then per
+//                  center and coordinate round((c - origin) / step) minus
+//                  that of the previous center
+// Computed centers are numbered by first vertex, so most vertices take a
+// byte of index and neighbouring centers small differences.
+
+// Appends the bone and value streams of the weights
+void EncodeWeights(const Eigen::SparseMatrix<float> & weights, int bits,
+    std::vector<uint8_t> & bones, std::vector<uint8_t> & values);
+
+// Decodes the streams straight into compressed column storage,
+// throws if they are corrupt or do not hold weightCount weights
+Eigen::SparseMatrix<float> DecodeWeights(const uint8_t * bones, size_t bonesSize,
+    const uint8_t * values, size_t valuesSize, int boneCount, int vertexCount, int weightCount);
+
+// Appends the index and coordinate streams of the centers,
+// indexOfCenter is -1 for vertices without a center
+void EncodeCenters(const Eigen::MatrixXf & vertices, const std::vector<int> & indexOfCenter,
+    const Eigen::MatrixXf & centers, int bits,
+    std::vector<uint8_t> & index, std::vector<uint8_t> & coordinates);
+
+// Throws if the streams are corrupt or do not hold centerCount centers
+void DecodeCenters(const uint8_t * index, size_t indexSize,
+    const uint8_t * coordinates, size_t coordinatesSize, int vertexCount, int centerCount,
+    std::vector<int> & indexOfCenter, Eigen::MatrixXf & centers);
@@ -0,0 +1,75 @@
+#include "skinning_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SKINNING_KERNEL_X86
+
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #include <immintrin.h>
+    #endif
+
+// in skinning_kernel_*.cpp
+void SkinBlocksSse4(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output);
+void SkinBlocksAvx2(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output);
+void SkinBlocksAvx512(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output);
+#endif
+
+SimdLevel DetectSimdLevel()
+{
+#if defined(SKINNING_KERNEL_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int highest = info[0];
+
+    __cpuid(info, 1);
+    bool sse4 = (info[2] & (1 << 19)) != 0;
+    bool osSavesYmm = false;
+    bool osSavesZmm = false;
+    // OSXSAVE, then the registers the system saves on context switches
+    if (info[2] & (1 << 27))
+    {
+        auto enabled = _xgetbv(0);
+        osSavesYmm = (enabled & 0x6) == 0x6;
+        osSavesZmm = (enabled & 0xe6) == 0xe6;
+    }
+
+    bool avx2 = false;
+    bool avx512 = false;
+    if (highest >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = osSavesYmm && (info[1] & (1 << 5));
+        avx512 = osSavesZmm && (info[1] & (1 << 16));
+    }
+
+    if (avx512) return SimdLevel::AVX512;
+    if (avx2) return SimdLevel::AVX2;
+    if (sse4) return SimdLevel::SSE4;
+#elif defined(SKINNING_KERNEL_X86)
+    // also checks that the system saves the wide registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE4;
+#endif
+    return SimdLevel::Scalar;
+}
+
+SkinBlocksFunction GetSkinningKernel(SimdLevel level)
+{
+#ifdef SKINNING_KERNEL_X86
+    switch (level)
+    {
+    case SimdLevel::AVX512: return SkinBlocksAvx512;
+    case SimdLevel::AVX2: return SkinBlocksAvx2;
+    case SimdLevel::SSE4: return SkinBlocksSse4;
+    default: return nullptr;
+    }
+#else
+    (void) level;
+    return nullptr;
+#endif
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// Vectorized center of rotation skinning, one vertex per SIMD lane.
+// The kernels follow the operation order of Mesh::DeformVertex, including
+// the order in which Eigen sums the products, and are built without
+// contraction into fused multiply adds, so the positions are the same as the
+// scalar path bit for bit. Compilers allowed to reassociate floats may differ
+// within a few ulps.
+// The kernels are compiled in their own files with the matching instruction
+// set, they do not use Eigen so no inline code built for a wider instruction
+// set can leak into the rest of the library.
+
+#include <cstdint>
+
+// vertices of a block, the widest kernel skins a block per iteration
+#define SKINNING_BLOCK_WIDTH 16
+
+enum class SimdLevel
+{
+    Scalar = 0,
+    SSE4 = 1,
+    AVX2 = 2,
+    AVX512 = 3
+};
+
+// Compact storage of the blocks (Mesh::SetCompactSkinning), indexed like
+// the float arrays it replaces and decoded as the kernels load it:
+// weight = q * weightScale, coordinate c = origin[c] + q * scale[c]
+struct SkinningCompactBlocks
+{
+    // one of the two, bytes for at most 256 bones
+    const uint8_t * bones8;
+    const uint16_t * bones16;
+    // one of the two, 8 or 16 bit weights
+    const uint8_t * weights8;
+    const uint16_t * weights16;
+    float weightScale;
+
+    // rest positions and centers on a 16 bit grid over their bounding box
+    const uint16_t * restPosition[3];
+    const uint16_t * center[3];
+    float origin[3];
+    float scale[3];
+    const uint8_t * hasCenter;
+};
+
+// Blocks of SKINNING_BLOCK_WIDTH vertices, padded with vertices without
+// influences. Influence k of lane l in block b is at
+// (b * stride + k) * SKINNING_BLOCK_WIDTH + l, per vertex data at
+// b * SKINNING_BLOCK_WIDTH + l.
+struct SkinningBlocks
+{
+    int blockCount;
+    int stride;
+
+    const int * bones;
+    const float * weights;
+
+    const float * restPosition[3];
+    const float * center[3];
+    // 1 for vertices with a center of rotation, 0 otherwise
+    const float * hasCenter;
+
+    // when not null, bones to hasCenter above are null and stored here
+    const SkinningCompactBlocks * compact;
+
+    // per block, the most influences of its vertices, which is all the
+    // kernels read, and the number of its vertices with a center
+    const int * influenceCount;
+    const int * centerCount;
+
+    // Vertex written for each position, null when vertices are stored in
+    // their own order. Coordinate c of position p goes to
+    // position[c][vertexIndex[p] * positionStride] of the output.
+    const int * vertexIndex;
+
+    // rest normals and tangents (x y z w), null when the mesh has none
+    const float * normal[3];
+    const float * tangent[4];
+};
+
+// Bone transformations of a frame, one array per coefficient
+struct SkinningFrame
+{
+    // x y z w
+    const float * quaternion[4];
+    // row major 3x3 rotation matrices of the quaternions
+    const float * rotation[9];
+    const float * translation[3];
+};
+
+// Where a frame is written. Coordinate c of vertex i goes to
+// position[c][i * positionStride]: a stride of 1 for separate arrays, 3 for
+// interleaved positions. Normals and tangents are the same, and are only
+// skinned when their pointers are not null.
+struct SkinningOutput
+{
+    float * position[3];
+    int positionStride;
+    // half floats written instead of the positions when not null,
+    // with the same stride
+    uint16_t * halfPosition[3];
+
+    float * normal[3];
+    int normalStride;
+
+    // x y z and w, which is copied from the rest tangent
+    float * tangent[4];
+    int tangentStride;
+
+    // Normals by the inverse transpose of the blended matrix of LBS and
+    // tangents by that matrix, normalized, instead of both by the rotation
+    // of the blended quaternion
+    bool lbsNormals;
+};
+
+// Skins blocks [firstBlock, endBlock) into the output,
+// vertices past vertexCount are not written
+typedef void (*SkinBlocksFunction)(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output);
+
+// best level supported by the processor and the operating system
+SimdLevel DetectSimdLevel();
+
+// Kernel of the given level, which the processor must support,
+// null for SimdLevel::Scalar or when the platform has no kernels
+SkinBlocksFunction GetSkinningKernel(SimdLevel level);
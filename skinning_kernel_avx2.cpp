@@ -0,0 +1,49 @@
+// Built with AVX2 enabled, see CMakeLists.txt
+#include "skinning_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#include "skinning_kernel_impl.h"
+
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx2Lanes
+    {
+        typedef __m256 F;
+        typedef __m256i I;
+        typedef __m256 M;
+        static const int Width = 8;
+
+        static F Set(float value) {return _mm256_set1_ps(value);}
+        static F Load(const float * data) {return _mm256_loadu_ps(data);}
+        static I LoadIndices(const int * data) {return _mm256_loadu_si256((const __m256i *) data);}
+        static void Store(float * data, F value) {_mm256_storeu_ps(data, value);}
+        static I LoadBytes(const uint8_t * data) {return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) data));}
+        static I LoadShorts(const uint16_t * data) {return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) data));}
+        static F ToFloat(I value) {return _mm256_cvtepi32_ps(value);}
+        static F Gather(const float * base, I indices) {return _mm256_i32gather_ps(base, indices, 4);}
+
+        static F Add(F a, F b) {return _mm256_add_ps(a, b);}
+        static F Sub(F a, F b) {return _mm256_sub_ps(a, b);}
+        static F Mul(F a, F b) {return _mm256_mul_ps(a, b);}
+        static F Div(F a, F b) {return _mm256_div_ps(a, b);}
+        static F Sqrt(F a) {return _mm256_sqrt_ps(a);}
+        static F Abs(F a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);}
+
+        static M LessEqual(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_LE_OQ);}
+        static M GreaterEqual(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_GE_OQ);}
+        static M Greater(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_GT_OQ);}
+        static M And(M a, M b) {return _mm256_and_ps(a, b);}
+        static F Select(M mask, F ifTrue, F ifFalse) {return _mm256_blendv_ps(ifFalse, ifTrue, mask);}
+    };
+}
+
+void SkinBlocksAvx2(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output)
+{
+    SkinBlocks<Avx2Lanes>(blocks, frame, firstBlock, endBlock, vertexCount, output);
+}
+
+#endif
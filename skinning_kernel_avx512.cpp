@@ -0,0 +1,50 @@
+// Built with AVX-512F enabled, see CMakeLists.txt
+#include "skinning_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#include "skinning_kernel_impl.h"
+
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx512Lanes
+    {
+        typedef __m512 F;
+        typedef __m512i I;
+        // masks are bits, one per lane
+        typedef __mmask16 M;
+        static const int Width = 16;
+
+        static F Set(float value) {return _mm512_set1_ps(value);}
+        static F Load(const float * data) {return _mm512_loadu_ps(data);}
+        static I LoadIndices(const int * data) {return _mm512_loadu_si512(data);}
+        static void Store(float * data, F value) {_mm512_storeu_ps(data, value);}
+        static I LoadBytes(const uint8_t * data) {return _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) data));}
+        static I LoadShorts(const uint16_t * data) {return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) data));}
+        static F ToFloat(I value) {return _mm512_cvtepi32_ps(value);}
+        static F Gather(const float * base, I indices) {return _mm512_i32gather_ps(indices, base, 4);}
+
+        static F Add(F a, F b) {return _mm512_add_ps(a, b);}
+        static F Sub(F a, F b) {return _mm512_sub_ps(a, b);}
+        static F Mul(F a, F b) {return _mm512_mul_ps(a, b);}
+        static F Div(F a, F b) {return _mm512_div_ps(a, b);}
+        static F Sqrt(F a) {return _mm512_sqrt_ps(a);}
+        static F Abs(F a) {return _mm512_abs_ps(a);}
+
+        static M LessEqual(F a, F b) {return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);}
+        static M GreaterEqual(F a, F b) {return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);}
+        static M Greater(F a, F b) {return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);}
+        static M And(M a, M b) {return (M) (a & b);}
+        static F Select(M mask, F ifTrue, F ifFalse) {return _mm512_mask_blend_ps(mask, ifFalse, ifTrue);}
+    };
+}
+
+void SkinBlocksAvx512(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output)
+{
+    SkinBlocks<Avx512Lanes>(blocks, frame, firstBlock, endBlock, vertexCount, output);
+}
+
+#endif
@@ -0,0 +1,330 @@
+#pragma once
+
+// Lane generic kernel, only included by the skinning_kernel_*.cpp files.
+// Everything here has internal linkage so the copy built for one
+// instruction set cannot replace another at link time.
+
+#include "half_float.h"
+#include "skinning_kernel.h"
+
+#include <cstddef>
+
+namespace
+{
+    // Eigen::isZero precision for floats
+    const float NULL_QUATERNION_PRECISION = 1e-5f;
+
+    // Row of a 3x3 matrix times a vector, summed like Eigen's unrolled
+    // 3 coefficient reduction: a0 + (a1 + a2)
+    template <typename L>
+    inline typename L::F RowProduct(const typename L::F * row, const typename L::F * vector)
+    {
+        return L::Add(L::Mul(row[0], vector[0]),
+            L::Add(L::Mul(row[1], vector[1]), L::Mul(row[2], vector[2])));
+    }
+
+    // Eigen's normalize: divided by the norm when it is not 0,
+    // the squared norm summed like its 3 coefficient reduction
+    template <typename L>
+    inline void Normalize(typename L::F * vector)
+    {
+        typedef typename L::F F;
+
+        F squaredNorm = L::Add(L::Mul(vector[0], vector[0]),
+            L::Add(L::Mul(vector[1], vector[1]), L::Mul(vector[2], vector[2])));
+        F norm = L::Select(L::Greater(squaredNorm, L::Set(0)), L::Sqrt(squaredNorm), L::Set(1));
+        for (int c = 0; c < 3; c++) vector[c] = L::Div(vector[c], norm);
+    }
+
+    // Loads of the blocks, decoded when they are compact
+
+    template <typename L, bool Compact>
+    inline typename L::I LoadBones(const SkinningBlocks & blocks, size_t slot)
+    {
+        if (!Compact) return L::LoadIndices(blocks.bones + slot);
+        const auto & compact = *blocks.compact;
+        if (compact.bones8) return L::LoadBytes(compact.bones8 + slot);
+        return L::LoadShorts(compact.bones16 + slot);
+    }
+
+    template <typename L, bool Compact>
+    inline typename L::F LoadWeights(const SkinningBlocks & blocks, size_t slot)
+    {
+        if (!Compact) return L::Load(blocks.weights + slot);
+        const auto & compact = *blocks.compact;
+        typename L::I quantized = compact.weights8 ? L::LoadBytes(compact.weights8 + slot)
+            : L::LoadShorts(compact.weights16 + slot);
+        return L::Mul(L::ToFloat(quantized), L::Set(compact.weightScale));
+    }
+
+    // coordinate c of the rest positions or, with isCenter, of the centers
+    template <typename L, bool Compact>
+    inline typename L::F LoadCoordinate(const SkinningBlocks & blocks, bool isCenter, int c,
+        size_t vertex)
+    {
+        if (!Compact) return L::Load((isCenter ? blocks.center : blocks.restPosition)[c] + vertex);
+        const auto & compact = *blocks.compact;
+        const uint16_t * quantized = (isCenter ? compact.center : compact.restPosition)[c];
+        return L::Add(L::Set(compact.origin[c]),
+            L::Mul(L::ToFloat(L::LoadShorts(quantized + vertex)), L::Set(compact.scale[c])));
+    }
+
+    template <typename L, bool Compact>
+    inline typename L::F LoadHasCenter(const SkinningBlocks & blocks, size_t vertex)
+    {
+        if (!Compact) return L::Load(blocks.hasCenter + vertex);
+        return L::ToFloat(L::LoadBytes(blocks.compact->hasCenter + vertex));
+    }
+
+    // Rows of the lanes: positions, normals, tangents x y z w
+    const int POSITION_ROW = 0;
+    const int NORMAL_ROW = 3;
+    const int TANGENT_ROW = 6;
+    const int LANE_ROW_COUNT = 10;
+
+    // L provides the vector types F (floats), I (ints) and M (masks) and the
+    // operations on them for Width lanes. Row r of the result is stored at
+    // rows[r], normals and tangents are skipped when their rows are null.
+    // Compact reads the blocks from blocks.compact.
+    template <typename L, bool Compact>
+    inline void SkinLanes(const SkinningBlocks & blocks, const SkinningFrame & frame,
+        bool lbsNormals, int block, int lane, float * const * rows)
+    {
+        typedef typename L::F F;
+        typedef typename L::I I;
+        typedef typename L::M M;
+
+        const F zero = L::Set(0);
+        const F one = L::Set(1);
+        const F minusOne = L::Set(-1);
+        const F two = L::Set(2);
+        const F precision = L::Set(NULL_QUATERNION_PRECISION);
+
+        F quaternion[4] = {zero, zero, zero, zero};
+        F rotation[9] = {zero, zero, zero, zero, zero, zero, zero, zero, zero};
+        F translation[3] = {zero, zero, zero};
+
+        // padding influences past the most of the block are not read
+        int influenceCount = blocks.influenceCount[block];
+        for (int k = 0; k < influenceCount; k++)
+        {
+            size_t slot = ((size_t) block * blocks.stride + k) * SKINNING_BLOCK_WIDTH + lane;
+            I bone = LoadBones<L, Compact>(blocks, slot);
+            F weight = LoadWeights<L, Compact>(blocks, slot);
+
+            F weighted[4];
+            for (int c = 0; c < 4; c++)
+            {
+                weighted[c] = L::Mul(weight, L::Gather(frame.quaternion[c], bone));
+            }
+
+            // Eigen::isZero on the sum so far
+            M isNull = L::And(
+                L::And(L::LessEqual(L::Abs(quaternion[0]), precision),
+                    L::LessEqual(L::Abs(quaternion[1]), precision)),
+                L::And(L::LessEqual(L::Abs(quaternion[2]), precision),
+                    L::LessEqual(L::Abs(quaternion[3]), precision)));
+
+            // summed like Eigen's 4 float dot product: (x + z) + (y + w)
+            F dot = L::Add(
+                L::Add(L::Mul(quaternion[0], weighted[0]), L::Mul(quaternion[2], weighted[2])),
+                L::Add(L::Mul(quaternion[1], weighted[1]), L::Mul(quaternion[3], weighted[3])));
+            F sign = L::Select(L::GreaterEqual(dot, zero), one, minusOne);
+
+            for (int c = 0; c < 4; c++)
+            {
+                quaternion[c] = L::Select(isNull, weighted[c],
+                    L::Add(quaternion[c], L::Mul(sign, weighted[c])));
+            }
+
+            for (int m = 0; m < 9; m++)
+            {
+                rotation[m] = L::Add(rotation[m],
+                    L::Mul(weight, L::Gather(frame.rotation[m], bone)));
+            }
+            for (int c = 0; c < 3; c++)
+            {
+                translation[c] = L::Add(translation[c],
+                    L::Mul(weight, L::Gather(frame.translation[c], bone)));
+            }
+        }
+
+        // normalize, null quaternions are left as they are
+        F squaredNorm = L::Add(
+            L::Add(L::Mul(quaternion[0], quaternion[0]), L::Mul(quaternion[2], quaternion[2])),
+            L::Add(L::Mul(quaternion[1], quaternion[1]), L::Mul(quaternion[3], quaternion[3])));
+        F norm = L::Select(L::Greater(squaredNorm, zero), L::Sqrt(squaredNorm), one);
+        for (int c = 0; c < 4; c++)
+        {
+            quaternion[c] = L::Div(quaternion[c], norm);
+        }
+
+        // Eigen::Quaternion::toRotationMatrix
+        F tx = L::Mul(two, quaternion[0]);
+        F ty = L::Mul(two, quaternion[1]);
+        F tz = L::Mul(two, quaternion[2]);
+        F twx = L::Mul(tx, quaternion[3]);
+        F twy = L::Mul(ty, quaternion[3]);
+        F twz = L::Mul(tz, quaternion[3]);
+        F txx = L::Mul(tx, quaternion[0]);
+        F txy = L::Mul(ty, quaternion[0]);
+        F txz = L::Mul(tz, quaternion[0]);
+        F tyy = L::Mul(ty, quaternion[1]);
+        F tyz = L::Mul(tz, quaternion[1]);
+        F tzz = L::Mul(tz, quaternion[2]);
+
+        F summed[9] = {
+            L::Sub(one, L::Add(tyy, tzz)), L::Sub(txy, twz), L::Add(txz, twy),
+            L::Add(txy, twz), L::Sub(one, L::Add(txx, tzz)), L::Sub(tyz, twx),
+            L::Sub(txz, twy), L::Add(tyz, twx), L::Sub(one, L::Add(txx, tyy))};
+
+        size_t vertex = (size_t) block * SKINNING_BLOCK_WIDTH + lane;
+
+        F rest[3];
+        for (int c = 0; c < 3; c++) rest[c] = LoadCoordinate<L, Compact>(blocks, false, c, vertex);
+
+        // blocks without centers, grouped when the vertices are reordered,
+        // keep the LBS translation without reading the centers
+        F finalTranslation[3] = {translation[0], translation[1], translation[2]};
+        if (blocks.centerCount[block] > 0)
+        {
+            F center[3];
+            for (int c = 0; c < 3; c++) center[c] = LoadCoordinate<L, Compact>(blocks, true, c, vertex);
+            M hasCenter = L::Greater(LoadHasCenter<L, Compact>(blocks, vertex), zero);
+
+            for (int r = 0; r < 3; r++)
+            {
+                // lbsRotation * center + lbsTranslation - summedQuaternionMatrix * center
+                F lbsCenter = RowProduct<L>(rotation + 3 * r, center);
+                F summedCenter = RowProduct<L>(summed + 3 * r, center);
+                finalTranslation[r] = L::Select(hasCenter,
+                    L::Sub(L::Add(lbsCenter, translation[r]), summedCenter), translation[r]);
+            }
+        }
+
+        F result[3];
+        for (int r = 0; r < 3; r++)
+        {
+            F summedRest = RowProduct<L>(summed + 3 * r, rest);
+            result[r] = L::Add(summedRest, finalTranslation[r]);
+        }
+
+        for (int c = 0; c < 3; c++) L::Store(rows[POSITION_ROW + c], result[c]);
+
+        if (!rows[NORMAL_ROW] && !rows[TANGENT_ROW]) return;
+
+        // cofactors of the blended matrix, its inverse transpose up to the determinant
+        F cofactor[9] = {
+            L::Sub(L::Mul(rotation[4], rotation[8]), L::Mul(rotation[5], rotation[7])),
+            L::Sub(L::Mul(rotation[5], rotation[6]), L::Mul(rotation[3], rotation[8])),
+            L::Sub(L::Mul(rotation[3], rotation[7]), L::Mul(rotation[4], rotation[6])),
+            L::Sub(L::Mul(rotation[2], rotation[7]), L::Mul(rotation[1], rotation[8])),
+            L::Sub(L::Mul(rotation[0], rotation[8]), L::Mul(rotation[2], rotation[6])),
+            L::Sub(L::Mul(rotation[1], rotation[6]), L::Mul(rotation[0], rotation[7])),
+            L::Sub(L::Mul(rotation[1], rotation[5]), L::Mul(rotation[2], rotation[4])),
+            L::Sub(L::Mul(rotation[2], rotation[3]), L::Mul(rotation[0], rotation[5])),
+            L::Sub(L::Mul(rotation[0], rotation[4]), L::Mul(rotation[1], rotation[3]))};
+
+        if (rows[NORMAL_ROW])
+        {
+            F normal[3], skinned[3];
+            for (int c = 0; c < 3; c++) normal[c] = L::Load(blocks.normal[c] + vertex);
+
+            if (lbsNormals)
+            {
+                // a negative determinant flips the cofactors
+                M isFlipped = L::Greater(zero, RowProduct<L>(rotation, cofactor));
+                for (int r = 0; r < 3; r++)
+                {
+                    skinned[r] = RowProduct<L>(cofactor + 3 * r, normal);
+                    skinned[r] = L::Select(isFlipped, L::Mul(minusOne, skinned[r]), skinned[r]);
+                }
+                Normalize<L>(skinned);
+            }
+            else
+            {
+                for (int r = 0; r < 3; r++) skinned[r] = RowProduct<L>(summed + 3 * r, normal);
+            }
+
+            for (int c = 0; c < 3; c++) L::Store(rows[NORMAL_ROW + c], skinned[c]);
+        }
+
+        if (rows[TANGENT_ROW])
+        {
+            F tangent[3], skinned[3];
+            for (int c = 0; c < 3; c++) tangent[c] = L::Load(blocks.tangent[c] + vertex);
+
+            const F * matrix = lbsNormals ? rotation : summed;
+            for (int r = 0; r < 3; r++) skinned[r] = RowProduct<L>(matrix + 3 * r, tangent);
+            if (lbsNormals) Normalize<L>(skinned);
+
+            for (int c = 0; c < 3; c++) L::Store(rows[TANGENT_ROW + c], skinned[c]);
+            if (rows[TANGENT_ROW + 3])
+                L::Store(rows[TANGENT_ROW + 3], L::Load(blocks.tangent[3] + vertex));
+        }
+    }
+
+    template <typename L>
+    void SkinBlocks(const SkinningBlocks & blocks, const SkinningFrame & frame,
+        int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output)
+    {
+        // destination arrays and strides of the rows, null rows are not skinned
+        float * destinations[LANE_ROW_COUNT] = {};
+        uint16_t * halfDestinations[LANE_ROW_COUNT] = {};
+        int strides[LANE_ROW_COUNT];
+        for (int c = 0; c < 3; c++)
+        {
+            destinations[POSITION_ROW + c] = output.position[c];
+            halfDestinations[POSITION_ROW + c] = output.halfPosition[c];
+            strides[POSITION_ROW + c] = output.positionStride;
+            destinations[NORMAL_ROW + c] = output.normal[c];
+            strides[NORMAL_ROW + c] = output.normalStride;
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            destinations[TANGENT_ROW + c] = output.tangent[c];
+            strides[TANGENT_ROW + c] = output.tangentStride;
+        }
+
+        float lanes[LANE_ROW_COUNT][L::Width];
+        float * rows[LANE_ROW_COUNT];
+
+        for (int block = firstBlock; block < endBlock; block++)
+        {
+            int first = block * SKINNING_BLOCK_WIDTH;
+
+            for (int lane = 0; lane < SKINNING_BLOCK_WIDTH; lane += L::Width)
+            {
+                int vertex = first + lane;
+                if (vertex >= vertexCount) break;
+
+                // separate arrays in vertex order are stored to directly,
+                // interleaved ones, reordered vertices and the last vertices
+                // go through the lanes
+                bool isFull = vertex + L::Width <= vertexCount && !blocks.vertexIndex;
+                for (int r = 0; r < LANE_ROW_COUNT; r++)
+                {
+                    if (halfDestinations[r]) rows[r] = lanes[r];
+                    else if (!destinations[r]) rows[r] = nullptr;
+                    else if (isFull && strides[r] == 1) rows[r] = destinations[r] + vertex;
+                    else rows[r] = lanes[r];
+                }
+
+                if (blocks.compact) SkinLanes<L, true>(blocks, frame, output.lbsNormals, block, lane, rows);
+                else SkinLanes<L, false>(blocks, frame, output.lbsNormals, block, lane, rows);
+
+                // padding lanes are not written out
+                for (int r = 0; r < LANE_ROW_COUNT; r++)
+                {
+                    if (rows[r] != lanes[r]) continue;
+                    for (int i = 0; i < L::Width && vertex + i < vertexCount; i++)
+                    {
+                        size_t index = blocks.vertexIndex ? blocks.vertexIndex[vertex + i] : vertex + i;
+                        if (halfDestinations[r]) halfDestinations[r][index * strides[r]] = FloatToHalf(lanes[r][i]);
+                        else destinations[r][index * strides[r]] = lanes[r][i];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,64 @@
+// Built with SSE4.1 enabled, see CMakeLists.txt
+#include "skinning_kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#include "skinning_kernel_impl.h"
+
+#include <smmintrin.h>
+
+#include <cstring>
+
+namespace
+{
+    struct Sse4Lanes
+    {
+        typedef __m128 F;
+        typedef __m128i I;
+        typedef __m128 M;
+        static const int Width = 4;
+
+        static F Set(float value) {return _mm_set1_ps(value);}
+        static F Load(const float * data) {return _mm_loadu_ps(data);}
+        static I LoadIndices(const int * data) {return _mm_loadu_si128((const __m128i *) data);}
+        static void Store(float * data, F value) {_mm_storeu_ps(data, value);}
+        static I LoadBytes(const uint8_t * data)
+        {
+            int bytes;
+            std::memcpy(&bytes, data, sizeof(bytes));
+            return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+        }
+        static I LoadShorts(const uint16_t * data) {return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) data));}
+        static F ToFloat(I value) {return _mm_cvtepi32_ps(value);}
+
+        // no gather before AVX2
+        static F Gather(const float * base, I indices)
+        {
+            return _mm_setr_ps(base[_mm_extract_epi32(indices, 0)],
+                base[_mm_extract_epi32(indices, 1)],
+                base[_mm_extract_epi32(indices, 2)],
+                base[_mm_extract_epi32(indices, 3)]);
+        }
+
+        static F Add(F a, F b) {return _mm_add_ps(a, b);}
+        static F Sub(F a, F b) {return _mm_sub_ps(a, b);}
+        static F Mul(F a, F b) {return _mm_mul_ps(a, b);}
+        static F Div(F a, F b) {return _mm_div_ps(a, b);}
+        static F Sqrt(F a) {return _mm_sqrt_ps(a);}
+        static F Abs(F a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);}
+
+        static M LessEqual(F a, F b) {return _mm_cmple_ps(a, b);}
+        static M GreaterEqual(F a, F b) {return _mm_cmpge_ps(a, b);}
+        static M Greater(F a, F b) {return _mm_cmpgt_ps(a, b);}
+        static M And(M a, M b) {return _mm_and_ps(a, b);}
+        static F Select(M mask, F ifTrue, F ifFalse) {return _mm_blendv_ps(ifFalse, ifTrue, mask);}
+    };
+}
+
+void SkinBlocksSse4(const SkinningBlocks & blocks, const SkinningFrame & frame,
+    int firstBlock, int endBlock, int vertexCount, const SkinningOutput & output)
+{
+    SkinBlocks<Sse4Lanes>(blocks, frame, firstBlock, endBlock, vertexCount, output);
+}
+
+#endif
@@ -0,0 +1,381 @@
+#include "skinning_layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+SkinningLayout::SkinningLayout(const Eigen::MatrixXf & restPositions,
+    const Eigen::SparseMatrix<float> & weights,
+    const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers,
+    const Eigen::MatrixXf & normals, const Eigen::MatrixXf & tangents,
+    const std::vector<int> & order, int compactWeightBits)
+{
+    if (compactWeightBits != 0 && compactWeightBits != 8 && compactWeightBits != 16)
+        throw std::invalid_argument("Compact weights have 8 or 16 bits, not "
+            + std::to_string(compactWeightBits));
+
+    int vertexCount = (int) restPositions.rows();
+    if (!order.empty() && (int) order.size() != vertexCount)
+        throw std::invalid_argument("The vertex order does not cover the mesh");
+    vertexIndex = order;
+
+    // stored entries are kept, explicit zeros included, to skin like the sparse weights
+    for (int i = 0; i < vertexCount; i++)
+    {
+        int count = 0;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it) count++;
+        stride = std::max(stride, count);
+    }
+
+    vertices.resize(vertexCount);
+    influences.assign((size_t) vertexCount * stride, SkinningInfluence{0, 0});
+
+    // from here on i is a position, the vertex stored there is GetVertexIndex(i)
+    for (int i = 0; i < vertexCount; i++)
+    {
+        auto & vertex = vertices[i];
+        int index = GetVertexIndex(i);
+
+        for (int c = 0; c < 3; c++)
+        {
+            vertex.restPosition[c] = restPositions(index, c);
+            vertex.center[c] = 0;
+        }
+
+        int centerIndex = indexOfCenter[index];
+        vertex.hasCenter = centerIndex != -1;
+        if (vertex.hasCenter)
+        {
+            for (int c = 0; c < 3; c++) vertex.center[c] = centers(centerIndex, c);
+        }
+
+        auto * vertexInfluences = influences.data() + (size_t) i * stride;
+        int count = 0;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, index); it; ++it)
+        {
+            vertexInfluences[count++] = SkinningInfluence{(int) it.index(), it.value()};
+        }
+        vertex.influenceCount = count;
+    }
+
+    // invert the influences, counting then filling keeps the vertices sorted
+    int boneCount = (int) weights.rows();
+    boneVertexStart.assign(boneCount + 1, 0);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        for (int k = 0; k < vertices[i].influenceCount; k++)
+            boneVertexStart[GetInfluences(i)[k].bone + 1]++;
+    }
+    for (int b = 0; b < boneCount; b++) boneVertexStart[b + 1] += boneVertexStart[b];
+
+    boneVertices.resize(boneVertexStart[boneCount]);
+    std::vector<int> next(boneVertexStart.begin(), boneVertexStart.end() - 1);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        for (int k = 0; k < vertices[i].influenceCount; k++)
+            boneVertices[next[GetInfluences(i)[k].bone]++] = i;
+    }
+
+    // decoded values replace the float ones before anything reads them
+    std::vector<uint16_t> positionCodes, centerCodes, weightCodes;
+    isCompact = compactWeightBits != 0;
+    if (isCompact) Quantize(compactWeightBits, positionCodes, centerCodes, weightCodes);
+    bool hasByteBones = boneCount <= 256;
+    bool hasByteWeights = compactWeightBits == 8;
+
+    // transpose into blocks, padding lanes have no influence
+    blockCount = (vertexCount + SKINNING_BLOCK_WIDTH - 1) / SKINNING_BLOCK_WIDTH;
+    size_t paddedCount = (size_t) blockCount * SKINNING_BLOCK_WIDTH;
+
+    if (!isCompact)
+    {
+        blockBones.assign(paddedCount * stride, 0);
+        blockWeights.assign(paddedCount * stride, 0);
+        for (int c = 0; c < 3; c++)
+        {
+            blockRestPositions[c].assign(paddedCount, 0);
+            blockCenters[c].assign(paddedCount, 0);
+        }
+        blockHasCenter.assign(paddedCount, 0);
+    }
+    else
+    {
+        if (hasByteBones) compactBones8.assign(paddedCount * stride, 0);
+        else compactBones16.assign(paddedCount * stride, 0);
+        if (hasByteWeights) compactWeights8.assign(paddedCount * stride, 0);
+        else compactWeights16.assign(paddedCount * stride, 0);
+        for (int c = 0; c < 3; c++)
+        {
+            compactRestPositions[c].assign(paddedCount, 0);
+            compactCenters[c].assign(paddedCount, 0);
+        }
+        compactHasCenter.assign(paddedCount, 0);
+    }
+    blockInfluenceCounts.assign(blockCount, 0);
+    blockCenterCounts.assign(blockCount, 0);
+
+    for (int i = 0; i < vertexCount; i++)
+    {
+        const auto & vertex = vertices[i];
+        int block = i / SKINNING_BLOCK_WIDTH;
+        int lane = i % SKINNING_BLOCK_WIDTH;
+
+        blockInfluenceCounts[block] = std::max(blockInfluenceCounts[block], vertex.influenceCount);
+        if (vertex.hasCenter) blockCenterCounts[block]++;
+
+        for (int k = 0; k < stride; k++)
+        {
+            size_t slot = ((size_t) block * stride + k) * SKINNING_BLOCK_WIDTH + lane;
+            int bone = GetInfluences(i)[k].bone;
+            if (!isCompact)
+            {
+                blockBones[slot] = bone;
+                blockWeights[slot] = GetInfluences(i)[k].weight;
+                continue;
+            }
+
+            uint16_t weightCode = weightCodes[(size_t) i * stride + k];
+            if (hasByteBones) compactBones8[slot] = (uint8_t) bone;
+            else compactBones16[slot] = (uint16_t) bone;
+            if (hasByteWeights) compactWeights8[slot] = (uint8_t) weightCode;
+            else compactWeights16[slot] = weightCode;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            if (!isCompact)
+            {
+                blockRestPositions[c][i] = vertex.restPosition[c];
+                blockCenters[c][i] = vertex.center[c];
+            }
+            else
+            {
+                compactRestPositions[c][i] = positionCodes[(size_t) 3 * i + c];
+                compactCenters[c][i] = centerCodes[(size_t) 3 * i + c];
+            }
+        }
+        if (!isCompact) blockHasCenter[i] = vertex.hasCenter ? 1.0f : 0.0f;
+        else compactHasCenter[i] = vertex.hasCenter ? 1 : 0;
+    }
+
+    if (isCompact)
+    {
+        compactBlocks.bones8 = hasByteBones ? compactBones8.data() : nullptr;
+        compactBlocks.bones16 = hasByteBones ? nullptr : compactBones16.data();
+        compactBlocks.weights8 = hasByteWeights ? compactWeights8.data() : nullptr;
+        compactBlocks.weights16 = hasByteWeights ? nullptr : compactWeights16.data();
+        for (int c = 0; c < 3; c++)
+        {
+            compactBlocks.restPosition[c] = compactRestPositions[c].data();
+            compactBlocks.center[c] = compactCenters[c].data();
+        }
+        compactBlocks.hasCenter = compactHasCenter.data();
+    }
+
+    // per vertex like the rest positions
+    if (normals.rows() > 0)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            blockNormals[c].assign(paddedCount, 0);
+            for (int i = 0; i < vertexCount; i++) blockNormals[c][i] = normals(GetVertexIndex(i), c);
+        }
+    }
+    if (tangents.rows() > 0)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            blockTangents[c].assign(paddedCount, 0);
+            for (int i = 0; i < vertexCount; i++) blockTangents[c][i] = tangents(GetVertexIndex(i), c);
+        }
+    }
+
+    std::vector<int> positions(vertexCount);
+    std::iota(positions.begin(), positions.end(), 0);
+    stats = MeasureOrder(positions);
+    if (!vertexIndex.empty())
+    {
+        for (int i = 0; i < vertexCount; i++) positions[vertexIndex[i]] = i;
+        meshOrderStats = MeasureOrder(positions);
+    }
+    else meshOrderStats = stats;
+}
+
+void SkinningLayout::Quantize(int weightBits, std::vector<uint16_t> & positionCodes,
+    std::vector<uint16_t> & centerCodes, std::vector<uint16_t> & weightCodes)
+{
+    int vertexCount = GetVertexCount();
+
+    // weights relative to the largest one, on weightBits bits
+    int largestCode = (1 << weightBits) - 1;
+    float largestWeight = 0;
+    for (const auto & influence : influences) largestWeight = std::max(largestWeight, influence.weight);
+    float weightScale = (largestWeight > 0 ? largestWeight : 1.0f) / largestCode;
+    compactBlocks.weightScale = weightScale;
+
+    weightCodes.assign(influences.size(), 0);
+    for (size_t k = 0; k < influences.size(); k++)
+    {
+        float code = std::round(influences[k].weight / weightScale);
+        weightCodes[k] = (uint16_t) std::min((float) largestCode, std::max(0.0f, code));
+
+        float decoded = (float) weightCodes[k] * weightScale;
+        quantizationError.weight = std::max(quantizationError.weight,
+            std::fabs(decoded - influences[k].weight));
+        influences[k].weight = decoded;
+    }
+
+    // one grid over the rest positions and the centers
+    float lowest[3], highest[3];
+    for (int c = 0; c < 3; c++)
+    {
+        lowest[c] = vertexCount > 0 ? vertices[0].restPosition[c] : 0;
+        highest[c] = lowest[c];
+    }
+    for (const auto & vertex : vertices)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            lowest[c] = std::min(lowest[c], vertex.restPosition[c]);
+            highest[c] = std::max(highest[c], vertex.restPosition[c]);
+            if (!vertex.hasCenter) continue;
+            lowest[c] = std::min(lowest[c], vertex.center[c]);
+            highest[c] = std::max(highest[c], vertex.center[c]);
+        }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        compactBlocks.origin[c] = lowest[c];
+        compactBlocks.scale[c] = (highest[c] - lowest[c]) / 65535.0f;
+    }
+
+    auto quantize = [&](float & coordinate, int c, float & error)
+    {
+        float scale = compactBlocks.scale[c];
+        float code = scale > 0 ? std::round((coordinate - compactBlocks.origin[c]) / scale) : 0;
+        uint16_t clamped = (uint16_t) std::min(65535.0f, std::max(0.0f, code));
+
+        // decoded like the kernels do
+        float decoded = compactBlocks.origin[c] + (float) clamped * scale;
+        error = std::max(error, std::fabs(decoded - coordinate));
+        coordinate = decoded;
+        return clamped;
+    };
+
+    positionCodes.assign((size_t) 3 * vertexCount, 0);
+    centerCodes.assign((size_t) 3 * vertexCount, 0);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        auto & vertex = vertices[i];
+        for (int c = 0; c < 3; c++)
+        {
+            positionCodes[(size_t) 3 * i + c] = quantize(vertex.restPosition[c], c,
+                quantizationError.restPosition);
+            // vertices without a center keep 0, which the kernels do not use
+            if (vertex.hasCenter)
+                centerCodes[(size_t) 3 * i + c] = quantize(vertex.center[c], c, quantizationError.center);
+        }
+    }
+}
+
+SkinningLayoutStats SkinningLayout::MeasureOrder(const std::vector<int> & positions) const
+{
+    const int lineSize = 64;
+    const int positionSize = 3 * sizeof(float);
+
+    // bytes of a block of each array of the storage in use
+    int boneBytes = sizeof(int), weightBytes = sizeof(float);
+    int coordinateBytes = sizeof(float), flagBytes = sizeof(float);
+    if (isCompact)
+    {
+        boneBytes = compactBlocks.bones8 ? 1 : 2;
+        weightBytes = compactBlocks.weights8 ? 1 : 2;
+        coordinateBytes = 2;
+        flagBytes = 1;
+    }
+    // consecutive blocks share lines when a block is smaller than a line
+    auto lines = [&](int bytes) {return (double) bytes * SKINNING_BLOCK_WIDTH / lineSize;};
+
+    SkinningLayoutStats measured = {};
+    int vertexCount = (int) positions.size();
+    int orderBlockCount = (vertexCount + SKINNING_BLOCK_WIDTH - 1) / SKINNING_BLOCK_WIDTH;
+    long long boneSum = 0;
+
+    std::vector<int> bones, outputLines;
+    for (int block = 0; block < orderBlockCount; block++)
+    {
+        int first = block * SKINNING_BLOCK_WIDTH;
+        int last = std::min(vertexCount, first + SKINNING_BLOCK_WIDTH);
+
+        int influenceCount = 0, centerCount = 0;
+        bones.clear();
+        outputLines.clear();
+        for (int p = first; p < last; p++)
+        {
+            int i = positions[p];
+            influenceCount = std::max(influenceCount, vertices[i].influenceCount);
+            if (vertices[i].hasCenter) centerCount++;
+            for (int k = 0; k < vertices[i].influenceCount; k++) bones.push_back(GetInfluences(i)[k].bone);
+
+            // first and last byte of the interleaved position
+            size_t offset = (size_t) GetVertexIndex(i) * positionSize;
+            outputLines.push_back((int) (offset / lineSize));
+            outputLines.push_back((int) ((offset + positionSize - 1) / lineSize));
+        }
+
+        std::sort(bones.begin(), bones.end());
+        boneSum += std::unique(bones.begin(), bones.end()) - bones.begin();
+        std::sort(outputLines.begin(), outputLines.end());
+        measured.cacheLines += std::unique(outputLines.begin(), outputLines.end()) - outputLines.begin();
+
+        // bones and weights per influence, rest positions and the center
+        // flags, centers when the block has some
+        measured.cacheLines += influenceCount * (lines(boneBytes) + lines(weightBytes))
+            + 3 * lines(coordinateBytes) + lines(flagBytes)
+            + (centerCount > 0 ? 3 * lines(coordinateBytes) : 0);
+        if (centerCount > 0 && centerCount < last - first) measured.mixedCenterBlocks++;
+    }
+
+    measured.bonesPerBlock = orderBlockCount > 0 ? (float) boneSum / orderBlockCount : 0;
+    return measured;
+}
+
+SkinningBlocks SkinningLayout::GetBlocks() const
+{
+    SkinningBlocks blocks;
+    blocks.blockCount = blockCount;
+    blocks.stride = stride;
+    blocks.bones = blockBones.data();
+    blocks.weights = blockWeights.data();
+    for (int c = 0; c < 3; c++)
+    {
+        blocks.restPosition[c] = blockRestPositions[c].data();
+        blocks.center[c] = blockCenters[c].data();
+    }
+    blocks.hasCenter = blockHasCenter.data();
+    blocks.compact = isCompact ? &compactBlocks : nullptr;
+    if (isCompact)
+    {
+        blocks.bones = nullptr;
+        blocks.weights = nullptr;
+        for (int c = 0; c < 3; c++)
+        {
+            blocks.restPosition[c] = nullptr;
+            blocks.center[c] = nullptr;
+        }
+        blocks.hasCenter = nullptr;
+    }
+    blocks.influenceCount = blockInfluenceCounts.data();
+    blocks.centerCount = blockCenterCounts.data();
+    blocks.vertexIndex = vertexIndex.empty() ? nullptr : vertexIndex.data();
+    for (int c = 0; c < 3; c++)
+    {
+        blocks.normal[c] = blockNormals[c].empty() ? nullptr : blockNormals[c].data();
+    }
+    for (int c = 0; c < 4; c++)
+    {
+        blocks.tangent[c] = blockTangents[c].empty() ? nullptr : blockTangents[c].data();
+    }
+    return blocks;
+}
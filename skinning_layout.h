@@ -0,0 +1,158 @@
+#pragma once
+
+#include "skinning_kernel.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <vector>
+
+// one bone of a vertex, padding slots have a weight of 0 on bone 0
+struct SkinningInfluence
+{
+    int bone;
+    float weight;
+};
+
+// Everything the skinning of a vertex reads besides its influences,
+// 32 bytes so 2 vertices share a cache line
+struct SkinningVertex
+{
+    float restPosition[3];
+    // copy of the center of rotation, only valid when hasCenter is set
+    float center[3];
+    int influenceCount;
+    int hasCenter;
+};
+
+// What skinning a frame reads and writes with a vertex order, to compare
+// orders. Lines are of 64 bytes, counted per block of the kernels with
+// positions written interleaved like Animate does.
+struct SkinningLayoutStats
+{
+    // lines of influences, per vertex data and positions
+    double cacheLines;
+    // blocks mixing vertices with and without a center
+    int mixedCenterBlocks;
+    // distinct bones read by a block on average
+    float bonesPerBlock;
+};
+
+// Largest differences between the compact storage and the float data
+struct SkinningQuantizationError
+{
+    float weight;
+    float restPosition;
+    float center;
+};
+
+// Runtime form of a skinned mesh, baked once the centers of rotation are known.
+// Vertices and their influences are stored in vertex order with a fixed
+// number of influences per vertex, so the skinning loop reads two arrays
+// front to back instead of walking the sparse weights and the center table.
+// Vertices may be stored in another order than the mesh's, the output is
+// always written in the mesh's order. With compact storage, the vertices and
+// influences hold the decoded values, so every path skins the same data.
+class SkinningLayout
+{
+private:
+    // influences per vertex, the most bones on one vertex
+    int stride = 0;
+
+    std::vector<SkinningVertex> vertices;
+    std::vector<SkinningInfluence> influences;
+
+    // the same data in blocks of SKINNING_BLOCK_WIDTH vertices, one
+    // array per field, for the SIMD kernels
+    int blockCount = 0;
+    std::vector<int> blockBones;
+    std::vector<float> blockWeights;
+    std::vector<float> blockRestPositions[3];
+    std::vector<float> blockCenters[3];
+    std::vector<float> blockHasCenter;
+    std::vector<int> blockInfluenceCounts;
+    std::vector<int> blockCenterCounts;
+    // empty when the mesh has no normals or tangents
+    std::vector<float> blockNormals[3];
+    std::vector<float> blockTangents[4];
+
+    // bone to vertex index, the vertices influenced by bone b are
+    // boneVertices[boneVertexStart[b]] to boneVertices[boneVertexStart[b + 1] - 1]
+    std::vector<int> boneVertexStart;
+    std::vector<int> boneVertices;
+
+    // compact storage replacing the float blocks, see SkinningCompactBlocks
+    bool isCompact = false;
+    SkinningCompactBlocks compactBlocks = {};
+    std::vector<uint8_t> compactBones8;
+    std::vector<uint16_t> compactBones16;
+    std::vector<uint8_t> compactWeights8;
+    std::vector<uint16_t> compactWeights16;
+    std::vector<uint16_t> compactRestPositions[3];
+    std::vector<uint16_t> compactCenters[3];
+    std::vector<uint8_t> compactHasCenter;
+    SkinningQuantizationError quantizationError = {};
+
+    // Quantizes the rest positions, centers and influence weights in place
+    // and returns their codes: 3 per vertex and stride per vertex
+    void Quantize(int weightBits, std::vector<uint16_t> & positionCodes,
+        std::vector<uint16_t> & centerCodes, std::vector<uint16_t> & weightCodes);
+
+    // vertex of the mesh at each position, empty in the mesh's order
+    std::vector<int> vertexIndex;
+    // stats of this order and of the mesh's
+    SkinningLayoutStats stats = {};
+    SkinningLayoutStats meshOrderStats = {};
+
+    // stats of the order that stores the vertex at positions[p] at p
+    SkinningLayoutStats MeasureOrder(const std::vector<int> & positions) const;
+
+public:
+    SkinningLayout() {}
+    // indexOfCenter is -1 for vertices without a center,
+    // normals (x y z) and tangents (x y z w) have no rows when absent.
+    // order[p] is the vertex stored at position p, empty keeps the mesh's order.
+    // compactWeightBits of 8 or 16 stores the blocks compactly with weights of
+    // that many bits, 0 stores floats.
+    SkinningLayout(const Eigen::MatrixXf & restPositions,
+        const Eigen::SparseMatrix<float> & weights,
+        const std::vector<int> & indexOfCenter, const Eigen::MatrixXf & centers,
+        const Eigen::MatrixXf & normals, const Eigen::MatrixXf & tangents,
+        const std::vector<int> & order = {}, int compactWeightBits = 0);
+
+    int GetVertexCount() const {return (int) vertices.size();}
+    int GetStride() const {return stride;}
+
+    // the vertex and its data are read by position
+    const SkinningVertex & GetVertex(int position) const {return vertices[position];}
+    // stride influences, the first influenceCount are the bones of the vertex
+    const SkinningInfluence * GetInfluences(int position) const
+    {
+        return influences.data() + (size_t) position * stride;
+    }
+    // vertex of the mesh stored at the position, where its output goes
+    int GetVertexIndex(int position) const
+    {
+        return vertexIndex.empty() ? position : vertexIndex[position];
+    }
+
+    bool IsCompact() const {return isCompact;}
+    // zero without compact storage
+    const SkinningQuantizationError & GetQuantizationError() const {return quantizationError;}
+
+    const SkinningLayoutStats & GetStats() const {return stats;}
+    // what the mesh's order would give
+    const SkinningLayoutStats & GetMeshOrderStats() const {return meshOrderStats;}
+
+    // view of the blocks, valid as long as the layout
+    SkinningBlocks GetBlocks() const;
+
+    int GetBoneCount() const {return (int) boneVertexStart.size() - 1;}
+    // positions of the vertices with an influence of the bone in increasing
+    // order, count is set to their number
+    const int * GetInfluencedVertices(int bone, int & count) const
+    {
+        count = boneVertexStart[bone + 1] - boneVertexStart[bone];
+        return boneVertices.data() + boneVertexStart[bone];
+    }
+};
@@ -0,0 +1,387 @@
+#include "streaming_centers.h"
+#include "center_integrator.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "triangle_cache.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#define VERTEX_CHUNK_SIZE 16
+// names tried for a scratch directory before giving up
+#define SCRATCH_NAME_ATTEMPTS 16
+
+namespace
+{
+    struct WeightEntry
+    {
+        int bone;
+        float value;
+    };
+
+    // Vertices and weights of the whole mesh, mapped from the scratch files
+    struct VertexStore
+    {
+        MappedFile positions;
+        // weights of vertex v are entries[start[v], start[v + 1])
+        MappedFile start;
+        MappedFile entries;
+
+        int vertexCount = 0;
+        int boneCount = 0;
+
+        Eigen::Vector3f GetPosition(int v) const
+        {
+            const float * position = positions.As<float>() + 3 * (size_t) v;
+            return Eigen::Vector3f(position[0], position[1], position[2]);
+        }
+
+        // columns of the given vertices, in their order
+        Eigen::SparseMatrix<float> GetWeights(const int * vertices, int count) const
+        {
+            std::vector<Eigen::Triplet<float>> triplets;
+            for (int i = 0; i < count; i++)
+            {
+                auto first = start.As<long long>()[vertices[i]];
+                auto last = start.As<long long>()[vertices[i] + 1];
+                for (auto e = first; e < last; e++)
+                {
+                    const auto & entry = entries.As<WeightEntry>()[e];
+                    triplets.emplace_back(entry.bone, i, entry.value);
+                }
+            }
+
+            Eigen::SparseMatrix<float> weights(boneCount, count);
+            weights.setFromTriplets(triplets.begin(), triplets.end());
+            return weights;
+        }
+    };
+
+    // A new directory of its own inside parent, removed with the scratch
+    // files however the computation ends. Nothing else in parent is touched.
+    struct ScratchDirectory
+    {
+        std::filesystem::path path;
+
+        ScratchDirectory(const std::filesystem::path & parent, const std::string & name)
+        {
+            std::filesystem::create_directories(parent);
+
+            std::random_device seed;
+            std::mt19937_64 random(((uint64_t) seed() << 32) ^ seed());
+            for (int attempt = 0; attempt < SCRATCH_NAME_ATTEMPTS; attempt++)
+            {
+                char suffix[17];
+                std::snprintf(suffix, sizeof(suffix), "%016llx", (unsigned long long) random());
+                auto candidate = parent / (name + "." + suffix);
+                if (std::filesystem::create_directory(candidate))
+                {
+                    path = candidate;
+                    return;
+                }
+            }
+            throw std::runtime_error(std::string("Cannot create a scratch directory in: ") + parent.string());
+        }
+        ~ScratchDirectory()
+        {
+            std::error_code ignored;
+            std::filesystem::remove_all(path, ignored);
+        }
+    };
+}
+
+static std::ifstream OpenText(const std::string & path)
+{
+    std::ifstream file(path);
+    if (!file.good())
+        throw std::runtime_error(std::string("Cannot open file at: ") + path);
+    return file;
+}
+
+static std::ofstream OpenBinary(const std::filesystem::path & path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error(std::string("Cannot create file at: ") + path.string());
+    return file;
+}
+
+static void ReadWeightSize(const std::string & path, int & boneCount, int & vertexCount)
+{
+    auto file = OpenText(path);
+    if (!(file >> boneCount >> vertexCount))
+        throw std::runtime_error(std::string("Cannot parse the weight size in: ") + path);
+}
+
+// text rows of 3 floats to packed floats, returns the vertex count
+static int ConvertVertices(const std::string & path, const std::filesystem::path & binaryPath)
+{
+    auto text = OpenText(path);
+    auto binary = OpenBinary(binaryPath);
+
+    int count = 0;
+    float position[3];
+    while (text >> position[0] >> position[1] >> position[2])
+    {
+        binary.write((const char *) position, sizeof(position));
+        count++;
+    }
+
+    if (!text.eof())
+        throw std::runtime_error(std::string("Cannot parse vertex ") + std::to_string(count)
+            + std::string(" in: ") + path);
+
+    return count;
+}
+
+// Weight triplets to compressed sparse columns, like setFromTriplets:
+// bones are sorted in each vertex and repeated bones are summed
+static void ConvertWeights(const std::string & path, int boneCount, int vertexCount,
+    const std::filesystem::path & startPath, const std::filesystem::path & entryPath)
+{
+    auto text = OpenText(path);
+    auto startFile = OpenBinary(startPath);
+    auto entryFile = OpenBinary(entryPath);
+
+    long long written = 0;
+    int nextVertex = 0;
+    std::vector<WeightEntry> vertexEntries;
+
+    auto flush = [&]()
+    {
+        std::stable_sort(vertexEntries.begin(), vertexEntries.end(),
+            [](const WeightEntry & a, const WeightEntry & b) { return a.bone < b.bone; });
+
+        for (size_t i = 0; i < vertexEntries.size(); i++)
+        {
+            auto entry = vertexEntries[i];
+            while (i + 1 < vertexEntries.size() && vertexEntries[i + 1].bone == entry.bone)
+            {
+                entry.value += vertexEntries[++i].value;
+            }
+            entryFile.write((const char *) &entry, sizeof(entry));
+            written++;
+        }
+        vertexEntries.clear();
+
+        startFile.write((const char *) &written, sizeof(written));
+        nextVertex++;
+    };
+
+    startFile.write((const char *) &written, sizeof(written));
+
+    int bone, vertex;
+    float value;
+    while (text >> bone >> vertex >> value)
+    {
+        if (bone < 0 || bone >= boneCount || vertex < 0 || vertex >= vertexCount)
+            throw std::runtime_error(std::string("Weight out of range: ")
+                + std::to_string(bone) + std::string(" ") + std::to_string(vertex));
+        if (vertex < nextVertex)
+            throw std::runtime_error(std::string("Weights must be sorted by vertex: ") + path);
+
+        while (nextVertex < vertex) flush();
+        vertexEntries.push_back({bone, value});
+    }
+
+    if (!text.eof())
+        throw std::runtime_error(std::string("Cannot parse the weights in: ") + path);
+
+    while (nextVertex < vertexCount) flush();
+}
+
+// Caches the triangles chunk by chunk, returns the chunk count
+static int CacheTriangles(const std::string & path, const VertexStore & store,
+    int chunkSize, ThreadPool & pool, const std::filesystem::path & cachePath)
+{
+    auto text = OpenText(path);
+    auto binary = OpenBinary(cachePath);
+
+    int chunkCount = 0;
+    int triangleCount = 0;
+    std::vector<int> corners;
+
+    while (true)
+    {
+        corners.clear();
+
+        int corner;
+        while ((int) corners.size() < 3 * chunkSize && text >> corner)
+        {
+            if (corner < 0 || corner >= store.vertexCount)
+                throw std::runtime_error(std::string("Vertex index out of range in triangle ")
+                    + std::to_string(triangleCount + (int) corners.size() / 3));
+            corners.push_back(corner);
+        }
+
+        if (corners.size() % 3 != 0 || (corners.empty() && !text.eof()))
+            throw std::runtime_error(std::string("Cannot parse triangle ")
+                + std::to_string(triangleCount + (int) corners.size() / 3)
+                + std::string(" in: ") + path);
+        if (corners.empty()) break;
+
+        // the chunk only needs its own corners, renumbered
+        std::vector<int> chunkVertices = corners;
+        std::sort(chunkVertices.begin(), chunkVertices.end());
+        chunkVertices.erase(std::unique(chunkVertices.begin(), chunkVertices.end()),
+            chunkVertices.end());
+
+        Eigen::MatrixXf vertices(chunkVertices.size(), 3);
+        for (int i = 0; i < (int) chunkVertices.size(); i++)
+        {
+            vertices.row(i) = store.GetPosition(chunkVertices[i]);
+        }
+
+        int chunkTriangles = (int) corners.size() / 3;
+        Eigen::MatrixXi triangles(chunkTriangles, 3);
+        for (int t = 0; t < chunkTriangles; t++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                triangles(t, c) = (int) (std::lower_bound(chunkVertices.begin(),
+                    chunkVertices.end(), corners[3 * t + c]) - chunkVertices.begin());
+            }
+        }
+
+        auto weights = store.GetWeights(chunkVertices.data(), (int) chunkVertices.size());
+
+        TriangleCache(vertices, triangles, weights, pool).Write(binary);
+
+        triangleCount += chunkTriangles;
+        chunkCount++;
+    }
+
+    if (!binary.good())
+        throw std::runtime_error(std::string("Cannot write file at: ") + cachePath.string());
+
+    return chunkCount;
+}
+
+static void CheckCancellation(const ComputeProgress * progress)
+{
+    if (progress && progress->cancelled.load(std::memory_order_relaxed))
+        throw std::runtime_error("Computation of the centers was cancelled");
+}
+
+void ComputeCentersStreaming(const std::string & path, const StreamingOptions & options)
+{
+    if (options.vertexTileSize <= 0 || options.triangleChunkSize <= 0)
+        throw std::invalid_argument("Tile and chunk sizes must be positive");
+
+    auto progress = options.progress;
+
+    std::filesystem::path meshPath(path);
+    auto parent = options.scratchDirectory.empty()
+        ? meshPath.parent_path() : std::filesystem::path(options.scratchDirectory);
+    ScratchDirectory scratch(parent.empty() ? std::filesystem::path(".") : parent,
+        meshPath.filename().string() + std::string(".scratch"));
+
+    ThreadPool pool(options.threadCount);
+
+    // binary copies of the vertices and weights, mapped for random access
+    VertexStore store;
+    int vertexCount = 0;
+    ReadWeightSize(path + std::string(".weights.size"), store.boneCount, vertexCount);
+
+    store.vertexCount = ConvertVertices(path + std::string(".vertices"),
+        scratch.path / "vertices.bin");
+    if (store.vertexCount != vertexCount)
+        throw std::runtime_error(std::string("Vertex count mismatch: ")
+            + std::to_string(store.vertexCount) + std::string(" vertices, ")
+            + std::to_string(vertexCount) + std::string(" weights"));
+
+    ConvertWeights(path + std::string(".weights"), store.boneCount, vertexCount,
+        scratch.path / "weight_start.bin", scratch.path / "weight_entries.bin");
+
+    store.positions = MappedFile((scratch.path / "vertices.bin").string());
+    store.start = MappedFile((scratch.path / "weight_start.bin").string());
+    store.entries = MappedFile((scratch.path / "weight_entries.bin").string());
+
+    CheckCancellation(progress);
+
+    auto cachePath = scratch.path / "triangles.bin";
+    int chunkCount = CacheTriangles(path + std::string(".triangles"), store,
+        options.triangleChunkSize, pool, cachePath);
+
+    int tileCount = (vertexCount + options.vertexTileSize - 1) / options.vertexTileSize;
+    if (progress) progress->total.store(tileCount * chunkCount, std::memory_order_relaxed);
+
+    // centers are written tile by tile, a failure leaves no partial file
+    auto centersPath = path + std::string(".centers");
+    std::ofstream centers(centersPath);
+    if (!centers.good())
+        throw std::runtime_error(std::string("Cannot create file at: ") + centersPath);
+
+    try
+    {
+        for (int tile = 0; tile < tileCount; tile++)
+        {
+            int first = tile * options.vertexTileSize;
+            int count = std::min(options.vertexTileSize, vertexCount - first);
+
+            std::vector<int> tileVertices(count);
+            for (int i = 0; i < count; i++) tileVertices[i] = first + i;
+            auto weights = store.GetWeights(tileVertices.data(), count);
+
+            // vertices with one bone have no center
+            std::vector<int> active;
+            for (int i = 0; i < count; i++)
+            {
+                if (1 != weights.col(i).nonZeros()) active.push_back(i);
+            }
+
+            std::vector<Eigen::Vector3f> nominators(active.size(), Eigen::Vector3f::Zero());
+            std::vector<float> denominators(active.size(), 0);
+
+            // chunks come in triangle order, so the sums match the in memory ones
+            std::ifstream chunks(cachePath, std::ios::binary);
+            for (int c = 0; c < chunkCount; c++)
+            {
+                CheckCancellation(progress);
+
+                TriangleCache cache;
+                cache.Read(chunks);
+                CenterIntegrator integrator(weights, cache);
+
+                pool.ParallelFor((int) active.size(), VERTEX_CHUNK_SIZE, [&](int begin, int end)
+                {
+                    std::vector<int> candidateTriangles;
+                    for (int k = begin; k < end; k++)
+                    {
+                        integrator.Accumulate(active[k], nominators[k], denominators[k],
+                            candidateTriangles);
+                    }
+                });
+
+                if (progress) progress->completed.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            for (int k = 0; k < (int) active.size(); k++)
+            {
+                CenterIntegrator::CheckDenominator(first + active[k], denominators[k]);
+
+                Eigen::Vector3f center = nominators[k] / denominators[k];
+                centers << center.x() << " " << center.y() << " " << center.z() << "\n";
+            }
+
+            if (!centers.good())
+                throw std::runtime_error(std::string("Cannot write file at: ") + centersPath);
+        }
+    }
+    catch (...)
+    {
+        centers.close();
+        std::error_code ignored;
+        std::filesystem::remove(centersPath, ignored);
+        throw;
+    }
+}
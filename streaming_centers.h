@@ -0,0 +1,33 @@
+#pragma once
+
+#include "compute_progress.h"
+
+#include <string>
+
+struct StreamingOptions
+{
+    // vertices whose sums are held in memory at once
+    int vertexTileSize = 1 << 16;
+    // triangles cached in memory at once
+    int triangleChunkSize = 1 << 16;
+    // 0 means one thread per hardware thread
+    int threadCount = 0;
+    // scratch files go to a new directory made inside this one, or next to
+    // path when empty, named like path + ".scratch.<random>". Only that new
+    // directory is removed when done.
+    std::string scratchDirectory;
+    // optional, counts tiles times chunks and can cancel
+    ComputeProgress * progress = nullptr;
+};
+
+// Out-of-core computation of the centers of rotation, for meshes whose
+// precomputation does not fit in memory.
+// Reads path.vertices, path.triangles, path.weights and path.weights.size
+// as written by Mesh::Serialize, with the weights sorted by vertex.
+// Vertices and weights are converted to memory mapped binary files and the
+// triangles are cached on disk chunk by chunk. Every tile of vertices then
+// accumulates its sums over the chunks like a blocked matrix product, and its
+// centers are appended to path.centers, one per vertex with more than one bone.
+// The centers are the same as Mesh::ComputeCentersOfRotation without sharing.
+void ComputeCentersStreaming(const std::string & path,
+    const StreamingOptions & options = StreamingOptions());
@@ -0,0 +1,263 @@
+#include "subdivision.h"
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define SUBDIVISION_CHUNK_SIZE 1024
+// every round halves the distance along split edges
+#define MAX_SUBDIVISION_ROUNDS 16
+
+float SkinningWeightDistance(const Eigen::SparseVector<float> & weightA,
+    const Eigen::SparseVector<float> & weightB)
+{
+    // merge of the sorted bones, without a temporary difference
+    Eigen::SparseVector<float>::InnerIterator itA(weightA);
+    Eigen::SparseVector<float>::InnerIterator itB(weightB);
+
+    float squaredDistance = 0;
+    while (itA || itB)
+    {
+        float difference;
+        if (itA && (!itB || itA.index() < itB.index()))
+        {
+            difference = itA.value();
+            ++itA;
+        }
+        else if (itB && (!itA || itB.index() < itA.index()))
+        {
+            difference = itB.value();
+            ++itB;
+        }
+        else
+        {
+            difference = itA.value() - itB.value();
+            ++itA;
+            ++itB;
+        }
+
+        squaredDistance += difference * difference;
+    }
+
+    return std::sqrt(squaredDistance);
+}
+
+static std::uint64_t EdgeKey(int a, int b)
+{
+    if (a > b) std::swap(a, b);
+    return ((std::uint64_t) a << 32) | (std::uint32_t) b;
+}
+
+// Pieces of a triangle whose edges (v0 v1), (v1 v2), (v2 v0) are split at the
+// midpoints m0, m1, m2 given by the mask, in the orientation of the triangle
+static int SplitTriangle(const Eigen::Vector3i & triangle, const Eigen::Vector3i & midpoints,
+    int mask, Eigen::Vector3i * pieces)
+{
+    if (mask == 7)
+    {
+        pieces[0] << triangle[0], midpoints[0], midpoints[2];
+        pieces[1] << midpoints[0], triangle[1], midpoints[1];
+        pieces[2] << midpoints[2], midpoints[1], triangle[2];
+        pieces[3] << midpoints[0], midpoints[1], midpoints[2];
+        return 4;
+    }
+
+    // rotate so edge 0 is split, and edge 2 too when 2 edges are split
+    int rotation = 0;
+    bool twoEdges = (mask & (mask - 1)) != 0;
+    for (; rotation < 3; rotation++)
+    {
+        bool first = mask & (1 << rotation);
+        bool last = mask & (1 << ((rotation + 2) % 3));
+        if (first && last == twoEdges) break;
+    }
+
+    int v0 = triangle[rotation];
+    int v1 = triangle[(rotation + 1) % 3];
+    int v2 = triangle[(rotation + 2) % 3];
+    int m0 = midpoints[rotation];
+
+    if (!twoEdges)
+    {
+        pieces[0] << v0, m0, v2;
+        pieces[1] << m0, v1, v2;
+        return 2;
+    }
+
+    int m2 = midpoints[(rotation + 2) % 3];
+    pieces[0] << v0, m0, m2;
+    pieces[1] << m0, v1, v2;
+    pieces[2] << m0, v2, m2;
+    return 3;
+}
+
+Subdivision SubdivideByWeightDistance(const Eigen::MatrixXf & vertices,
+    const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights,
+    float threshold, ThreadPool & pool)
+{
+    int restCount = (int) vertices.rows();
+
+    // weights of every vertex, the new ones are appended
+    std::vector<Eigen::SparseVector<float>> vertexWeights(restCount);
+    pool.ParallelFor(restCount, SUBDIVISION_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++) vertexWeights[i] = weights.col(i);
+    });
+
+    std::vector<Eigen::Vector3f> newPositions;
+    auto position = [&](int v) -> Eigen::Vector3f
+    {
+        if (v < restCount) return vertices.row(v);
+        return newPositions[v - restCount];
+    };
+
+    // triangles to test, and triangles under the threshold for good
+    std::vector<Eigen::Vector3i> pending(triangles.rows());
+    for (int t = 0; t < (int) triangles.rows(); t++) pending[t] = triangles.row(t);
+    std::vector<Eigen::Vector3i> done;
+    done.reserve(pending.size());
+
+    std::vector<unsigned char> splitMask;
+    std::vector<Eigen::Vector3i> midpointsOf;
+    std::vector<std::int64_t> pieceStart;
+    std::vector<std::pair<int, int>> splitEdges;
+    std::unordered_map<std::uint64_t, int> midpointOfEdge;
+    std::vector<Eigen::Vector3i> pieces;
+
+    for (int round = 0; round < MAX_SUBDIVISION_ROUNDS && !pending.empty(); round++)
+    {
+        int pendingCount = (int) pending.size();
+
+        // edges over the threshold, both sides of an edge agree
+        splitMask.assign(pendingCount, 0);
+        pool.ParallelFor(pendingCount, SUBDIVISION_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for (int t = begin; t < end; t++)
+            {
+                const auto & triangle = pending[t];
+                for (int e = 0; e < 3; e++)
+                {
+                    if (SkinningWeightDistance(vertexWeights[triangle[e]],
+                        vertexWeights[triangle[(e + 1) % 3]]) > threshold)
+                        splitMask[t] |= 1 << e;
+                }
+            }
+        });
+
+        // one midpoint per split edge, numbered in triangle order
+        // edges that were not split never are later, so the map is per round
+        midpointOfEdge.clear();
+        splitEdges.clear();
+        midpointsOf.assign(pendingCount, Eigen::Vector3i::Constant(-1));
+        pieceStart.assign(pendingCount + 1, 0);
+
+        int firstNew = restCount + (int) newPositions.size();
+        for (int t = 0; t < pendingCount; t++)
+        {
+            const auto & triangle = pending[t];
+            int mask = splitMask[t];
+
+            if (mask == 0)
+            {
+                done.push_back(triangle);
+                pieceStart[t + 1] = pieceStart[t];
+                continue;
+            }
+
+            int splitCount = 0;
+            for (int e = 0; e < 3; e++)
+            {
+                if (!(mask & (1 << e))) continue;
+                splitCount++;
+
+                int a = triangle[e];
+                int b = triangle[(e + 1) % 3];
+                auto inserted = midpointOfEdge.emplace(EdgeKey(a, b),
+                    firstNew + (int) splitEdges.size());
+                if (inserted.second) splitEdges.emplace_back(a, b);
+
+                midpointsOf[t][e] = inserted.first->second;
+            }
+
+            pieceStart[t + 1] = pieceStart[t] + splitCount + 1;
+        }
+
+        // every triangle is done
+        if (splitEdges.empty())
+        {
+            pending.clear();
+            break;
+        }
+
+        if ((std::int64_t) done.size() + pieceStart[pendingCount] > MAX_SUBDIVIDED_TRIANGLES)
+        {
+            std::ostringstream message;
+            message << "Subdivision at threshold " << threshold << " makes more than "
+                << MAX_SUBDIVIDED_TRIANGLES << " triangles, the threshold is too small";
+            throw std::runtime_error(message.str());
+        }
+
+        // midpoints average the ends, which come from earlier rounds
+        int edgeCount = (int) splitEdges.size();
+        newPositions.resize(newPositions.size() + edgeCount);
+        vertexWeights.resize(vertexWeights.size() + edgeCount);
+        pool.ParallelFor(edgeCount, SUBDIVISION_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                int a = splitEdges[i].first;
+                int b = splitEdges[i].second;
+                int m = firstNew + i;
+
+                newPositions[m - restCount] = (position(a) + position(b)) / 2;
+                vertexWeights[m] = (vertexWeights[a] + vertexWeights[b]) / 2;
+            }
+        });
+
+        // pieces are tested again in the next round
+        pieces.resize(pieceStart[pendingCount]);
+        pool.ParallelFor(pendingCount, SUBDIVISION_CHUNK_SIZE, [&](int begin, int end)
+        {
+            for (int t = begin; t < end; t++)
+            {
+                if (splitMask[t] == 0) continue;
+                SplitTriangle(pending[t], midpointsOf[t], splitMask[t],
+                    pieces.data() + pieceStart[t]);
+            }
+        });
+
+        std::swap(pending, pieces);
+    }
+
+    // left over when the round limit is reached
+    done.insert(done.end(), pending.begin(), pending.end());
+
+    Subdivision subdivision;
+
+    subdivision.vertices.resize(newPositions.size(), 3);
+    for (int i = 0; i < (int) newPositions.size(); i++)
+    {
+        subdivision.vertices.row(i) = newPositions[i];
+    }
+
+    subdivision.triangles.resize(done.size(), 3);
+    for (int t = 0; t < (int) done.size(); t++)
+    {
+        subdivision.triangles.row(t) = done[t];
+    }
+
+    std::vector<Eigen::Triplet<float>> triplets;
+    for (int v = 0; v < (int) vertexWeights.size(); v++)
+    {
+        for (Eigen::SparseVector<float>::InnerIterator it(vertexWeights[v]); it; ++it)
+            triplets.emplace_back((int) it.index(), v, it.value());
+    }
+    subdivision.weights.resize(weights.rows(), vertexWeights.size());
+    subdivision.weights.setFromTriplets(triplets.begin(), triplets.end());
+
+    return subdivision;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// most triangles a subdivision may end with, each round can make up to 4
+// pieces of a triangle. The centers integrate over all of them per vertex,
+// so more would not be computed in useful time anyway.
+#define MAX_SUBDIVIDED_TRIANGLES (1 << 22)
+
+// Triangles refined for the integration of the centers of rotation.
+// Vertex indices at or past the rest vertex count refer to the new vertices.
+struct Subdivision
+{
+    // new vertices only, vertex restCount + i is row i
+    Eigen::MatrixXf vertices;
+    // every triangle to integrate over, split or not
+    Eigen::MatrixXi triangles;
+    // weights of the rest vertices followed by the new ones
+    Eigen::SparseMatrix<float> weights;
+};
+
+// norm(weightA - weightB)
+float SkinningWeightDistance(const Eigen::SparseVector<float> & weightA,
+    const Eigen::SparseVector<float> & weightB);
+
+// Splits the triangles until the skinning weight distance along every edge
+// is under the threshold, as the paper does for coarse meshes.
+// Each round splits the too long edges at their midpoint, whose weight is
+// the average of the ends. A midpoint is created once per edge and shared
+// by the triangles on both sides, which are cut in 2, 3 or 4 depending on
+// how many of their edges are split. The result does not depend on the
+// thread count. Throws if the threshold would make more than
+// MAX_SUBDIVIDED_TRIANGLES triangles.
+Subdivision SubdivideByWeightDistance(const Eigen::MatrixXf & vertices,
+    const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights,
+    float threshold, ThreadPool & pool);
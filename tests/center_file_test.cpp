@@ -0,0 +1,119 @@
+#include "Mesh.h"
+#include "check.h"
+#include "serialize.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+// center files are written in the working directory of the test
+#define CENTERS "center_file_test"
+#define SHIFTED_CENTERS "center_file_test_shifted"
+#define SHORT_CENTERS "center_file_test_short"
+
+#define GRID_SIZE 10
+#define BONE_COUNT 3
+
+// Grid blending 3 bones along x
+static Mesh * GridMesh()
+{
+    int vertexCount = GRID_SIZE * GRID_SIZE;
+    Eigen::MatrixXf vertices(vertexCount, 3);
+    Eigen::MatrixXi triangles(2 * (GRID_SIZE - 1) * (GRID_SIZE - 1), 3);
+    std::vector<Eigen::Triplet<float>> triplets;
+
+    for (int y = 0; y < GRID_SIZE; y++)
+    {
+        for (int x = 0; x < GRID_SIZE; x++)
+        {
+            int i = y * GRID_SIZE + x;
+            vertices.row(i) << 0.1f * x, 0.2f * y, 0.01f * x * y;
+
+            float t = (float) x / (GRID_SIZE - 1);
+            if (t < 1) triplets.emplace_back(x < GRID_SIZE / 2 ? 0 : 1, i, 1 - t);
+            if (t > 0) triplets.emplace_back(2, i, t);
+        }
+    }
+    for (int y = 0, t = 0; y + 1 < GRID_SIZE; y++)
+    {
+        for (int x = 0; x + 1 < GRID_SIZE; x++)
+        {
+            int i = y * GRID_SIZE + x;
+            triangles.row(t++) << i, i + 1, i + GRID_SIZE + 1;
+            triangles.row(t++) << i, i + GRID_SIZE + 1, i + GRID_SIZE;
+        }
+    }
+
+    Eigen::SparseMatrix<float> weights(BONE_COUNT, vertexCount);
+    weights.setFromTriplets(triplets.begin(), triplets.end());
+    return new Mesh(vertices, triangles, weights);
+}
+
+// bone 2 turned about z, the others at rest
+static std::vector<float> Skin(Mesh & mesh, std::vector<float> & positions)
+{
+    float rotations[4 * BONE_COUNT] = {0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1};
+    float translations[3 * BONE_COUNT] = {};
+    rotations[4 * 2 + 2] = std::sin(0.5f);
+    rotations[4 * 2 + 3] = std::cos(0.5f);
+    translations[3 * 2 + 1] = 0.3f;
+
+    positions.resize(3 * mesh.GetRestVertexCount());
+    mesh.SkinInto(rotations, translations, positions.data());
+    CHECK(mesh.failureContextMessage.empty());
+    return positions;
+}
+
+int main()
+{
+    std::unique_ptr<Mesh> mesh(GridMesh());
+    CHECK(mesh->ComputeCentersOfRotation());
+    mesh->WriteCentersOfRotation(CENTERS);
+
+    Eigen::MatrixXf centers = ReadVertices(CENTERS ".centers");
+    Eigen::MatrixXf shifted = centers.rowwise() + Eigen::RowVector3f(0.05f, -0.1f, 0.2f);
+    SerializeVertices(shifted, SHIFTED_CENTERS ".centers");
+    // as the text holds them
+    shifted = ReadVertices(SHIFTED_CENTERS ".centers");
+    SerializeVertices(centers.topRows(centers.rows() - 1), SHORT_CENTERS ".centers");
+
+    // skinned in place, then with centers read over the computed ones
+    mesh->SetIncrementalSkinning(true);
+    std::vector<float> positions;
+    auto computed = Skin(*mesh, positions);
+
+    mesh->ReadCentersOfRotation(SHIFTED_CENTERS);
+    CHECK(mesh->failureContextMessage.empty());
+    CHECK(mesh->GetCentersOfRotation() == shifted);
+    auto read = Skin(*mesh, positions);
+    CHECK(read != computed);
+
+    // as skinned by a mesh that only read them
+    std::unique_ptr<Mesh> fresh(GridMesh());
+    fresh->ReadCentersOfRotation(SHIFTED_CENTERS);
+    std::vector<float> freshPositions;
+    CHECK(Skin(*fresh, freshPositions) == read);
+
+    // a file that does not fit leaves the centers as they were,
+    // skinned in full into new buffers
+    mesh->SetIncrementalSkinning(false);
+    for (const char * path : {SHORT_CENTERS, "center_file_test_missing"})
+    {
+        mesh->ReadCentersOfRotation(path);
+        CHECK(!mesh->failureContextMessage.empty());
+        mesh->ResetFailureMessage();
+        CHECK(mesh->GetCentersOfRotation() == shifted);
+        std::vector<float> again;
+        CHECK(Skin(*mesh, again) == read);
+    }
+
+    // or uncomputed on a mesh without centers
+    std::unique_ptr<Mesh> empty(GridMesh());
+    empty->ReadCentersOfRotation(SHORT_CENTERS);
+    CHECK(!empty->failureContextMessage.empty());
+    empty->ResetFailureMessage();
+    std::vector<float> emptyPositions;
+    CHECK(Skin(*empty, emptyPositions) == computed);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+// Stops the test with the failed condition and its line
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// Stops the test unless the statement throws a std::exception
+#define CHECK_THROWS(statement) \
+    do \
+    { \
+        bool isThrown = false; \
+        try \
+        { \
+            statement; \
+        } \
+        catch (const std::exception &) \
+        { \
+            isThrown = true; \
+        } \
+        if (!isThrown) \
+        { \
+            std::fprintf(stderr, "%s:%d: %s did not throw\n", __FILE__, __LINE__, #statement); \
+            std::exit(1); \
+        } \
+    } while (0)
@@ -0,0 +1,206 @@
+"""Writes the glTF fixtures of gltf_import_test next to this script.
+
+One skinned mesh of two primitives, stored three ways:
+  skin.gltf           buffer in "skin data.bin", referenced percent encoded
+  skin_embedded.gltf  buffer in a base64 data URI
+  skin.glb            buffer in the binary chunk
+and skin.expected, the mesh as gltf_import_test reads it back:
+  vertexCount triangleCount jointCount
+  x y z                         per vertex
+  a b c                         per triangle
+  n bone weight ... (n pairs)   per vertex, by bone
+  name node translationX        per joint, of its inverse bind matrix
+
+Primitive 0 is a 6 x 6 grid with unsigned short indices, unsigned byte
+joints and float weights. Primitive 1 is a 4 x 4 grid of unindexed
+triangles, its positions interleaved with unsigned short joints at a
+stride of 20 bytes, with a second joint and weight set, normalized
+unsigned byte weights, and a joint repeated across the sets.
+
+gltf_import_test makes its malformed files from these, with one defect
+each, and expects the import to fail with a message naming it. It writes
+over the buffer at the byte offsets of the views of primitive 0.
+"""
+
+import base64
+import copy
+import json
+import os
+import random
+import struct
+
+FLOAT = 5126
+UNSIGNED_BYTE = 5121
+UNSIGNED_SHORT = 5123
+
+DIRECTORY = os.path.dirname(os.path.abspath(__file__))
+
+
+def f32(value):
+    return struct.unpack('<f', struct.pack('<f', value))[0]
+
+
+def grid(size, x0):
+    vertices = [(f32(x0 + i * 0.1), f32(j * 0.1), f32(0.01 * i * j))
+                for i in range(size) for j in range(size)]
+    triangles = []
+    for i in range(size - 1):
+        for j in range(size - 1):
+            a = i * size + j
+            triangles += [a, a + size, a + 1, a + 1, a + size, a + size + 1]
+    return vertices, triangles
+
+
+class Builder:
+    def __init__(self):
+        self.buffer = bytearray()
+        self.views = []
+        self.accessors = []
+
+    def view(self, data, stride=None):
+        while len(self.buffer) % 4:
+            self.buffer.append(0)
+        view = dict(buffer=0, byteOffset=len(self.buffer), byteLength=len(data))
+        if stride:
+            view['byteStride'] = stride
+        self.views.append(view)
+        self.buffer += data
+        return len(self.views) - 1
+
+    def accessor(self, view, component_type, count, type_name, offset=0, normalized=False):
+        accessor = dict(bufferView=view, componentType=component_type, count=count,
+                        type=type_name, byteOffset=offset)
+        if normalized:
+            accessor['normalized'] = True
+        self.accessors.append(accessor)
+        return len(self.accessors) - 1
+
+
+def build():
+    random.seed(1)
+    builder = Builder()
+    expected_weights = []
+
+    # primitive 0
+    vertices0, triangles0 = grid(6, 0)
+    joints0, weights0 = [], []
+    for x, _, _ in vertices0:
+        bone = min(int(x * 3), 3)
+        weight = f32(round(random.random(), 3))
+        joints0.append([bone, bone + 1, 0, 0])
+        weights0.append([weight, f32(1 - weight), 0, 0])
+        pairs = {bone: weight, bone + 1: f32(1 - weight)}
+        expected_weights.append({joint: value for joint, value in pairs.items() if value != 0})
+
+    position0 = builder.accessor(builder.view(b''.join(struct.pack('<3f', *v) for v in vertices0)),
+                                 FLOAT, len(vertices0), 'VEC3')
+    indices0 = builder.accessor(builder.view(b''.join(struct.pack('<H', i) for i in triangles0)),
+                                UNSIGNED_SHORT, len(triangles0), 'SCALAR')
+    joint0 = builder.accessor(builder.view(b''.join(struct.pack('<4B', *j) for j in joints0)),
+                              UNSIGNED_BYTE, len(vertices0), 'VEC4')
+    weight0 = builder.accessor(builder.view(b''.join(struct.pack('<4f', *w) for w in weights0)),
+                               FLOAT, len(vertices0), 'VEC4')
+
+    # primitive 1, a vertex per corner of a triangle
+    vertices1, triangles1 = grid(4, 1.0)
+    corners = [vertices1[i] for i in triangles1]
+    interleaved = b''.join(struct.pack('<3f4H', *p, 1, 2, 3, 4) for p in corners)
+    view1 = builder.view(interleaved, stride=20)
+    position1 = builder.accessor(view1, FLOAT, len(corners), 'VEC3')
+    joint1 = builder.accessor(view1, UNSIGNED_SHORT, len(corners), 'VEC4', offset=12)
+    weight1 = builder.accessor(builder.view(struct.pack('<4B', 100, 50, 0, 0) * len(corners)),
+                               UNSIGNED_BYTE, len(corners), 'VEC4', normalized=True)
+    joint2 = builder.accessor(builder.view(struct.pack('<4B', 1, 3, 4, 4) * len(corners)),
+                              UNSIGNED_BYTE, len(corners), 'VEC4')
+    weight2 = builder.accessor(builder.view(struct.pack('<4B', 55, 50, 0, 0) * len(corners)),
+                               UNSIGNED_BYTE, len(corners), 'VEC4', normalized=True)
+    for _ in corners:
+        expected_weights.append({1: f32(100 / 255 + 55 / 255), 2: f32(50 / 255), 3: f32(50 / 255)})
+
+    # joint b at x = b
+    inverse_binds = builder.accessor(
+        builder.view(b''.join(struct.pack('<16f', 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, -b, 0, 0, 1)
+                              for b in range(5))),
+        FLOAT, 5, 'MAT4')
+
+    nodes = [{'name': 'root', 'children': [1]}] + [{'name': 'bone%d' % b} for b in range(5)]
+    nodes.append({'mesh': 0, 'skin': 0, 'translation': [5, 5, 5]})
+    gltf = {
+        'asset': {'version': '2.0'},
+        'scenes': [{'nodes': [0, 6]}],
+        'nodes': nodes,
+        'skins': [{'joints': [1, 2, 3, 4, 5], 'inverseBindMatrices': inverse_binds}],
+        'meshes': [{'primitives': [
+            {'attributes': {'POSITION': position0, 'JOINTS_0': joint0, 'WEIGHTS_0': weight0},
+             'indices': indices0},
+            {'attributes': {'POSITION': position1, 'JOINTS_0': joint1, 'WEIGHTS_0': weight1,
+                            'JOINTS_1': joint2, 'WEIGHTS_1': weight2},
+             'mode': 4}]}],
+        'accessors': builder.accessors,
+        'bufferViews': builder.views,
+        'buffers': [{'byteLength': len(builder.buffer)}],
+    }
+
+    expected = {
+        'vertices': vertices0 + corners,
+        'triangles': triangles0 + [len(vertices0) + k for k in range(len(corners))],
+        'weights': expected_weights,
+        'joints': [('bone%d' % b, b + 1, -b) for b in range(5)],
+    }
+    return gltf, bytes(builder.buffer), expected
+
+
+def write_expected(expected):
+    vertices, triangles = expected['vertices'], expected['triangles']
+    with open(os.path.join(DIRECTORY, 'skin.expected'), 'w') as file:
+        file.write('%d %d %d\n' % (len(vertices), len(triangles) // 3, len(expected['joints'])))
+        for vertex in vertices:
+            file.write('%.9g %.9g %.9g\n' % vertex)
+        for t in range(0, len(triangles), 3):
+            file.write('%d %d %d\n' % tuple(triangles[t:t + 3]))
+        for weights in expected['weights']:
+            pairs = sorted(weights.items())
+            file.write('%d %s\n' % (len(pairs), ' '.join('%d %.9g' % pair for pair in pairs)))
+        for joint in expected['joints']:
+            file.write('%s %d %.9g\n' % joint)
+
+
+def embedded(gltf, buffer):
+    gltf = copy.deepcopy(gltf)
+    gltf['buffers'] = [{'byteLength': len(buffer),
+                        'uri': 'data:application/octet-stream;base64,' + base64.b64encode(buffer).decode()}]
+    return gltf
+
+
+def write_json(name, gltf):
+    with open(os.path.join(DIRECTORY, name), 'w') as file:
+        json.dump(gltf, file, indent=1)
+
+
+def write_glb(gltf, buffer):
+    text = json.dumps(gltf).encode()
+    text += b' ' * (-len(text) % 4)
+    data = buffer + b'\0' * (-len(buffer) % 4)
+    length = 12 + 8 + len(text) + 8 + len(data)
+    with open(os.path.join(DIRECTORY, 'skin.glb'), 'wb') as file:
+        file.write(struct.pack('<3I', 0x46546C67, 2, length))
+        file.write(struct.pack('<2I', len(text), 0x4E4F534A) + text)
+        file.write(struct.pack('<2I', len(data), 0x004E4942) + data)
+
+
+def main():
+    gltf, buffer, expected = build()
+
+    external = copy.deepcopy(gltf)
+    external['buffers'][0]['uri'] = 'skin%20data.bin'
+    write_json('skin.gltf', external)
+    with open(os.path.join(DIRECTORY, 'skin data.bin'), 'wb') as file:
+        file.write(buffer)
+
+    write_json('skin_embedded.gltf', embedded(gltf, buffer))
+    write_glb(gltf, buffer)
+    write_expected(expected)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,283 @@
+#include "center_of_rotation_api.h"
+#include "check.h"
+#include "gltf_import.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// fixtures of tests/data, written by make_gltf_fixtures.py
+#define DATA(name) (std::string(TEST_DATA_DIR) + "/" + name)
+
+// edited copies of the fixtures are written in the working directory
+#define EDITED_GLB "gltf_import_test_edited.glb"
+#define EDITED_GLTF "gltf_import_test_edited.gltf"
+#define EDITED_BUFFER "gltf_import_test_edited.bin"
+
+struct ExpectedSkin
+{
+    Eigen::MatrixXf vertices;
+    Eigen::MatrixXi triangles;
+    std::vector<std::vector<std::pair<int, float>>> weights;
+    std::vector<std::string> jointNames;
+    std::vector<int> jointNodes;
+    std::vector<float> inverseBindTranslations;
+};
+
+static ExpectedSkin ReadExpected(const std::string & path)
+{
+    std::ifstream file(path);
+    CHECK(file);
+
+    ExpectedSkin skin;
+    int vertexCount, triangleCount, jointCount;
+    file >> vertexCount >> triangleCount >> jointCount;
+
+    skin.vertices.resize(vertexCount, 3);
+    for (int i = 0; i < vertexCount; i++) file >> skin.vertices(i, 0) >> skin.vertices(i, 1) >> skin.vertices(i, 2);
+    skin.triangles.resize(triangleCount, 3);
+    for (int t = 0; t < triangleCount; t++) file >> skin.triangles(t, 0) >> skin.triangles(t, 1) >> skin.triangles(t, 2);
+
+    skin.weights.resize(vertexCount);
+    for (auto & weights : skin.weights)
+    {
+        int count;
+        file >> count;
+        weights.resize(count);
+        for (auto & weight : weights) file >> weight.first >> weight.second;
+    }
+
+    skin.jointNames.resize(jointCount);
+    skin.jointNodes.resize(jointCount);
+    skin.inverseBindTranslations.resize(jointCount);
+    for (int j = 0; j < jointCount; j++)
+        file >> skin.jointNames[j] >> skin.jointNodes[j] >> skin.inverseBindTranslations[j];
+
+    CHECK(file);
+    return skin;
+}
+
+static void CheckWeights(const Eigen::SparseMatrix<float> & weights, const ExpectedSkin & expected)
+{
+    CHECK(weights.cols() == expected.vertices.rows());
+    CHECK(weights.rows() == (int) expected.jointNames.size());
+    for (int i = 0; i < weights.cols(); i++)
+    {
+        size_t k = 0;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it, ++k)
+        {
+            CHECK(k < expected.weights[i].size());
+            CHECK(it.row() == expected.weights[i][k].first);
+            // normalized bytes are summed in float
+            CHECK(std::abs(it.value() - expected.weights[i][k].second) <= 1e-6f);
+        }
+        CHECK(k == expected.weights[i].size());
+    }
+}
+
+static void TestEncodings(const ExpectedSkin & expected)
+{
+    for (const char * name : {"skin.gltf", "skin_embedded.gltf", "skin.glb"})
+    {
+        auto skin = ReadGltfSkin(DATA(name));
+
+        CHECK(skin.vertices == expected.vertices);
+        CHECK(skin.triangles == expected.triangles);
+        CheckWeights(skin.weights, expected);
+
+        CHECK(skin.jointNames == expected.jointNames);
+        CHECK(skin.jointNodes == expected.jointNodes);
+        CHECK(skin.inverseBindMatrices.size() == expected.jointNames.size());
+        for (size_t j = 0; j < skin.inverseBindMatrices.size(); j++)
+        {
+            Eigen::Matrix4f matrix = Eigen::Matrix4f::Identity();
+            matrix(0, 3) = expected.inverseBindTranslations[j];
+            CHECK(skin.inverseBindMatrices[j] == matrix);
+        }
+
+        std::unique_ptr<Mesh> mesh(ReadGltfMesh(DATA(name)));
+        CHECK(mesh->GetVertices() == expected.vertices);
+        CHECK(mesh->GetFaces() == expected.triangles);
+        CheckWeights(mesh->GetWeights(), expected);
+    }
+}
+
+static std::vector<char> ReadBytes(const std::string & path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteBytes(const std::string & path, const std::vector<char> & bytes)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), (std::streamsize) bytes.size());
+}
+
+static std::string ReadText(const std::string & path)
+{
+    auto bytes = ReadBytes(path);
+    return std::string(bytes.begin(), bytes.end());
+}
+
+// the message of the failed import, empty if it succeeds
+static std::string ImportError(const std::string & path)
+{
+    try
+    {
+        ReadGltfSkin(path);
+    }
+    catch (const std::exception & e)
+    {
+        return e.what();
+    }
+    return "";
+}
+
+static void CheckError(const char * defect, const std::string & path, const char * expected)
+{
+    auto message = ImportError(path);
+    if (message.find(expected) == std::string::npos)
+    {
+        std::fprintf(stderr, "%s: expected '%s', got '%s'\n", defect, expected, message.c_str());
+        CHECK(false);
+    }
+}
+
+template <typename T>
+static std::string Bytes(T value)
+{
+    return std::string(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void TestMalformed()
+{
+    // skin_embedded.gltf with text replaced once, and the part of the
+    // message naming the defect
+    struct TextDefect
+    {
+        const char * from;
+        const char * to;
+        const char * message;
+    };
+    const TextDefect textDefects[] = {
+        {"\"byteStride\": 20", "\"byteStride\": 22", "invalid stride"},
+        {"\"byteStride\": 20", "\"byteStride\": 256", "invalid stride"},
+        {"\"byteStride\": 20", "\"byteStride\": 4503599627370496", "invalid stride"},
+        // the interleaved positions
+        {"\"bufferView\": 4,\n   \"componentType\": 5126,\n   \"count\": 54",
+            "\"bufferView\": 4,\n   \"componentType\": 5126,\n   \"count\": 2147483647", "past its buffer view"},
+        {"\"bufferView\": 4,\n   \"componentType\": 5126,\n   \"count\": 54",
+            "\"bufferView\": 4,\n   \"componentType\": 5126,\n   \"count\": 55", "past its buffer view"},
+        // their view, then the buffer
+        {"\"byteLength\": 1080", "\"byteLength\": 3500", "buffer view past its buffer"},
+        {"\"byteLength\": 3500", "\"byteLength\": 3504", "shorter than its byteLength"},
+        {"\"bufferView\": 3,", "\"bufferView\": 3, \"sparse\": {\"count\": 1},", "sparse"},
+        {"\"skin\": 0,", "", "No node with a mesh and a skin"},
+        {"\"mode\": 4", "\"mode\": 5", "not a triangle list"},
+    };
+
+    const auto text = ReadText(DATA("skin_embedded.gltf"));
+    for (const auto & defect : textDefects)
+    {
+        auto at = text.find(defect.from);
+        CHECK(at != std::string::npos && text.find(defect.from, at + 1) == std::string::npos);
+        auto edited = text;
+        edited.replace(at, std::strlen(defect.from), defect.to);
+        WriteBytes(EDITED_GLTF, std::vector<char>(edited.begin(), edited.end()));
+        CheckError(defect.to, EDITED_GLTF, defect.message);
+    }
+
+    // bytes written over "skin data.bin", at offsets of its buffer views in
+    // skin.gltf: indices at 432, joints at 732 and weights at 876 for
+    // primitive 0, 4 bytes per joint and 16 per weight
+    struct BufferDefect
+    {
+        size_t offset;
+        std::string bytes;
+        const char * message;
+    };
+    const BufferDefect bufferDefects[] = {
+        {876 + 16 * 3 + 4, Bytes(-0.5f), "Invalid weight at vertex 3"},
+        {876 + 16 * 3, Bytes(INFINITY), "Invalid weight at vertex 3"},
+        {732 + 4 * 3, Bytes((uint8_t) 5), "Joint out of range at vertex 3"},
+        {432 + 2 * 7, Bytes((uint16_t) 36), "index out of range"},
+        // last, read again through the C API below
+        {876 + 16 * 3 + 4, Bytes(NAN), "Invalid weight at vertex 3"},
+    };
+
+    auto gltf = ReadText(DATA("skin.gltf"));
+    const std::string uri = "skin%20data.bin";
+    gltf.replace(gltf.find(uri), uri.size(), EDITED_BUFFER);
+    WriteBytes(EDITED_GLTF, std::vector<char>(gltf.begin(), gltf.end()));
+
+    const auto buffer = ReadBytes(DATA("skin data.bin"));
+    for (const auto & defect : bufferDefects)
+    {
+        auto edited = buffer;
+        CHECK(defect.offset + defect.bytes.size() <= edited.size());
+        std::copy(defect.bytes.begin(), defect.bytes.end(), edited.begin() + defect.offset);
+        WriteBytes(EDITED_BUFFER, edited);
+        CheckError(defect.message, EDITED_GLTF, defect.message);
+    }
+
+    // the C API returns a null mesh carrying the error
+    Mesh * mesh = LoadGltfMesh(EDITED_GLTF);
+    const char * message = HasFailedMeshConstruction(mesh);
+    CHECK(std::string(message).find("Invalid weight") != std::string::npos);
+    FreeErrorMessage(message);
+    DestroyMesh(mesh);
+
+    std::string nesting = std::string(1000, '[') + std::string(1000, ']');
+    WriteBytes(EDITED_GLTF, std::vector<char>(nesting.begin(), nesting.end()));
+    CheckError("nesting", EDITED_GLTF, "Too deeply nested");
+    CheckError("missing", "gltf_import_test_missing.gltf", "Cannot open");
+}
+
+static bool IsReadable(const std::vector<char> & bytes)
+{
+    WriteBytes(EDITED_GLB, bytes);
+    try
+    {
+        ReadGltfSkin(EDITED_GLB);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+static void TestCorruptGlb()
+{
+    const auto bytes = ReadBytes(DATA("skin.glb"));
+    CHECK(IsReadable(bytes));
+
+    // every truncation is found
+    for (size_t size = 0; size < bytes.size(); size++)
+        CHECK(!IsReadable(std::vector<char>(bytes.begin(), bytes.begin() + size)));
+
+    // changed bytes throw or read a mesh, without reading out of the file
+    for (size_t b = 0; b < bytes.size(); b++)
+    {
+        auto edited = bytes;
+        edited[b] ^= 0xFF;
+        IsReadable(edited);
+    }
+}
+
+int main()
+{
+    auto expected = ReadExpected(DATA("skin.expected"));
+    TestEncodings(expected);
+    TestMalformed();
+    TestCorruptGlb();
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include "check.h"
+#include "mesh_bundle.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// bundles are written in the working directory of the test
+#define RAW_BUNDLE "mesh_bundle_test.bundle"
+#define COMPRESSED_BUNDLE "mesh_bundle_test_compressed.bundle"
+#define CORRUPT_BUNDLE "mesh_bundle_test_corrupt.bundle"
+#define COPY_BUNDLE "mesh_bundle_test_copy.bundle"
+
+#define GRID_SIZE 12
+
+struct TestMesh
+{
+    Eigen::MatrixXf vertices;
+    Eigen::MatrixXi triangles;
+    Eigen::SparseMatrix<float> weights;
+    std::vector<int> indexOfCenter;
+    Eigen::MatrixXf centers;
+};
+
+// Grid blending 3 bones along x, one center per row of vertices,
+// none on the first row
+static TestMesh GridMesh()
+{
+    TestMesh mesh;
+    int vertexCount = GRID_SIZE * GRID_SIZE;
+    mesh.vertices.resize(vertexCount, 3);
+    mesh.triangles.resize(2 * (GRID_SIZE - 1) * (GRID_SIZE - 1), 3);
+    std::vector<Eigen::Triplet<float>> triplets;
+
+    for (int y = 0; y < GRID_SIZE; y++)
+    {
+        for (int x = 0; x < GRID_SIZE; x++)
+        {
+            int i = y * GRID_SIZE + x;
+            mesh.vertices.row(i) << 0.1f * x, 0.25f * y, 0.01f * x * y;
+
+            float t = (float) x / (GRID_SIZE - 1);
+            if (t < 1) triplets.emplace_back(x < GRID_SIZE / 2 ? 0 : 1, i, 1 - t);
+            if (t > 0) triplets.emplace_back(2, i, t);
+
+            mesh.indexOfCenter.push_back(y - 1);
+        }
+    }
+    for (int y = 0, t = 0; y + 1 < GRID_SIZE; y++)
+    {
+        for (int x = 0; x + 1 < GRID_SIZE; x++)
+        {
+            int i = y * GRID_SIZE + x;
+            mesh.triangles.row(t++) << i, i + 1, i + GRID_SIZE + 1;
+            mesh.triangles.row(t++) << i, i + GRID_SIZE + 1, i + GRID_SIZE;
+        }
+    }
+
+    mesh.weights.resize(3, vertexCount);
+    mesh.weights.setFromTriplets(triplets.begin(), triplets.end());
+    mesh.weights.makeCompressed();
+
+    mesh.centers.resize(GRID_SIZE - 1, 3);
+    for (int c = 0; c < GRID_SIZE - 1; c++) mesh.centers.row(c) << 0.55f, 0.25f * (c + 1), -0.3f;
+    return mesh;
+}
+
+static void Write(const TestMesh & mesh, const std::string & path, const SkinCompression * compression)
+{
+    WriteMeshBundle(path, mesh.vertices, mesh.triangles, mesh.weights,
+        mesh.indexOfCenter, mesh.centers, compression);
+}
+
+static std::vector<char> ReadBytes(const std::string & path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteBytes(const std::string & path, const std::vector<char> & bytes)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), (std::streamsize) bytes.size());
+}
+
+// the header of the bundle, to edit
+static MeshBundleHeader & Header(std::vector<char> & bytes)
+{
+    return *reinterpret_cast<MeshBundleHeader *>(bytes.data());
+}
+
+// int32 k of a section
+static void SetInt(std::vector<char> & bytes, MeshBundleSection section, int k, int32_t value)
+{
+    std::memcpy(bytes.data() + Header(bytes).sectionOffset[(int) section] + 4 * k, &value, sizeof(value));
+}
+
+static bool IsReadable(const std::vector<char> & bytes)
+{
+    WriteBytes(CORRUPT_BUNDLE, bytes);
+    try
+    {
+        delete ReadMeshBundle(CORRUPT_BUNDLE);
+        return true;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+static void TestRaw(const TestMesh & expected)
+{
+    Write(expected, RAW_BUNDLE, nullptr);
+
+    // the arrays are there in place
+    {
+        MeshBundle bundle(RAW_BUNDLE);
+        CHECK(!bundle.IsCompressed() && bundle.HasCenters());
+        CHECK(bundle.GetCenterCount() == expected.centers.rows());
+        CHECK(std::vector<int>(bundle.GetCenterIndex(), bundle.GetCenterIndex() + bundle.GetVertexCount())
+            == expected.indexOfCenter);
+    }
+
+    std::unique_ptr<Mesh> mesh(ReadMeshBundle(RAW_BUNDLE));
+    CHECK(mesh->GetVertices() == expected.vertices);
+    CHECK(mesh->GetFaces() == expected.triangles);
+    CHECK(Eigen::MatrixXf(mesh->GetWeights()) == Eigen::MatrixXf(expected.weights));
+    CHECK(mesh->GetCentersOfRotation() == expected.centers);
+}
+
+static void TestCompressed(const TestMesh & expected)
+{
+    SkinCompression compression;
+    compression.weightBits = 8;
+    compression.centerBits = 12;
+    Write(expected, COMPRESSED_BUNDLE, &compression);
+
+    // smaller than the arrays
+    CHECK(ReadBytes(COMPRESSED_BUNDLE).size() < ReadBytes(RAW_BUNDLE).size());
+
+    std::unique_ptr<Mesh> mesh(ReadMeshBundle(COMPRESSED_BUNDLE));
+    CHECK(mesh->GetVertices() == expected.vertices);
+    CHECK(mesh->GetFaces() == expected.triangles);
+
+    float weightBound = 1.0f / (2 * 255) + FLT_EPSILON;
+    Eigen::MatrixXf weights = mesh->GetWeights();
+    CHECK(mesh->GetWeights().nonZeros() == expected.weights.nonZeros());
+    CHECK((weights - Eigen::MatrixXf(expected.weights)).cwiseAbs().maxCoeff() <= weightBound);
+
+    // written out again without compression for the center of each vertex
+    mesh->SerializeBundle(COPY_BUNDLE);
+    MeshBundle copy(COPY_BUNDLE);
+    CHECK(std::vector<int>(copy.GetCenterIndex(), copy.GetCenterIndex() + copy.GetVertexCount())
+        == expected.indexOfCenter);
+
+    Eigen::Array3f lower = expected.vertices.colwise().minCoeff()
+        .cwiseMin(expected.centers.colwise().minCoeff()).transpose();
+    Eigen::Array3f upper = expected.vertices.colwise().maxCoeff()
+        .cwiseMax(expected.centers.colwise().maxCoeff()).transpose();
+    Eigen::Array3f centerBound = (upper - lower) / (2 * 4095.0f) + 4 * FLT_EPSILON;
+    const auto & centers = mesh->GetCentersOfRotation();
+    CHECK(centers.rows() == expected.centers.rows());
+    for (int c = 0; c < centers.rows(); c++)
+        CHECK(((centers.row(c) - expected.centers.row(c)).transpose().array().abs() <= centerBound).all());
+}
+
+static void TestVersion1()
+{
+    // a bundle of the first version is a raw one of version 1
+    auto bytes = ReadBytes(RAW_BUNDLE);
+    Header(bytes).version = 1;
+    CHECK(IsReadable(bytes));
+
+    // which had no compression
+    auto compressed = ReadBytes(COMPRESSED_BUNDLE);
+    Header(compressed).version = 1;
+    CHECK(!IsReadable(compressed));
+}
+
+static void TestMalformed()
+{
+    CHECK_THROWS(ReadMeshBundle("mesh_bundle_test_missing.bundle"));
+
+    for (const char * path : {RAW_BUNDLE, COMPRESSED_BUNDLE})
+    {
+        const auto bytes = ReadBytes(path);
+
+        // truncated files are found
+        for (size_t size = 0; size < bytes.size(); size += 7)
+        {
+            auto truncated = bytes;
+            truncated.resize(size);
+            CHECK(!IsReadable(truncated));
+        }
+
+        auto edited = bytes;
+        edited[0] = 'X';
+        CHECK(!IsReadable(edited));
+
+        edited = bytes;
+        Header(edited).version = MESH_BUNDLE_VERSION + 1;
+        CHECK(!IsReadable(edited));
+
+        edited = bytes;
+        Header(edited).flags |= 2;
+        CHECK(!IsReadable(edited));
+
+        edited = bytes;
+        Header(edited).vertexCount = -1;
+        CHECK(!IsReadable(edited));
+
+        edited = bytes;
+        Header(edited).sectionOffset[(int) MeshBundleSection::Vertices] += 1;
+        CHECK(!IsReadable(edited));
+
+        edited = bytes;
+        Header(edited).sectionSize[(int) MeshBundleSection::Triangles] = ~0ull;
+        CHECK(!IsReadable(edited));
+
+        // indices of the mesh out of range
+        edited = bytes;
+        SetInt(edited, MeshBundleSection::Triangles, 1, Header(edited).vertexCount);
+        CHECK(!IsReadable(edited));
+    }
+
+    // raw weights and centers out of range or order
+    auto bytes = ReadBytes(RAW_BUNDLE);
+    auto header = Header(bytes);
+
+    auto edited = bytes;
+    SetInt(edited, MeshBundleSection::WeightBones, 0, header.boneCount);
+    CHECK(!IsReadable(edited));
+
+    edited = bytes;
+    SetInt(edited, MeshBundleSection::WeightStart, 1, header.weightCount + 1);
+    CHECK(!IsReadable(edited));
+
+    edited = bytes;
+    SetInt(edited, MeshBundleSection::CenterIndex, 0, header.centerCount);
+    CHECK(!IsReadable(edited));
+
+    // corrupt compressed streams throw or give a well formed mesh
+    bytes = ReadBytes(COMPRESSED_BUNDLE);
+    header = Header(bytes);
+    for (int s = (int) MeshBundleSection::WeightBones; s < (int) MeshBundleSection::Count; s++)
+    {
+        for (uint64_t b = 0; b < header.sectionSize[s]; b++)
+        {
+            edited = bytes;
+            edited[header.sectionOffset[s] + b] ^= 0xFF;
+            IsReadable(edited);
+        }
+    }
+}
+
+int main()
+{
+    auto mesh = GridMesh();
+    TestRaw(mesh);
+    TestCompressed(mesh);
+    TestVersion1();
+    TestMalformed();
+    return 0;
+}
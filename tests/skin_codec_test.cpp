@@ -0,0 +1,269 @@
+#include "check.h"
+#include "skin_codec.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#define VERTEX_COUNT 300
+#define BONE_COUNT 40
+
+// 0 to 4 bones per vertex, weights summing to 1
+static Eigen::SparseMatrix<float> RandomWeights(std::mt19937 & random)
+{
+    std::vector<Eigen::Triplet<float>> triplets;
+    for (int i = 0; i < VERTEX_COUNT; i++)
+    {
+        int count = i % 5;
+        std::vector<int> bones;
+        while ((int) bones.size() < count)
+        {
+            int bone = (int) (random() % BONE_COUNT);
+            if (std::find(bones.begin(), bones.end(), bone) == bones.end()) bones.push_back(bone);
+        }
+
+        std::vector<float> values(count);
+        float sum = 0;
+        for (auto & value : values) sum += value = std::uniform_real_distribution<float>(0.01f, 1)(random);
+        for (int k = 0; k < count; k++) triplets.emplace_back(bones[k], i, values[k] / sum);
+    }
+
+    Eigen::SparseMatrix<float> weights(BONE_COUNT, VERTEX_COUNT);
+    weights.setFromTriplets(triplets.begin(), triplets.end());
+    weights.makeCompressed();
+    return weights;
+}
+
+static Eigen::SparseMatrix<float> Decode(const std::vector<uint8_t> & bones,
+    const std::vector<uint8_t> & values, int weightCount)
+{
+    return DecodeWeights(bones.data(), bones.size(), values.data(), values.size(),
+        BONE_COUNT, VERTEX_COUNT, weightCount);
+}
+
+// a corrupt stream either throws or decodes to well formed weights
+static void CheckCorruptWeights(const std::vector<uint8_t> & bones,
+    const std::vector<uint8_t> & values, int weightCount)
+{
+    try
+    {
+        auto weights = Decode(bones, values, weightCount);
+        CHECK(weights.rows() == BONE_COUNT && weights.cols() == VERTEX_COUNT);
+        CHECK(weights.nonZeros() == weightCount);
+        for (int i = 0; i < VERTEX_COUNT; i++)
+        {
+            int previous = -1;
+            for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+            {
+                CHECK(it.row() > previous && it.row() < BONE_COUNT);
+                CHECK(it.value() >= 0 && std::isfinite(it.value()));
+                previous = (int) it.row();
+            }
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+}
+
+static void TestWeights(std::mt19937 & random)
+{
+    auto weights = RandomWeights(random);
+    int weightCount = (int) weights.nonZeros();
+    float largest = weights.coeffs().maxCoeff();
+
+    for (int bits : {1, 4, 8, 12, 16})
+    {
+        std::vector<uint8_t> bones, values;
+        EncodeWeights(weights, bits, bones, values);
+        auto decoded = Decode(bones, values, weightCount);
+
+        // same bones, values within half a step of the grid
+        float bound = largest / (2 * (float) ((1 << bits) - 1)) + largest * FLT_EPSILON;
+        CHECK(decoded.nonZeros() == weightCount);
+        for (int i = 0; i < VERTEX_COUNT; i++)
+        {
+            Eigen::SparseMatrix<float>::InnerIterator expected(weights, i), it(decoded, i);
+            for (; expected && it; ++expected, ++it)
+            {
+                CHECK(it.row() == expected.row());
+                CHECK(std::abs(it.value() - expected.value()) <= bound);
+            }
+            CHECK(!expected && !it);
+        }
+
+        // every truncation is detected, and so is trailing data
+        for (size_t size = 0; size < bones.size(); size++)
+            CHECK_THROWS(DecodeWeights(bones.data(), size, values.data(), values.size(),
+                BONE_COUNT, VERTEX_COUNT, weightCount));
+        for (size_t size = 0; size < values.size(); size++)
+            CHECK_THROWS(DecodeWeights(bones.data(), bones.size(), values.data(), size,
+                BONE_COUNT, VERTEX_COUNT, weightCount));
+        auto longer = values;
+        longer.push_back(0);
+        CHECK_THROWS(Decode(bones, longer, weightCount));
+        CHECK_THROWS(Decode(bones, values, weightCount - 1));
+        CHECK_THROWS(Decode(bones, values, weightCount + 1));
+
+        for (size_t b = 0; b < bones.size(); b++)
+        {
+            for (uint8_t mask : {0x01, 0x80, 0xFF})
+            {
+                auto corrupt = bones;
+                corrupt[b] ^= mask;
+                CheckCorruptWeights(corrupt, values, weightCount);
+            }
+        }
+        for (size_t b = 0; b < values.size(); b++)
+        {
+            auto corrupt = values;
+            corrupt[b] ^= 0xFF;
+            CheckCorruptWeights(bones, corrupt, weightCount);
+        }
+    }
+
+    std::vector<uint8_t> bones, values;
+    CHECK_THROWS(EncodeWeights(weights, 0, bones, values));
+    CHECK_THROWS(EncodeWeights(weights, 17, bones, values));
+
+    Eigen::SparseMatrix<float> negative = weights;
+    negative.coeffs()[0] = -0.5f;
+    CHECK_THROWS(EncodeWeights(negative, 8, bones, values));
+}
+
+// zigzag varint of the center streams
+static void WriteSigned(std::vector<uint8_t> & bytes, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    for (; zigzag >= 0x80; zigzag >>= 7) bytes.push_back((uint8_t) (zigzag | 0x80));
+    bytes.push_back((uint8_t) zigzag);
+}
+
+// Two centers on an 8 bit grid, the second one a delta away from the top
+// of the grid
+static std::vector<uint8_t> CenterDeltaStream(int64_t delta)
+{
+    std::vector<uint8_t> coordinates = {8};
+    const float grid[6] = {0, 0, 0, 1, 1, 1};
+    const auto * gridBytes = reinterpret_cast<const uint8_t *>(grid);
+    coordinates.insert(coordinates.end(), gridBytes, gridBytes + sizeof(grid));
+    for (int64_t value : {(int64_t) 255, (int64_t) 0, (int64_t) 0, delta, (int64_t) 0, (int64_t) 0})
+        WriteSigned(coordinates, value);
+    return coordinates;
+}
+
+// deltas past the grid throw before they are summed
+static void TestCenterDeltas()
+{
+    const std::vector<uint8_t> index = {1, 1};
+    std::vector<int> decodedIndex;
+    Eigen::MatrixXf decoded;
+
+    auto coordinates = CenterDeltaStream(-255);
+    DecodeCenters(index.data(), index.size(), coordinates.data(), coordinates.size(),
+        2, 2, decodedIndex, decoded);
+    CHECK(decoded(0, 0) == 255 && decoded(1, 0) == 0);
+
+    for (int64_t delta : {(int64_t) 1, (int64_t) -256, INT64_MAX, INT64_MIN})
+    {
+        coordinates = CenterDeltaStream(delta);
+        CHECK_THROWS(DecodeCenters(index.data(), index.size(), coordinates.data(), coordinates.size(),
+            2, 2, decodedIndex, decoded));
+    }
+}
+
+static void TestCenters(std::mt19937 & random)
+{
+    std::uniform_real_distribution<float> coordinate(-1, 1);
+    Eigen::MatrixXf vertices(VERTEX_COUNT, 3);
+    for (int i = 0; i < VERTEX_COUNT; i++)
+        vertices.row(i) << coordinate(random), coordinate(random), coordinate(random);
+
+    // numbered by first vertex like computed centers, shared by 3 vertices,
+    // some vertices without one
+    std::vector<int> indexOfCenter(VERTEX_COUNT);
+    int centerCount = 0;
+    for (int i = 0; i < VERTEX_COUNT; i++)
+    {
+        if (i % 7 == 0) indexOfCenter[i] = -1;
+        else if (i % 3 == 0 || centerCount == 0) indexOfCenter[i] = centerCount++;
+        else indexOfCenter[i] = (int) (random() % centerCount);
+    }
+    // some centers out of the bounding box of the vertices
+    Eigen::MatrixXf centers = 1.5f * Eigen::MatrixXf::Random(centerCount, 3);
+
+    Eigen::Array3f lower = vertices.colwise().minCoeff().cwiseMin(centers.colwise().minCoeff()).transpose();
+    Eigen::Array3f upper = vertices.colwise().maxCoeff().cwiseMax(centers.colwise().maxCoeff()).transpose();
+
+    for (int bits : {1, 8, 16, 24})
+    {
+        std::vector<uint8_t> index, coordinates;
+        EncodeCenters(vertices, indexOfCenter, centers, bits, index, coordinates);
+
+        std::vector<int> decodedIndex;
+        Eigen::MatrixXf decoded;
+        DecodeCenters(index.data(), index.size(), coordinates.data(), coordinates.size(),
+            VERTEX_COUNT, centerCount, decodedIndex, decoded);
+
+        CHECK(decodedIndex == indexOfCenter);
+        CHECK(decoded.rows() == centerCount && decoded.cols() == 3);
+        Eigen::Array3f bound = (upper - lower) / (2 * (float) ((1 << bits) - 1)) + 4 * FLT_EPSILON;
+        for (int c = 0; c < centerCount; c++)
+            CHECK(((decoded.row(c) - centers.row(c)).transpose().array().abs() <= bound).all());
+
+        for (size_t size = 0; size < index.size(); size++)
+            CHECK_THROWS(DecodeCenters(index.data(), size, coordinates.data(), coordinates.size(),
+                VERTEX_COUNT, centerCount, decodedIndex, decoded));
+        for (size_t size = 0; size < coordinates.size(); size++)
+            CHECK_THROWS(DecodeCenters(index.data(), index.size(), coordinates.data(), size,
+                VERTEX_COUNT, centerCount, decodedIndex, decoded));
+        CHECK_THROWS(DecodeCenters(index.data(), index.size(), coordinates.data(), coordinates.size(),
+            VERTEX_COUNT, centerCount - 1, decodedIndex, decoded));
+
+        // corrupt streams throw or decode to indices in range
+        for (int stream = 0; stream < 2; stream++)
+        {
+            auto & bytes = stream == 0 ? index : coordinates;
+            for (size_t b = 0; b < bytes.size(); b++)
+            {
+                bytes[b] ^= 0xFF;
+                try
+                {
+                    DecodeCenters(index.data(), index.size(), coordinates.data(), coordinates.size(),
+                        VERTEX_COUNT, centerCount, decodedIndex, decoded);
+                    CHECK((int) decodedIndex.size() == VERTEX_COUNT && decoded.rows() == centerCount);
+                    for (int c : decodedIndex) CHECK(c >= -1 && c < centerCount);
+                }
+                catch (const std::exception &)
+                {
+                }
+                bytes[b] ^= 0xFF;
+            }
+        }
+    }
+
+    std::vector<uint8_t> index, coordinates;
+    CHECK_THROWS(EncodeCenters(vertices, indexOfCenter, centers, 0, index, coordinates));
+    CHECK_THROWS(EncodeCenters(vertices, indexOfCenter, centers, 25, index, coordinates));
+
+    auto outOfRange = indexOfCenter;
+    outOfRange[1] = centerCount;
+    CHECK_THROWS(EncodeCenters(vertices, outOfRange, centers, 16, index, coordinates));
+
+    Eigen::MatrixXf infinite = centers;
+    infinite(0, 0) = INFINITY;
+    CHECK_THROWS(EncodeCenters(vertices, indexOfCenter, infinite, 16, index, coordinates));
+
+    TestCenterDeltas();
+}
+
+int main()
+{
+    std::mt19937 random(7);
+    TestWeights(random);
+    TestCenters(random);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#else
+#define CPU_RELAX() std::this_thread::yield()
+#endif
+
+ThreadPool::ThreadPool(int threadCount, int spinCount)
+    : spinCount(std::max(0, spinCount))
+{
+    int hardwareThreads = std::max(1, (int) std::thread::hardware_concurrency());
+    if (threadCount <= 0) threadCount = hardwareThreads;
+
+    // spinning threads would take the time of the working ones
+    if (threadCount > hardwareThreads) this->spinCount = 0;
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        ranges.push_back(std::make_unique<WorkRange>());
+    }
+
+    // slot 0 belongs to the thread calling ParallelFor
+    for (int i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping.store(true);
+    }
+    wake.notify_all();
+
+    for (auto &&worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::WorkerLoop(int slot)
+{
+    unsigned long long seen = 0;
+
+    while (true)
+    {
+        auto isWoken = [&]{ return stopping.load() || generation.load() != seen; };
+
+        for (int i = 0; i < spinCount && !isWoken(); i++) CPU_RELAX();
+
+        if (!isWoken())
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            parkedWorkers++;
+            wake.wait(guard, isWoken);
+            parkedWorkers--;
+        }
+
+        if (stopping.load()) return;
+        seen = generation.load();
+
+        RunSlot(slot);
+
+        if (activeWorkers.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            if (isCallerParked) done.notify_one();
+        }
+    }
+}
+
+// Work on this slot, then on stolen work, until nothing is left
+void ThreadPool::RunSlot(int slot)
+{
+    int begin, end;
+    while (TakeChunk(slot, begin, end) || (Steal(slot) && TakeChunk(slot, begin, end)))
+    {
+        try
+        {
+            (*task)(begin, end);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(failureLock);
+            if (!failure) failure = std::current_exception();
+        }
+    }
+}
+
+// Pop one chunk from the front of this slot
+bool ThreadPool::TakeChunk(int slot, int & begin, int & end)
+{
+    auto & range = *ranges[slot];
+    std::lock_guard<std::mutex> guard(range.lock);
+
+    if (range.begin >= range.end) return false;
+
+    begin = range.begin;
+    end = std::min(range.end, range.begin + grain);
+    range.begin = end;
+    return true;
+}
+
+// Move the back half of another slot into this one, at least a chunk
+bool ThreadPool::Steal(int slot)
+{
+    int slotCount = (int) ranges.size();
+
+    for (int offset = 1; offset < slotCount; offset++)
+    {
+        auto & victim = *ranges[(slot + offset) % slotCount];
+
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            // leave the victim at least the chunk it is about to take,
+            // a range of a chunk or less is left to its owner
+            int size = victim.end - victim.begin;
+            if (size <= grain) continue;
+
+            begin = victim.end - std::min(std::max(size / 2, grain), size - grain);
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        auto & own = *ranges[slot];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.begin = begin;
+        own.end = end;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::ParallelFor(int count, int grain,
+    const std::function<void(int, int)> & task)
+{
+    if (count <= 0) return;
+
+    grain = std::max(1, grain);
+    if (count <= grain || workers.empty())
+    {
+        task(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> job(jobLock);
+
+    this->task = &task;
+    this->grain = grain;
+    this->failure = nullptr;
+
+    // contiguous initial slices, stealing balances the rest
+    int slotCount = (int) ranges.size();
+    for (int i = 0; i < slotCount; i++)
+    {
+        ranges[i]->begin = (int) ((long long) count * i / slotCount);
+        ranges[i]->end = (int) ((long long) count * (i + 1) / slotCount);
+    }
+
+    // the job is published before the generation, which spinning workers see
+    bool isAnyoneParked;
+    activeWorkers.store((int) workers.size());
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        generation.fetch_add(1);
+        isAnyoneParked = parkedWorkers > 0;
+    }
+    if (isAnyoneParked) wake.notify_all();
+
+    RunSlot(0);
+
+    // stolen chunks usually finish soon after the caller runs dry
+    auto isDone = [&]{ return activeWorkers.load() == 0; };
+    for (int i = 0; i < spinCount && !isDone(); i++) CPU_RELAX();
+
+    if (!isDone())
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        isCallerParked = true;
+        done.wait(guard, isDone);
+        isCallerParked = false;
+    }
+
+    this->task = nullptr;
+
+    if (failure) std::rethrow_exception(failure);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// polls of an idle thread before it parks, a few tens of microseconds
+#define THREAD_POOL_SPIN_COUNT 2000
+
+// Persistent pool of worker threads.
+// Work is handed out as index ranges; every participant owns a slice of the
+// range and steals half of another participant's slice when it runs dry.
+// The calling thread takes part in the work, so a pool of 1 thread is serial.
+// Idle workers spin for a while before they park on a condition variable,
+// so jobs issued back to back, like the frames of an animation, start
+// without a kernel round trip.
+class ThreadPool
+{
+private:
+
+    // a slice of the index range owned by one participant
+    struct alignas(64) WorkRange
+    {
+        std::mutex lock;
+        int begin = 0;
+        int end = 0;
+    };
+
+    std::vector<std::thread> workers;
+    // one slice per participant, the caller is slot 0
+    std::vector<std::unique_ptr<WorkRange>> ranges;
+
+    // serializes calls to ParallelFor
+    std::mutex jobLock;
+
+    // Wake up and completion signals. Spinning threads watch the atomics,
+    // the condition variables are only notified when someone is parked.
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<unsigned long long> generation{0};
+    std::atomic<int> activeWorkers{0};
+    std::atomic<bool> stopping{false};
+    int parkedWorkers = 0;
+    bool isCallerParked = false;
+    int spinCount;
+
+    // current job
+    const std::function<void(int, int)> * task = nullptr;
+    int grain = 1;
+
+    // first exception thrown by the current job
+    std::mutex failureLock;
+    std::exception_ptr failure;
+
+    void WorkerLoop(int slot);
+    void RunSlot(int slot);
+    bool TakeChunk(int slot, int & begin, int & end);
+    bool Steal(int slot);
+
+public:
+    // 0 means one thread per hardware thread, spinCount is the number of
+    // polls before an idle thread parks, 0 parks right away, as do
+    // pools with more threads than the hardware
+    explicit ThreadPool(int threadCount = 0, int spinCount = THREAD_POOL_SPIN_COUNT);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    // caller included
+    int GetThreadCount() const {return (int) ranges.size();}
+
+    // Calls task(begin, end) on disjoint chunks covering [0, count)
+    // of at most grain indices. Blocks until every chunk is done and
+    // rethrows the first exception thrown by a chunk.
+    // A single chunk runs on the calling thread without waking the workers.
+    void ParallelFor(int count, int grain,
+        const std::function<void(int, int)> & task);
+};
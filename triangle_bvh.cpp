@@ -0,0 +1,232 @@
+#include "triangle_bvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+
+// triangles per leaf
+#define BVH_LEAF_SIZE 8
+
+TriangleBVH::TriangleBVH(const TriangleCache & triangles)
+    : triangles(&triangles)
+{
+    int triangleCount = triangles.GetTriangleCount();
+
+    centroids.reserve(triangleCount);
+    for (int i = 0; i < triangleCount; i++)
+    {
+        centroids.push_back(triangles.GetCentroid(i));
+        order.push_back(i);
+    }
+
+    if (triangleCount > 0)
+    {
+        nodes.reserve(2 * (triangleCount / BVH_LEAF_SIZE + 1));
+        Build(0, triangleCount);
+    }
+}
+
+// Builds the node of order[first, first + count) and returns its index
+int TriangleBVH::Build(int first, int count)
+{
+    int index = (int) nodes.size();
+    nodes.emplace_back();
+    nodes[index].first = first;
+    nodes[index].count = count;
+
+    if (count <= BVH_LEAF_SIZE)
+    {
+        auto & leaf = nodes[index];
+
+        // bone -> lowest weight, highest weight, triangles having the bone
+        std::map<int, std::tuple<float, float, int>> ranges;
+
+        for (int i = first; i < first + count; i++)
+        {
+            int t = order[i];
+            auto area = triangles->GetArea(t);
+
+            leaf.centroidBox.extend(centroids[t]);
+            leaf.area += area;
+            leaf.weightedCentroid += area * centroids[t];
+
+            const int * bones = triangles->GetWeightBones(t);
+            const float * values = triangles->GetWeightValues(t);
+
+            for (int b = 0; b < triangles->GetWeightCount(t); b++)
+            {
+                auto found = ranges.find(bones[b]);
+                if (found == ranges.end())
+                {
+                    ranges[bones[b]] = std::make_tuple(values[b], values[b], 1);
+                    continue;
+                }
+                auto & [lowest, highest, present] = found->second;
+                lowest = std::min(lowest, values[b]);
+                highest = std::max(highest, values[b]);
+                present++;
+            }
+        }
+
+        // a triangle without the bone weighs 0 on it
+        for (const auto & [bone, range] : ranges)
+        {
+            auto [lowest, highest, present] = range;
+            if (present < count)
+            {
+                lowest = std::min(lowest, 0.0f);
+                highest = std::max(highest, 0.0f);
+            }
+            leaf.bounds.push_back(WeightBound{bone, lowest, highest});
+        }
+
+        return index;
+    }
+
+    // split at the median of the longest axis
+    Eigen::AlignedBox3f box;
+    for (int i = first; i < first + count; i++)
+    {
+        box.extend(centroids[order[i]]);
+    }
+    int axis;
+    box.sizes().maxCoeff(&axis);
+
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half,
+        order.begin() + first + count,
+        [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    int left = Build(first, half);
+    int right = Build(first + half, count - half);
+
+    // nodes may have moved while building the children
+    auto & node = nodes[index];
+    node.left = left;
+    node.right = right;
+    Aggregate(node, nodes[left], nodes[right]);
+
+    return index;
+}
+
+void TriangleBVH::Aggregate(Node & node, const Node & left, const Node & right)
+{
+    node.centroidBox = left.centroidBox.merged(right.centroidBox);
+    node.area = left.area + right.area;
+    node.weightedCentroid = left.weightedCentroid + right.weightedCentroid;
+
+    // merge the sorted bounds, a bone missing on one side weighs 0 there
+    auto widen = [](WeightBound bound)
+    {
+        bound.lower = std::min(bound.lower, 0.0f);
+        bound.upper = std::max(bound.upper, 0.0f);
+        return bound;
+    };
+
+    size_t l = 0, r = 0;
+    while (l < left.bounds.size() || r < right.bounds.size())
+    {
+        if (r == right.bounds.size()
+            || (l < left.bounds.size() && left.bounds[l].bone < right.bounds[r].bone))
+        {
+            node.bounds.push_back(widen(left.bounds[l++]));
+        }
+        else if (l == left.bounds.size() || right.bounds[r].bone < left.bounds[l].bone)
+        {
+            node.bounds.push_back(widen(right.bounds[r++]));
+        }
+        else
+        {
+            node.bounds.push_back(WeightBound{left.bounds[l].bone,
+                std::min(left.bounds[l].lower, right.bounds[r].lower),
+                std::max(left.bounds[l].upper, right.bounds[r].upper)});
+            l++;
+            r++;
+        }
+    }
+}
+
+// With s~ the similarity used for an accepted node and s the exact one,
+// P~ - P = sum (s~ - s) A (c - P) / D~ over accepted triangles, so with
+// R the distance from P~ to a node's centroids and d its similarity spread
+// |P~ - P| <= sum d A R / D~ / (1 - sum d A / D~)
+float TriangleBVH::Accumulate(const Eigen::SparseVector<float> & weight,
+    float relativeSpread, Eigen::Vector3f & nominator, float & denominator) const
+{
+    nominator.setZero();
+    denominator = 0;
+
+    if (nodes.empty()) return 0;
+
+    // accepted nodes and their spread, to bound the error afterwards
+    std::vector<std::pair<int, float>> accepted;
+
+    std::vector<int> stack;
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        const auto & node = nodes[stack.back()];
+        int index = stack.back();
+        stack.pop_back();
+
+        float lower, upper;
+        BoundSimilarity(weight, node.bounds, lower, upper);
+
+        // no triangle of this node contributes
+        if (upper <= 0 && lower >= 0) continue;
+
+        float spread = (upper - lower) / 2;
+        float middle = (upper + lower) / 2;
+
+        if (spread <= relativeSpread * std::abs(middle))
+        {
+            nominator += middle * node.weightedCentroid;
+            denominator += middle * node.area;
+            if (spread > 0) accepted.emplace_back(index, spread);
+        }
+        else if (node.left == -1)
+        {
+            for (int i = node.first; i < node.first + node.count; i++)
+            {
+                int t = order[i];
+                auto similarity = ComputeSimilarity(weight, triangles->GetWeightBones(t),
+                    triangles->GetWeightValues(t), triangles->GetWeightCount(t));
+                auto area = triangles->GetArea(t);
+
+                nominator += similarity * centroids[t] * area;
+                denominator += similarity * area;
+            }
+        }
+        else
+        {
+            stack.push_back(node.right);
+            stack.push_back(node.left);
+        }
+    }
+
+    if (accepted.empty()) return 0;
+    if (denominator <= 0) return std::numeric_limits<float>::infinity();
+
+    Eigen::Vector3f center = nominator / denominator;
+
+    float distanceSum = 0;
+    float spreadSum = 0;
+    for (const auto & [index, spread] : accepted)
+    {
+        const auto & box = nodes[index].centroidBox;
+
+        // farthest corner of the box
+        Eigen::Vector3f farthest = (box.min() - center).cwiseAbs()
+            .cwiseMax((box.max() - center).cwiseAbs());
+
+        distanceSum += spread * nodes[index].area * farthest.norm();
+        spreadSum += spread * nodes[index].area;
+    }
+
+    float ratio = spreadSum / denominator;
+    if (ratio >= 1) return std::numeric_limits<float>::infinity();
+
+    return distanceSum / denominator / (1 - ratio);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "similarity.h"
+#include "triangle_cache.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <Eigen/Sparse>
+
+#include <vector>
+
+// Bounding volume hierarchy over the triangles of a mesh, used to
+// approximate the center of rotation integral like Barnes-Hut.
+// Each node aggregates the area and area weighted centroid of its triangles
+// with the range of their weights, so a whole node can be skipped when it
+// cannot contribute or be accepted with one similarity when the range of
+// similarities over the node is narrow.
+class TriangleBVH
+{
+private:
+
+    struct Node
+    {
+        // bounds of the triangle centroids
+        Eigen::AlignedBox3f centroidBox;
+
+        float area = 0;
+        // sum of area * centroid
+        Eigen::Vector3f weightedCentroid = Eigen::Vector3f::Zero();
+
+        // range of the triangle weights, per bone
+        std::vector<WeightBound> bounds;
+
+        // children, -1 for leaves
+        int left = -1;
+        int right = -1;
+
+        // triangles of the node are order[first, first + count)
+        int first = 0;
+        int count = 0;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> order;
+
+    const TriangleCache * triangles = nullptr;
+    std::vector<Eigen::Vector3f> centroids;
+
+    int Build(int first, int count);
+    void Aggregate(Node & node, const Node & left, const Node & right);
+
+public:
+    TriangleBVH(const TriangleCache & triangles);
+
+    // Accumulates the nominator and denominator of the center of rotation.
+    // A node is accepted as a whole when the spread of its similarity range
+    // is under relativeSpread times its midpoint, 0 only accepts constant ranges.
+    // Returns a bound on the distance between nominator / denominator and
+    // the exact center, infinite when no bound can be given.
+    float Accumulate(const Eigen::SparseVector<float> & weight, float relativeSpread,
+        Eigen::Vector3f & nominator, float & denominator) const;
+};
@@ -0,0 +1,192 @@
+#include "triangle_cache.h"
+#include "area.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#define TRIANGLE_CHUNK_SIZE 1024
+
+// Visits the union of the bones of 3 weights in increasing order with
+// their sum in the order of (weightA + weightB + weightC), like Eigen
+template <typename Visit>
+static void MergeCornerWeights(const Eigen::SparseMatrix<float> & weights,
+    const Eigen::Vector3i & triangle, const Visit & visit)
+{
+    Eigen::SparseMatrix<float>::InnerIterator itA(weights, triangle.x());
+    Eigen::SparseMatrix<float>::InnerIterator itB(weights, triangle.y());
+    Eigen::SparseMatrix<float>::InnerIterator itC(weights, triangle.z());
+
+    const int none = std::numeric_limits<int>::max();
+
+    while (itA || itB || itC)
+    {
+        int bone = std::min({
+            itA ? (int) itA.index() : none,
+            itB ? (int) itB.index() : none,
+            itC ? (int) itC.index() : none});
+
+        float sum = 0;
+        bool started = false;
+        for (auto * it : {&itA, &itB, &itC})
+        {
+            if (*it && it->index() == bone)
+            {
+                sum = started ? sum + it->value() : it->value();
+                started = true;
+                ++(*it);
+            }
+        }
+
+        visit(bone, sum);
+    }
+}
+
+TriangleCache::TriangleCache(const Eigen::MatrixXf & vertices, const Eigen::MatrixXi & triangles,
+    const Eigen::SparseMatrix<float> & weights, ThreadPool & pool)
+{
+    int triangleCount = (int) triangles.rows();
+
+    cornerSumX.resize(triangleCount);
+    cornerSumY.resize(triangleCount);
+    cornerSumZ.resize(triangleCount);
+    areas.resize(triangleCount);
+    weightStart.assign(triangleCount + 1, 0);
+
+    // geometry and size of every triangle weight
+    pool.ParallelFor(triangleCount, TRIANGLE_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            Eigen::Vector3i triangle = triangles.row(i);
+
+            Eigen::Vector3f vertexA = vertices.row(triangle.x());
+            Eigen::Vector3f vertexB = vertices.row(triangle.y());
+            Eigen::Vector3f vertexC = vertices.row(triangle.z());
+
+            Eigen::Vector3f cornerSum = vertexA + vertexB + vertexC;
+            cornerSumX[i] = cornerSum.x();
+            cornerSumY[i] = cornerSum.y();
+            cornerSumZ[i] = cornerSum.z();
+
+            areas[i] = area(vertexA, vertexB, vertexC);
+
+            int count = 0;
+            MergeCornerWeights(weights, triangle, [&](int, float) { count++; });
+            weightStart[i + 1] = count;
+        }
+    });
+
+    for (int i = 0; i < triangleCount; i++)
+    {
+        weightStart[i + 1] += weightStart[i];
+    }
+
+    weightBones.resize(weightStart[triangleCount]);
+    weightValues.resize(weightStart[triangleCount]);
+
+    // weight of a triangle is the average of its vertices
+    pool.ParallelFor(triangleCount, TRIANGLE_CHUNK_SIZE, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+        {
+            int slot = weightStart[i];
+            MergeCornerWeights(weights, triangles.row(i), [&](int bone, float sum)
+            {
+                weightBones[slot] = bone;
+                weightValues[slot] = sum / 3;
+                slot++;
+            });
+        }
+    });
+}
+
+int TriangleCache::GetMaximumWeightCount() const
+{
+    int largest = 0;
+    for (int i = 0; i < GetTriangleCount(); i++)
+    {
+        largest = std::max(largest, GetWeightCount(i));
+    }
+    return largest;
+}
+
+void TriangleCache::UpdateWeights(const std::vector<int> & changedTriangles,
+    const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights)
+{
+    int triangleCount = GetTriangleCount();
+
+    std::vector<int> newStart(triangleCount + 1, 0);
+    std::vector<int> newBones;
+    std::vector<float> newValues;
+    newBones.reserve(weightBones.size());
+    newValues.reserve(weightValues.size());
+
+    // spans of unchanged triangles are copied, changed ones are merged again
+    size_t next = 0;
+    for (int i = 0; i < triangleCount; i++)
+    {
+        if (next < changedTriangles.size() && changedTriangles[next] == i)
+        {
+            MergeCornerWeights(weights, triangles.row(i), [&](int bone, float sum)
+            {
+                newBones.push_back(bone);
+                newValues.push_back(sum / 3);
+            });
+            next++;
+        }
+        else
+        {
+            newBones.insert(newBones.end(), GetWeightBones(i), GetWeightBones(i) + GetWeightCount(i));
+            newValues.insert(newValues.end(), GetWeightValues(i), GetWeightValues(i) + GetWeightCount(i));
+        }
+
+        newStart[i + 1] = (int) newBones.size();
+    }
+
+    weightStart = std::move(newStart);
+    weightBones = std::move(newBones);
+    weightValues = std::move(newValues);
+}
+
+template <typename T>
+static void WriteArray(std::ostream & stream, const std::vector<T> & array)
+{
+    auto count = (long long) array.size();
+    stream.write((const char *) &count, sizeof(count));
+    stream.write((const char *) array.data(), count * sizeof(T));
+}
+
+template <typename T>
+static void ReadArray(std::istream & stream, std::vector<T> & array)
+{
+    long long count = 0;
+    stream.read((char *) &count, sizeof(count));
+    if (!stream || count < 0) throw std::runtime_error("Truncated triangle cache");
+
+    array.resize(count);
+    stream.read((char *) array.data(), count * sizeof(T));
+    if (!stream) throw std::runtime_error("Truncated triangle cache");
+}
+
+void TriangleCache::Write(std::ostream & stream) const
+{
+    WriteArray(stream, cornerSumX);
+    WriteArray(stream, cornerSumY);
+    WriteArray(stream, cornerSumZ);
+    WriteArray(stream, areas);
+    WriteArray(stream, weightStart);
+    WriteArray(stream, weightBones);
+    WriteArray(stream, weightValues);
+}
+
+void TriangleCache::Read(std::istream & stream)
+{
+    ReadArray(stream, cornerSumX);
+    ReadArray(stream, cornerSumY);
+    ReadArray(stream, cornerSumZ);
+    ReadArray(stream, areas);
+    ReadArray(stream, weightStart);
+    ReadArray(stream, weightBones);
+    ReadArray(stream, weightValues);
+}
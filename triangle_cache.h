@@ -0,0 +1,74 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Per triangle data of the center of rotation precomputation,
+// laid out as a structure of arrays so the integration over triangles
+// streams through memory without per triangle heap objects.
+// It only depends on the rest pose and weights, so it is built once per mesh.
+class TriangleCache
+{
+private:
+    // Sum of the 3 corners, 3 times the centroid.
+    // The division by 3 stays in the integration loop
+    // to keep the rounding of the sums.
+    std::vector<float> cornerSumX;
+    std::vector<float> cornerSumY;
+    std::vector<float> cornerSumZ;
+
+    std::vector<float> areas;
+
+    // Triangle weights, the average of the corner weights, in compressed
+    // sparse rows: the bones of triangle t are in [weightStart[t], weightStart[t + 1])
+    std::vector<int> weightStart;
+    std::vector<int> weightBones;
+    std::vector<float> weightValues;
+
+public:
+    TriangleCache() {}
+    TriangleCache(const Eigen::MatrixXf & vertices, const Eigen::MatrixXi & triangles,
+        const Eigen::SparseMatrix<float> & weights, ThreadPool & pool);
+
+    int GetTriangleCount() const {return (int) areas.size();}
+
+    Eigen::Vector3f GetCornerSum(int triangle) const
+    {
+        return Eigen::Vector3f(cornerSumX[triangle], cornerSumY[triangle], cornerSumZ[triangle]);
+    }
+    Eigen::Vector3f GetCentroid(int triangle) const {return GetCornerSum(triangle) / 3;}
+    float GetArea(int triangle) const {return areas[triangle];}
+
+    // bones of the triangle weight, sorted, with their weights
+    int GetWeightCount(int triangle) const
+    {
+        return weightStart[triangle + 1] - weightStart[triangle];
+    }
+    const int * GetWeightBones(int triangle) const
+    {
+        return weightBones.data() + weightStart[triangle];
+    }
+    const float * GetWeightValues(int triangle) const
+    {
+        return weightValues.data() + weightStart[triangle];
+    }
+
+    // most bones on one triangle
+    int GetMaximumWeightCount() const;
+
+    // Binary copy of the cache, to keep chunks of triangles on disk.
+    // Read throws if the stream ends early.
+    void Write(std::ostream & stream) const;
+    void Read(std::istream & stream);
+
+    // Recompute the weights of the given triangles, sorted,
+    // after the weights of their vertices changed
+    void UpdateWeights(const std::vector<int> & changedTriangles,
+        const Eigen::MatrixXi & triangles, const Eigen::SparseMatrix<float> & weights);
+};
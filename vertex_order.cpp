@@ -0,0 +1,78 @@
+#include "vertex_order.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+
+// Interleaves the low 10 bits of x, y and z
+static uint32_t MortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    auto spread = [](uint32_t value)
+    {
+        value &= 0x3ff;
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+std::vector<int> LocalityVertexOrder(const Eigen::MatrixXf & restPositions,
+    const Eigen::SparseMatrix<float> & weights, const std::vector<int> & indexOfCenter)
+{
+    int vertexCount = (int) restPositions.rows();
+    std::vector<int> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0);
+    if (vertexCount == 0) return order;
+
+    // position on the curve, in the bounding box split 1024 times per axis
+    Eigen::RowVector3f lowest = restPositions.colwise().minCoeff();
+    Eigen::RowVector3f extent = restPositions.colwise().maxCoeff() - lowest;
+    std::vector<uint32_t> codes(vertexCount);
+    for (int i = 0; i < vertexCount; i++)
+    {
+        uint32_t cell[3];
+        for (int c = 0; c < 3; c++)
+        {
+            float unit = extent[c] > 0 ? (restPositions(i, c) - lowest[c]) / extent[c] : 0;
+            cell[c] = (uint32_t) std::min(1023.0f, std::max(0.0f, unit * 1023.0f));
+        }
+        codes[i] = MortonCode(cell[0], cell[1], cell[2]);
+    }
+
+    // bones of each vertex, sorted since the weights are column major,
+    // stored entries counted like in the layout
+    std::vector<int> boneStart(vertexCount + 1, 0);
+    std::vector<int> bones;
+    for (int i = 0; i < vertexCount; i++)
+    {
+        for (Eigen::SparseMatrix<float>::InnerIterator it(weights, i); it; ++it)
+            bones.push_back((int) it.index());
+        boneStart[i + 1] = (int) bones.size();
+    }
+
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        bool aHasCenter = indexOfCenter[a] != -1;
+        bool bHasCenter = indexOfCenter[b] != -1;
+        if (aHasCenter != bHasCenter) return aHasCenter;
+
+        int aCount = boneStart[a + 1] - boneStart[a];
+        int bCount = boneStart[b + 1] - boneStart[b];
+        if (aCount != bCount) return aCount < bCount;
+
+        for (int k = 0; k < aCount; k++)
+        {
+            int aBone = bones[boneStart[a] + k];
+            int bBone = bones[boneStart[b] + k];
+            if (aBone != bBone) return aBone < bBone;
+        }
+
+        if (codes[a] != codes[b]) return codes[a] < codes[b];
+        return a < b;
+    });
+
+    return order;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <vector>
+
+// Order of the vertices in the skinning layout, order[p] is the vertex
+// stored at position p. Vertices with a center of rotation come first, then
+// vertices are grouped by number of bones and by bone set, and ordered along
+// a Morton curve of their rest position within a bone set. Blocks of the
+// layout then hold vertices that read the same bones and take the same path.
+// indexOfCenter is -1 for vertices without a center.
+std::vector<int> LocalityVertexOrder(const Eigen::MatrixXf & restPositions,
+    const Eigen::SparseMatrix<float> & weights, const std::vector<int> & indexOfCenter);
@@ -0,0 +1,51 @@
+#include "weight_signature.h"
+
+#include <cmath>
+#include <cstring>
+
+// FNV-1a over the bones and values
+std::size_t WeightSignatureHash::operator()(const WeightSignature & signature) const
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    auto mix = [&](uint64_t word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    };
+
+    for (int i = 0; i < (int) signature.bones.size(); i++)
+    {
+        mix((uint64_t) signature.bones[i]);
+        mix((uint64_t) signature.values[i]);
+    }
+
+    return (std::size_t) hash;
+}
+
+WeightSignature MakeWeightSignature(const Eigen::SparseVector<float> & weight,
+    float tolerance)
+{
+    WeightSignature signature;
+    signature.bones.reserve(weight.nonZeros());
+    signature.values.reserve(weight.nonZeros());
+
+    for (Eigen::SparseVector<float>::InnerIterator it(weight); it; ++it)
+    {
+        signature.bones.push_back((int) it.index());
+
+        if (tolerance > 0)
+        {
+            signature.values.push_back(std::llround(it.value() / tolerance));
+        }
+        else
+        {
+            uint32_t bits;
+            float value = it.value();
+            std::memcpy(&bits, &value, sizeof(bits));
+            signature.values.push_back(bits);
+        }
+    }
+
+    return signature;
+}
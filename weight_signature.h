@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Eigen/Sparse>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Key of a skin weight column.
+// The center of rotation only depends on the weights of a vertex,
+// so vertices with the same signature share the same center.
+struct WeightSignature
+{
+    std::vector<int> bones;
+    // bit pattern of the weight, or the weight divided by the tolerance
+    std::vector<int64_t> values;
+
+    bool operator==(const WeightSignature & other) const
+    {
+        return bones == other.bones && values == other.values;
+    }
+};
+
+struct WeightSignatureHash
+{
+    std::size_t operator()(const WeightSignature & signature) const;
+};
+
+// A tolerance of 0 keys on the exact weights,
+// otherwise weights are rounded to multiples of the tolerance
+WeightSignature MakeWeightSignature(const Eigen::SparseVector<float> & weight,
+    float tolerance);